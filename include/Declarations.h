@@ -11,10 +11,20 @@
 #define VOXELS_API __declspec(dllimport)
 #endif
 
-#define VOXELS_CDECL __cdecl
+#define VOXELS_CDECL __cdecl
+
+#elif defined(__GNUC__)
+
+#ifdef VOXELS_EXPORT
+#define VOXELS_API __attribute__((visibility("default")))
+#else
+#define VOXELS_API
+#endif
+
+#define VOXELS_CDECL
 
 #else
 
-#pragma error Voxels currently supports Windows only.
+#pragma error Voxels currently supports Windows and GCC/Clang only.
 
 #endif
\ No newline at end of file
@@ -24,7 +24,8 @@ public:
 
 	virtual ~MaterialMap() {};
 
-	/// Provides the material mapping for a specific material id
+	/// Provides the material mapping for a specific material id.
+	/// Called for all the ids when a polygonization starts.
 	/// @param id the material id to map
 	/// @return a maping to texture ids
 	virtual Material* GetMaterial(unsigned char id) const = 0;
@@ -5,6 +5,7 @@
 
 #include "Structs.h"
 #include "MaterialMap.h"
+#include "TaskExecutor.h"
 
 namespace Voxels
 {
@@ -47,6 +48,86 @@ struct VOXELS_API PolygonVertex
 	} Textures;
 };
 
+/// Quantized version of PolygonVertex - 16 bytes instead of 48.
+/// Output only when the polygonizer runs with VF_Compact
+///
+struct VOXELS_API CompactPolygonVertex
+{
+	/// Position relative to the block the vertex belongs to. Every component
+	/// is decoded as MinimalCorner + (Position / 65535) * (MaximalCorner - MinimalCorner)
+	unsigned short Position[3];
+
+	/// The same adjacency mask as the W component of PolygonVertex::SecondaryPosition.
+	/// Vertices with a mask come first in the vertex array, so the vertex with
+	/// index i has its secondary position at index i of the secondary positions table.
+	unsigned char TransitionFlags;
+
+	/// Same as PolygonVertex::Textures::TextureIndices::Blend
+	///
+	unsigned char Blend;
+
+	/// Octahedral-encoded normal - each component is a signed normalized value
+	///
+	signed char Normal[2];
+
+	/// Texture ids - same as the ones in PolygonVertex::Textures::TextureIndices
+	///
+	unsigned char Uxz;
+	unsigned char Txz;
+	unsigned char Uny;
+	unsigned char Upy;
+	unsigned char Tny;
+	unsigned char Tpy;
+};
+
+/// Quantized secondary position of a CompactPolygonVertex. Decoded like
+/// CompactPolygonVertex::Position
+struct VOXELS_API CompactSecondaryPosition
+{
+	unsigned short Position[3];
+	unsigned short Reserved;
+};
+
+/// A range of the indices of a block whose triangles have the same material
+///
+struct VOXELS_API MaterialIndexRange
+{
+	/// The material of the triangles - the one of at least two of their
+	/// vertices or of the first vertex if all three differ
+	unsigned char Material;
+	/// The position of the first index of the range in the indices of the block
+	unsigned FirstIndex;
+	/// The count of indices in the range
+	unsigned IndicesCount;
+};
+
+/// A cluster of adjacent triangles of a block with bounds for culling. The
+/// triangles of a meshlet are a range of the indices of the block.
+struct VOXELS_API Meshlet
+{
+	static const unsigned MAX_VERTICES = 64;
+	static const unsigned MAX_TRIANGLES = 124;
+
+	/// The position of the first index of the meshlet in the indices of the block
+	unsigned FirstIndex;
+	/// The count of indices in the meshlet - at most 3 * MAX_TRIANGLES
+	unsigned IndicesCount;
+	/// The count of distinct vertices the triangles use - at most MAX_VERTICES
+	unsigned VerticesCount;
+
+	/// Bounding sphere of the triangles
+	float3 Center;
+	float Radius;
+
+	/// Normal cone of the triangles. All of them face away from a viewer at
+	/// position V if dot(normalize(ConeApex - V), ConeAxis) >= ConeCutoff.
+	/// The front of a triangle is the side its vertex normals point to.
+	/// ConeAxis is zero if the triangles face too different directions.
+	float3 ConeApex;
+	float3 ConeAxis;
+	float ConeCutoff;
+};
+
 /// Contains all the polygons in a block of the surface
 ///
 class BlockPolygons
@@ -67,8 +148,8 @@ public:
 		Face_Count
 	};
 
-	/// Unique ID of the block. A polygonizer instance will generate unique IDs
-	/// on every run.
+	/// Unique ID of the block. The ID depends only on the LOD level and the position
+	/// of the block, so a block keeps its ID when the surface is modified.
 	/// @return the ID of the block
 	virtual unsigned GetId() const = 0;
 
@@ -103,6 +184,75 @@ public:
 	/// Returns the coordinates of the maximal corner of the polygonized surface
 	/// @return maximal corner coordinates
 	virtual float3 GetMaximalCorner() const = 0;
+
+	/// Returns the minimal corner of the tight bounding box of the polygons of the
+	/// block - the vertices, the transition vertices and the secondary positions.
+	/// It is inside the box of GetMinimalCorner and GetMaximalCorner.
+	/// @return minimal corner coordinates
+	virtual float3 GetPolygonsMinimalCorner() const = 0;
+
+	/// Returns the maximal corner of the tight bounding box of the polygons of the block
+	/// @return maximal corner coordinates
+	virtual float3 GetPolygonsMaximalCorner() const = 0;
+
+	/// Returns the quantized vertices of the block. Available only when the surface
+	/// was polygonized with VF_Compact - GetVertices returns nothing in that case.
+	/// @param count output param with the count of vertices
+	/// @return an array of "count" vertices
+	virtual const CompactPolygonVertex* GetCompactVertices(unsigned* count) const = 0;
+
+	/// 16-bit indices for the compact vertices. If the block has too many vertices
+	/// to address with 16 bits, nullptr is returned and the 32-bit indices are
+	/// available through GetIndices.
+	/// @param count output param with the count of indices
+	/// @return an array of "count" indices
+	virtual const unsigned short* GetCompactIndices(unsigned* count) const = 0;
+
+	/// Secondary positions for the compact vertices that have a transition mask.
+	/// @param count output param with the count of positions
+	/// @return an array of "count" positions
+	virtual const CompactSecondaryPosition* GetCompactSecondaryPositions(unsigned* count) const = 0;
+
+	/// Quantized transition vertices generated for a specific face of the block
+	/// @param face the ID of the face of the block
+	/// @param count output param with the count of vertices
+	/// @return an array of "count" vertices
+	virtual const CompactPolygonVertex* GetCompactTransitionVertices(TransitionFaceId face, unsigned* count) const = 0;
+
+	/// 16-bit transition indices generated for a specific face of the block.
+	/// The same fallback to GetTransitionIndices as in GetCompactIndices applies.
+	/// @param face the ID of the face of the block
+	/// @param count output param with the count of indices
+	/// @return an array of "count" indices
+	virtual const unsigned short* GetCompactTransitionIndices(TransitionFaceId face, unsigned* count) const = 0;
+
+	/// Secondary positions for the compact transition vertices of a face
+	/// @param face the ID of the face of the block
+	/// @param count output param with the count of positions
+	/// @return an array of "count" positions
+	virtual const CompactSecondaryPosition* GetCompactTransitionSecondaryPositions(TransitionFaceId face, unsigned* count) const = 0;
+
+	/// Returns the vertex positions of the block. Available only when the surface
+	/// was polygonized with VF_Collision - they are indexed by GetIndices.
+	/// @param count output param with the count of positions
+	/// @return an array of "count" positions
+	virtual const float3* GetPositions(unsigned* count) const = 0;
+
+	/// Ranges of the indices of the block with the triangles of a single material,
+	/// ordered by material. Available only when the surface was polygonized with
+	/// PolygonizationOptions::GroupIndicesByMaterial. The ranges apply both to
+	/// GetIndices and GetCompactIndices. The transition meshes are not grouped.
+	/// @param count output param with the count of ranges
+	/// @return an array of "count" ranges
+	virtual const MaterialIndexRange* GetMaterialRanges(unsigned* count) const = 0;
+
+	/// Meshlets of the block, in the order of their indices. Available only when the
+	/// surface was polygonized with PolygonizationOptions::BuildMeshlets. They cover
+	/// all the indices of GetIndices and GetCompactIndices and every meshlet is inside
+	/// a single material range. The transition meshes are not split in meshlets.
+	/// @param count output param with the count of meshlets
+	/// @return an array of "count" meshlets
+	virtual const Meshlet* GetMeshlets(unsigned* count) const = 0;
 };
 
 /// Statistics provided about the polygonization process
@@ -125,12 +275,158 @@ struct VOXELS_API PolygonizationStatistics
 	///
 	unsigned DegenerateTrianglesRemoved;
 
+	/// The count of triangles reordered by the vertex cache optimization.
+	/// Zero if the optimization is disabled.
+	unsigned CacheOptimizedTriangles;
+
+	/// Vertex cache misses of the optimized triangles before and after the
+	/// optimization, simulated with a 16-entry FIFO cache. Divide by
+	/// CacheOptimizedTriangles to get the average cache miss ratio (ACMR).
+	unsigned VertexCacheMissesBefore;
+	unsigned VertexCacheMissesAfter;
+
+	/// The count of triangles removed by the simplification of the blocks
+	///
+	unsigned SimplificationTrianglesRemoved;
+
 	static const unsigned CASES_COUNT = 16;
 	/// Counts for all the cell cases encountered
 	///
 	unsigned PerCaseCellsCount[CASES_COUNT];
 };
 
+/// Layout of the vertices output by the polygonizer
+///
+enum VertexFormat
+{
+	/// PolygonVertex with 32-bit indices
+	///
+	VF_Full = 0,
+	/// CompactPolygonVertex with 16-bit indices and a side table
+	/// of secondary positions
+	VF_Compact,
+	/// Only positions and 32-bit indices for collision and physics. Only
+	/// level 0 is polygonized, without normals, materials, secondary positions
+	/// and transition meshes, and the vertices with equal positions are welded.
+	/// The positions are available through BlockPolygons::GetPositions.
+	VF_Collision,
+};
+
+/// The algorithm that builds the polygons of the blocks
+///
+enum MeshingMethod
+{
+	/// TransVoxel - marching cubes cells with transition cells between the
+	/// LOD levels. The most accurate surface.
+	///
+	MM_TransVoxel = 0,
+	/// Surface Nets - a single vertex in every cell with a surface and a quad
+	/// over every edge the surface crosses. Produces fewer vertices and is faster,
+	/// but rounds the sharp features. Instead of transition meshes the blocks have
+	/// a skirt on every face - draw it when the neighbor across the face is of
+	/// another LOD level.
+	MM_SurfaceNets,
+};
+
+/// Options that control the polygonization process
+///
+struct VOXELS_API PolygonizationOptions
+{
+	/// Creates the default options
+	///
+	PolygonizationOptions();
+
+	/// The layout of the output vertices. Modifications of a surface always
+	/// use the format the surface was created with.
+	VertexFormat OutputFormat;
+
+	/// The algorithm that builds the polygons. Modifications of a surface always
+	/// use the method the surface was created with. The default is MM_TransVoxel.
+	MeshingMethod Method;
+
+	/// Reorders the triangles of every block and transition mesh for
+	/// post-transform vertex cache locality and then the vertices in the order
+	/// they are used. Adds some polygonization time, but makes drawing faster.
+	bool OptimizeVertexCache;
+
+	/// Orders the triangles of every block by material, so that the triangles of
+	/// a material can be drawn with a single call. The ranges of the materials
+	/// are available through BlockPolygons::GetMaterialRanges. The vertex cache
+	/// optimization is done for each range separately. Ignored with VF_Collision.
+	bool GroupIndicesByMaterial;
+
+	/// Splits the triangles of every block in meshlets with bounds for culling.
+	/// The meshlets are available through BlockPolygons::GetMeshlets. The vertex
+	/// cache optimization is done for each meshlet separately.
+	bool BuildMeshlets;
+
+	static const unsigned LEVELS_COUNT = 16;
+	/// Maximal error in grid units allowed when simplifying the blocks of
+	/// each LOD level. The simplification collapses edges of the surface
+	/// inside a block, but never moves the vertices in the cells on the block
+	/// boundaries, so the blocks still match their neighbours and transitions.
+	/// Zero (the default) disables the simplification for the level.
+	float SimplificationError[LEVELS_COUNT];
+
+	/// The count of workers that polygonize the blocks. Zero (the default)
+	/// uses one worker per hardware thread.
+	unsigned ThreadsCount;
+
+	/// Runs the workers of the polygonization. When it is nullptr (the default)
+	/// the library uses a pool of threads owned by the Polygonizer that is kept
+	/// between Execute calls. The executor must outlive the Execute calls that use it.
+	TaskExecutor* Executor;
+
+	/// The Polygonizer keeps the caches and the mesh building buffers of its
+	/// workers between Execute calls, so that they are not allocated again on
+	/// every run. Memory above this limit in bytes is released at the end of
+	/// every Execute. Zero releases all of it. The default is 64 MB.
+	size_t MaxRetainedScratchBytes;
+};
+
+/// Identifies a block of a LOD level by its position. The position is in
+/// blocks of that level and in *grid* coordinates, i.e. Z is UP
+struct VOXELS_API BlockAddress
+{
+	unsigned Level;
+	unsigned X;
+	unsigned Y;
+	unsigned Z;
+};
+
+/// Restricts the polygonization to a part of the surface. Only the selected
+/// blocks get polygons. The finer blocks under a selected one are still
+/// polygonized to compute its materials, but their polygons are discarded.
+struct VOXELS_API PolygonizationRegion
+{
+	/// Creates a region that selects nothing
+	///
+	PolygonizationRegion();
+
+	/// Blocks to polygonize. The array must stay valid during the Execute call.
+	///
+	const BlockAddress* Blocks;
+	unsigned BlocksCount;
+
+	/// Selects blocks around ViewerPosition too. Every block closer to the viewer
+	/// than LodDistances[level - 1] is replaced by its 8 finer blocks, starting
+	/// with the blocks of MaxLevel closer than LodDistances[MaxLevel].
+	bool UseViewer;
+
+	/// The position of the viewer in *grid* coordinates, i.e. Z is UP
+	///
+	float3 ViewerPosition;
+
+	/// The distance in voxels up to which each LOD level is used
+	///
+	float LodDistances[PolygonizationOptions::LEVELS_COUNT];
+
+	/// The finest and the coarsest LOD level selected around the viewer
+	///
+	unsigned MinLevel;
+	unsigned MaxLevel;
+};
+
 /// Represents a whole polygonized surface
 ///
 class PolygonSurface
@@ -156,6 +452,11 @@ public:
 	/// @return the block requested or nullptr if the id or level are invalid
 	virtual const BlockPolygons* GetBlockForLevel(unsigned level, unsigned id) const = 0;
 
+	/// Returns a block by its unique ID
+	/// @param id the ID of the block as returned by BlockPolygons::GetId
+	/// @return the block or nullptr if the surface has no polygons with this ID
+	virtual const BlockPolygons* GetBlockById(unsigned id) const = 0;
+
 	/// Returns the statistics for the polygonization process
 	/// @return statistics about the polygonization process
 	virtual const PolygonizationStatistics* GetStatistics() const = 0;
@@ -170,6 +471,10 @@ public:
 	/// @return the total size in bytes of the polygon data
 	virtual unsigned GetPolygonDataSizeBytes() const = 0;
 
+	/// The layout of the vertices in the blocks of this surface
+	/// @return the vertex format the surface was polygonized with
+	virtual VertexFormat GetVertexFormat() const = 0;
+
 	/// Destroys the Surface and frees all memory associated with it.
 	/// All pointers retrieved through this object become invalid.
 	virtual void Destroy() = 0;
@@ -177,6 +482,26 @@ public:
 	VOXELS_API static const unsigned INVALID_ID;
 };
 
+/// The ways a block can change when a surface is modified
+///
+enum BlockChange
+{
+	/// The block had no polygons before the modification
+	///
+	BC_Added = 0,
+	/// The block has no polygons after the modification
+	///
+	BC_Removed,
+	/// The polygons of the block are different
+	///
+	BC_Changed,
+	/// The block was polygonized again, but its polygons are the same
+	///
+	BC_Unchanged,
+
+	BC_Count
+};
+
 /// Represents a "dirty" region you want to modify
 ///
 struct VOXELS_API Modification
@@ -198,11 +523,18 @@ struct VOXELS_API Modification
 	float3 MaxCornerModified; // in GRID coordinates
 
 	/// Returns an array of modified blocks after the polygonization of the
-	/// modified region.
+	/// modified region - the added and the changed ones.
 	/// @param count output count of blocks in the modification array
-	/// @return an array of "count" new blocks
+	/// @return an array of "count" block IDs
 	virtual const unsigned* GetModifiedBlocks(unsigned* count) const = 0;
 
+	/// Returns the blocks that underwent a specific change after the
+	/// polygonization of the modified region.
+	/// @param change the kind of change
+	/// @param count output count of blocks in the array
+	/// @return an array of "count" block IDs
+	virtual const unsigned* GetBlocks(BlockChange change, unsigned* count) const = 0;
+
 	/// Destroys the modification structure and all the memory associated
 	// with it. The retrieved block pointers are invalidated.
 	virtual void Destroy() = 0;
@@ -210,6 +542,100 @@ struct VOXELS_API Modification
 	virtual ~Modification();
 };
 
+/// Receives the results of an asynchronous polygonization. The methods
+/// are called on the threads that run the polygonization.
+class PolygonizationListener
+{
+public:
+	virtual ~PolygonizationListener() {};
+
+	/// Called as soon as the polygons of a block are ready. Calls for different
+	/// blocks might run in parallel. Blocks without polygons are reported too,
+	/// so that the data of their previous version can be dropped when modifying a surface.
+	/// @param level the LOD level of the block
+	/// @param block the block - valid only during the call
+	virtual void OnBlockPolygonized(unsigned level, const BlockPolygons* block) = 0;
+
+	/// Called once when the polygonization completes or is cancelled
+	/// @param surface the polygonized surface. It is nullptr when the creation
+	/// of a new surface is cancelled
+	/// @param cancelled whether the polygonization was cancelled
+	virtual void OnCompleted(PolygonSurface* surface, bool cancelled) = 0;
+};
+
+/// Handle of a polygonization that runs in the background
+///
+class AsyncPolygonization
+{
+public:
+	/// Stops the polygonization as soon as possible. A cancelled modification
+	/// leaves the surface valid - the region that was not polygonized again is
+	/// added to the next modification of the surface.
+	virtual void Cancel() = 0;
+
+	/// Checks if the polygonization has completed or was cancelled
+	/// @return true if the polygonization has ended
+	virtual bool IsCompleted() const = 0;
+
+	/// Waits for the polygonization to end
+	/// @return the polygonized surface - the same as the one passed
+	/// to PolygonizationListener::OnCompleted
+	virtual PolygonSurface* Wait() = 0;
+
+	/// Cancels the polygonization if it still runs, waits for it to end and
+	/// frees the handle
+	virtual void Destroy() = 0;
+
+protected:
+	virtual ~AsyncPolygonization() {};
+};
+
+/// Limits the work done by a single step of an incremental polygonization.
+/// The blocks that have started when the budget runs out are completed, so the
+/// step might take a bit longer than the budget.
+struct VOXELS_API PolygonizationBudget
+{
+	/// Creates a budget without limits
+	///
+	PolygonizationBudget();
+
+	/// Time in milliseconds after which no new blocks are started. Zero means no limit.
+	///
+	float Milliseconds;
+
+	/// Count of cells after which no new blocks are started. Zero means no limit.
+	///
+	unsigned Cells;
+};
+
+/// A polygonization done in steps with a limited budget
+///
+class PolygonizationProgress
+{
+public:
+	/// Polygonizes more blocks within the budget
+	/// @param budget the limit of the work done by this step
+	/// @return true if the polygonization has completed
+	virtual bool Continue(const PolygonizationBudget& budget) = 0;
+
+	/// Checks if the polygonization has completed
+	/// @return true if the polygonization has completed
+	virtual bool IsCompleted() const = 0;
+
+	/// Returns the surface. A modified surface is valid during the whole
+	/// polygonization - the blocks of a LOD level are replaced only after all
+	/// of them are ready. A new surface is available only after the polygonization completes.
+	/// @return the surface or nullptr if a new surface is not completed yet
+	virtual PolygonSurface* GetSurface() const = 0;
+
+	/// Frees the progress. A polygonization that has not completed is cancelled
+	/// like an asynchronous one - see AsyncPolygonization::Cancel
+	virtual void Destroy() = 0;
+
+protected:
+	virtual ~PolygonizationProgress() {};
+};
+
 /// Polygonizes a Voxel grid
 /// Outputs LOD levels with collections of blocks - each with vertices and indices.
 class VOXELS_API Polygonizer
@@ -231,6 +657,59 @@ public:
 		const MaterialMap* materials,
 		Modification* modification = nullptr);
 
+	/// Polygonizes only a region of a Voxels grid. Modifications of the
+	/// returned surface update only the blocks polygonized by this call.
+	/// @param grid the Voxel grid we wish to work on
+	/// @param materials a material table that will map material ids in the
+	/// voxels to texture ids in the output vertices
+	/// @param region the blocks to polygonize
+	/// @return the polygonized surface
+	PolygonSurface* Execute(const Grid& grid,
+		const MaterialMap* materials,
+		const PolygonizationRegion& region);
+
+	/// Starts the polygonization on a background thread and returns immediately.
+	/// The polygonizations of a Polygonizer run one at a time - the pending
+	/// ones with higher priority first. The grid, the materials and the
+	/// modification must not change until the polygonization ends.
+	/// @param grid the Voxel grid we wish to work on
+	/// @param materials a material table that will map material ids in the
+	/// voxels to texture ids in the output vertices
+	/// @param modification optional modification structure when you want to update an
+	/// already polygonized surface
+	/// @param listener optional object that receives the blocks as they are polygonized
+	/// @param priority the priority of the polygonization
+	/// @return a handle that has to be destroyed after the polygonization ends
+	AsyncPolygonization* ExecuteAsync(const Grid& grid,
+		const MaterialMap* materials,
+		Modification* modification = nullptr,
+		PolygonizationListener* listener = nullptr,
+		int priority = 0);
+
+	/// Starts a polygonization that is done in steps, so that a large change can be spread
+	/// over many frames. The first step is done by this call and the rest by
+	/// PolygonizationProgress::Continue. The grid, the materials and the modification
+	/// must not change and the Polygonizer must not be destroyed until the polygonization completes.
+	/// @param grid the Voxel grid we wish to work on
+	/// @param materials a material table that will map material ids in the
+	/// voxels to texture ids in the output vertices
+	/// @param modification optional modification structure when you want to update an
+	/// already polygonized surface
+	/// @param budget the limit of the work done by the first step
+	/// @return the progress of the polygonization - has to be destroyed once not needed
+	PolygonizationProgress* ExecuteIncremental(const Grid& grid,
+		const MaterialMap* materials,
+		Modification* modification,
+		const PolygonizationBudget& budget);
+
+	/// Sets the options used by all subsequent executions
+	/// @param options the new options
+	void SetOptions(const PolygonizationOptions& options);
+
+	/// Returns the options currently in use
+	/// @return the options
+	const PolygonizationOptions& GetOptions() const;
+
 private:
 	Polygonizer(const Polygonizer&);
 	Polygonizer& operator=(const Polygonizer&);
@@ -0,0 +1,32 @@
+// Copyright (c) 2013-2016, Stoyan Nikolov
+// All rights reserved.
+// Voxels Library, please see LICENSE for licensing details.
+#pragma once
+
+#include "Declarations.h"
+
+namespace Voxels
+{
+
+/// Provides the threads the polygonization runs on. Implement it to run
+/// the polygonization on the threads of an existing job system.
+class VOXELS_API TaskExecutor
+{
+public:
+	/// The work of a single worker. It runs polygonization tasks and
+	/// returns only when all the tasks of the run are complete.
+	typedef void (*WorkerFunction)(void* context, unsigned workerIndex);
+
+	virtual ~TaskExecutor() {};
+
+	/// Calls "function" once for every worker index from 0 to workersCount - 1
+	/// and returns when all of the calls have completed. The calls should run in
+	/// parallel to make use of the available cores, but a single worker is able to
+	/// complete all the work, so running them one after another is valid too.
+	/// @param workersCount the count of workers to run
+	/// @param function the function every worker has to execute
+	/// @param context the argument to pass to the function
+	virtual void Run(unsigned workersCount, WorkerFunction function, void* context) = 0;
+};
+
+}
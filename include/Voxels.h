@@ -8,5 +8,6 @@
 #include "Structs.h"
 #include "Grid.h"
 #include "Polygonizer.h"
+#include "TaskExecutor.h"
 #include "VoxelSurface.h"
 #include "Library.h"
@@ -0,0 +1,27 @@
+// Copyright (c) 2013-2016, Stoyan Nikolov
+// All rights reserved.
+// Voxels Library, please see LICENSE for licensing details.
+#pragma once
+
+namespace StMath
+{
+
+template<typename T, typename U>
+inline T min_value(T a, U b)
+{
+	return a < T(b) ? a : T(b);
+}
+
+template<typename T, typename U>
+inline T max_value(T a, U b)
+{
+	return a > T(b) ? a : T(b);
+}
+
+template<typename T, typename U, typename V>
+inline T clamp_value(T value, U minValue, V maxValue)
+{
+	return max_value(min_value(value, maxValue), minValue);
+}
+
+}
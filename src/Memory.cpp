@@ -9,12 +9,12 @@ void* operator new(size_t size)
 	return voxel_allocate(size);
 }
 
-void* operator new(std::size_t count, const std::nothrow_t& tag)
+void* operator new(std::size_t count, const std::nothrow_t&)
 {
 	return voxel_allocate(count);
 }
 
-void* operator new[](std::size_t count, const std::nothrow_t& tag)
+void* operator new[](std::size_t count, const std::nothrow_t&)
 {
 	return voxel_allocate(count);
 }
@@ -29,7 +29,7 @@ void operator delete(void* ptr)
 	voxel_deallocate(ptr);
 }
 
-void operator delete(void* ptr, const std::nothrow_t& tag)
+void operator delete(void* ptr, const std::nothrow_t&)
 {
 	voxel_deallocate(ptr);
 }
@@ -39,7 +39,7 @@ void operator delete[](void* ptr)
 	voxel_deallocate(ptr);
 }
 
-void operator delete[](void* ptr, const std::nothrow_t& tag)
+void operator delete[](void* ptr, const std::nothrow_t&)
 {
 	voxel_deallocate(ptr);
 }
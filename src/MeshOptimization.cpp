@@ -0,0 +1,904 @@
+// Copyright (c) 2013-2016, Stoyan Nikolov
+// All rights reserved.
+// Voxels Library, please see LICENSE for licensing details.
+#include "stdafx.h"
+#include "MeshOptimization.h"
+
+#include <iterator>
+
+namespace Voxels
+{
+
+static const unsigned INVALID_VERTEX = 0xFFFFFFFF;
+
+unsigned CalculateVertexCacheMisses(const unsigned* indices
+								, unsigned indicesCount
+								, unsigned verticesCount
+								, unsigned cacheSize)
+{
+	// a vertex is in the cache if it was inserted less than "cacheSize" insertions ago
+	std::vector<unsigned> insertionTime(verticesCount, 0);
+	unsigned time = cacheSize + 1;
+	unsigned misses = 0;
+	for (auto i = 0u; i < indicesCount; ++i) {
+		const auto vertex = indices[i];
+		if (time - insertionTime[vertex] > cacheSize) {
+			insertionTime[vertex] = time++;
+			++misses;
+		}
+	}
+
+	return misses;
+}
+
+namespace
+{
+
+class Tipsify
+{
+public:
+	Tipsify(const unsigned* indices
+		, unsigned indicesCount
+		, unsigned verticesCount
+		, unsigned cacheSize)
+		: m_Indices(indices)
+		, m_TrianglesCount(indicesCount / 3)
+		, m_VerticesCount(verticesCount)
+		, m_CacheSize(cacheSize)
+		, m_LiveTriangles(verticesCount, 0)
+		, m_CacheTime(verticesCount, 0)
+		, m_AdjacencyOffsets(verticesCount + 1, 0)
+		, m_Emitted(indicesCount / 3, false)
+		, m_Time(cacheSize + 1)
+		, m_Cursor(0)
+	{
+		BuildAdjacency();
+	}
+
+	void Execute(std::vector<unsigned>& output)
+	{
+		output.reserve(m_TrianglesCount * 3);
+
+		std::vector<unsigned> candidates;
+		candidates.reserve(m_CacheSize * 3);
+
+		auto fanningVertex = SkipDeadEnd();
+		while (fanningVertex != INVALID_VERTEX) {
+			candidates.clear();
+			for (auto adj = m_AdjacencyOffsets[fanningVertex]; adj < m_AdjacencyOffsets[fanningVertex + 1]; ++adj) {
+				const auto triangle = m_Adjacency[adj];
+				if (m_Emitted[triangle])
+					continue;
+
+				for (auto corner = 0u; corner < 3; ++corner) {
+					const auto vertex = m_Indices[triangle * 3 + corner];
+					output.push_back(vertex);
+					m_DeadEnd.push_back(vertex);
+					candidates.push_back(vertex);
+					--m_LiveTriangles[vertex];
+					if (m_Time - m_CacheTime[vertex] > m_CacheSize) {
+						m_CacheTime[vertex] = m_Time++;
+					}
+				}
+				m_Emitted[triangle] = true;
+			}
+
+			fanningVertex = GetNextVertex(candidates);
+		}
+	}
+
+private:
+	void BuildAdjacency()
+	{
+		for (auto i = 0u; i < m_TrianglesCount * 3; ++i) {
+			++m_LiveTriangles[m_Indices[i]];
+		}
+		for (auto vertex = 0u; vertex < m_VerticesCount; ++vertex) {
+			m_AdjacencyOffsets[vertex + 1] = m_AdjacencyOffsets[vertex] + m_LiveTriangles[vertex];
+		}
+
+		m_Adjacency.resize(m_TrianglesCount * 3);
+		std::vector<unsigned> fill(m_AdjacencyOffsets.begin(), m_AdjacencyOffsets.end() - 1);
+		for (auto triangle = 0u; triangle < m_TrianglesCount; ++triangle) {
+			for (auto corner = 0u; corner < 3; ++corner) {
+				m_Adjacency[fill[m_Indices[triangle * 3 + corner]]++] = triangle;
+			}
+		}
+	}
+
+	unsigned GetNextVertex(const std::vector<unsigned>& candidates)
+	{
+		// prefer the candidate that will still be in the cache after its
+		// remaining triangles are emitted and was inserted the earliest
+		auto bestVertex = INVALID_VERTEX;
+		auto bestPriority = -1;
+		for (auto it = candidates.cbegin(); it != candidates.cend(); ++it) {
+			const auto vertex = *it;
+			if (!m_LiveTriangles[vertex])
+				continue;
+
+			auto priority = 0;
+			const auto age = m_Time - m_CacheTime[vertex];
+			if (age + 2 * m_LiveTriangles[vertex] <= m_CacheSize) {
+				priority = int(age);
+			}
+			if (priority > bestPriority) {
+				bestPriority = priority;
+				bestVertex = vertex;
+			}
+		}
+
+		if (bestVertex == INVALID_VERTEX) {
+			bestVertex = SkipDeadEnd();
+		}
+
+		return bestVertex;
+	}
+
+	unsigned SkipDeadEnd()
+	{
+		while (!m_DeadEnd.empty()) {
+			const auto vertex = m_DeadEnd.back();
+			m_DeadEnd.pop_back();
+			if (m_LiveTriangles[vertex])
+				return vertex;
+		}
+
+		while (m_Cursor < m_VerticesCount) {
+			const auto vertex = m_Cursor++;
+			if (m_LiveTriangles[vertex])
+				return vertex;
+		}
+
+		return INVALID_VERTEX;
+	}
+
+	const unsigned* m_Indices;
+	unsigned m_TrianglesCount;
+	unsigned m_VerticesCount;
+	unsigned m_CacheSize;
+
+	std::vector<unsigned> m_LiveTriangles;
+	std::vector<unsigned> m_CacheTime;
+	std::vector<unsigned> m_AdjacencyOffsets;
+	std::vector<unsigned> m_Adjacency;
+	std::vector<bool> m_Emitted;
+	std::vector<unsigned> m_DeadEnd;
+
+	unsigned m_Time;
+	unsigned m_Cursor;
+};
+
+}
+
+void OptimizeVertexCache(unsigned* indices
+						, unsigned indicesCount
+						, unsigned verticesCount
+						, unsigned cacheSize)
+{
+	if (indicesCount < 3)
+		return;
+
+	std::vector<unsigned> output;
+	Tipsify(indices, indicesCount, verticesCount, cacheSize).Execute(output);
+
+	assert(output.size() == indicesCount);
+	std::copy(output.cbegin(), output.cend(), indices);
+}
+
+void CalculateVertexFetchRemap(const unsigned* indices
+							, unsigned indicesCount
+							, unsigned verticesCount
+							, std::vector<unsigned>& remap)
+{
+	remap.assign(verticesCount, INVALID_VERTEX);
+
+	unsigned nextVertex = 0;
+	for (auto i = 0u; i < indicesCount; ++i) {
+		auto& newPosition = remap[indices[i]];
+		if (newPosition == INVALID_VERTEX) {
+			newPosition = nextVertex++;
+		}
+	}
+
+	for (auto vertex = 0u; vertex < verticesCount; ++vertex) {
+		if (remap[vertex] == INVALID_VERTEX) {
+			remap[vertex] = nextVertex++;
+		}
+	}
+}
+
+unsigned CalculateUnusedVerticesRemap(const unsigned* indices
+									, unsigned indicesCount
+									, unsigned verticesCount
+									, std::vector<unsigned>& remap)
+{
+	std::vector<char> used(verticesCount, 0);
+	for (auto i = 0u; i < indicesCount; ++i) {
+		used[indices[i]] = 1;
+	}
+
+	remap.resize(verticesCount);
+	unsigned nextVertex = 0;
+	for (auto vertex = 0u; vertex < verticesCount; ++vertex) {
+		if (used[vertex]) {
+			remap[vertex] = nextVertex++;
+		}
+	}
+	const auto usedCount = nextVertex;
+	for (auto vertex = 0u; vertex < verticesCount; ++vertex) {
+		if (!used[vertex]) {
+			remap[vertex] = nextVertex++;
+		}
+	}
+
+	return usedCount;
+}
+
+namespace
+{
+
+// Symmetric 4x4 matrix of the sum of squared distances to a set of planes
+struct Quadric
+{
+	Quadric()
+	{
+		std::fill(M, M + _countof(M), 0.0f);
+	}
+
+	void AddPlane(const glm::vec3& normal, float d)
+	{
+		M[0] += normal.x * normal.x;
+		M[1] += normal.x * normal.y;
+		M[2] += normal.x * normal.z;
+		M[3] += normal.x * d;
+		M[4] += normal.y * normal.y;
+		M[5] += normal.y * normal.z;
+		M[6] += normal.y * d;
+		M[7] += normal.z * normal.z;
+		M[8] += normal.z * d;
+		M[9] += d * d;
+	}
+
+	Quadric& operator+=(const Quadric& rhs)
+	{
+		for (auto i = 0u; i < _countof(M); ++i) {
+			M[i] += rhs.M[i];
+		}
+		return *this;
+	}
+
+	float Evaluate(const glm::vec3& p) const
+	{
+		const auto result = p.x * (M[0] * p.x + 2 * (M[1] * p.y + M[2] * p.z + M[3]))
+			+ p.y * (M[4] * p.y + 2 * (M[5] * p.z + M[6]))
+			+ p.z * (M[7] * p.z + 2 * M[8])
+			+ M[9];
+		return std::max(result, 0.0f);
+	}
+
+	float M[10];
+};
+
+struct Collapse
+{
+	unsigned From;
+	unsigned To;
+	float Error;
+
+	bool operator<(const Collapse& rhs) const
+	{
+		return Error < rhs.Error;
+	}
+};
+
+class EdgeCollapser
+{
+public:
+	EdgeCollapser(unsigned* indices
+		, unsigned indicesCount
+		, const std::vector<glm::vec3>& positions
+		, const std::vector<char>& locked
+		, const std::vector<unsigned>& collapseKeys)
+		: m_Indices(indices)
+		, m_TrianglesCount(indicesCount / 3)
+		, m_Positions(positions)
+		, m_CollapseKeys(collapseKeys)
+		, m_Locked(locked)
+		, m_Quadrics(positions.size())
+		, m_LiveTriangles(indicesCount / 3, true)
+	{
+		WeldVertices();
+		CalculateQuadrics();
+		LockBorders();
+	}
+
+	unsigned Execute(float maxError)
+	{
+		static const unsigned MAX_PASSES = 32;
+
+		const auto maxErrorSq = maxError * maxError;
+		for (auto pass = 0u; pass < MAX_PASSES; ++pass) {
+			if (!CollapsePass(maxErrorSq))
+				break;
+		}
+
+		// compact the remaining triangles
+		auto outputIndex = 0u;
+		for (auto triangle = 0u; triangle < m_TrianglesCount; ++triangle) {
+			if (!m_LiveTriangles[triangle])
+				continue;
+			for (auto corner = 0u; corner < 3; ++corner) {
+				m_Indices[outputIndex++] = m_Indices[triangle * 3 + corner];
+			}
+		}
+
+		return outputIndex;
+	}
+
+private:
+	// The polygonization doesn't share all the vertices with the same position,
+	// so the topology is built on one representative vertex per position.
+	// A position shared by vertices with different collapse keys is locked.
+	void WeldVertices()
+	{
+		const auto verticesCount = unsigned(m_Positions.size());
+		std::vector<unsigned> sorted(verticesCount);
+		for (auto vertex = 0u; vertex < verticesCount; ++vertex) {
+			sorted[vertex] = vertex;
+		}
+		const auto& positions = m_Positions;
+		std::sort(sorted.begin(), sorted.end(), [&positions](unsigned lhs, unsigned rhs) {
+			const auto& l = positions[lhs];
+			const auto& r = positions[rhs];
+			if (l.x != r.x)
+				return l.x < r.x;
+			if (l.y != r.y)
+				return l.y < r.y;
+			if (l.z != r.z)
+				return l.z < r.z;
+			return lhs < rhs;
+		});
+
+		std::vector<unsigned> representative(verticesCount);
+		for (auto first = 0u; first < verticesCount;) {
+			const auto head = sorted[first];
+			auto last = first + 1;
+			while (last < verticesCount && positions[sorted[last]] == positions[head]) {
+				++last;
+			}
+			for (auto i = first; i < last; ++i) {
+				const auto vertex = sorted[i];
+				representative[vertex] = head;
+				if (m_Locked[vertex] || m_CollapseKeys[vertex] != m_CollapseKeys[head]) {
+					m_Locked[head] = 1;
+				}
+			}
+			first = last;
+		}
+
+		m_Topology.resize(m_TrianglesCount * 3);
+		for (auto i = 0u; i < m_TrianglesCount * 3; ++i) {
+			m_Topology[i] = representative[m_Indices[i]];
+		}
+	}
+
+	void CalculateQuadrics()
+	{
+		for (auto triangle = 0u; triangle < m_TrianglesCount; ++triangle) {
+			const auto* tri = &m_Topology[triangle * 3];
+			const auto& p0 = m_Positions[tri[0]];
+			const auto normal = glm::cross(m_Positions[tri[1]] - p0, m_Positions[tri[2]] - p0);
+			const auto len = glm::length(normal);
+			if (len <= std::numeric_limits<float>::epsilon())
+				continue;
+
+			const auto unitNormal = normal / len;
+			const auto d = -glm::dot(unitNormal, p0);
+			for (auto corner = 0u; corner < 3; ++corner) {
+				m_Quadrics[tri[corner]].AddPlane(unitNormal, d);
+			}
+		}
+	}
+
+	// edges used by a single triangle are on an open border - moving their
+	// vertices would open holes. The same goes for non-manifold edges.
+	void LockBorders()
+	{
+		std::vector<std::pair<unsigned, unsigned>> edges;
+		edges.reserve(m_TrianglesCount * 3);
+		for (auto triangle = 0u; triangle < m_TrianglesCount; ++triangle) {
+			const auto* tri = &m_Topology[triangle * 3];
+			for (auto corner = 0u; corner < 3; ++corner) {
+				const auto a = tri[corner];
+				const auto b = tri[(corner + 1) % 3];
+				edges.push_back(std::make_pair(std::min(a, b), std::max(a, b)));
+			}
+		}
+		std::sort(edges.begin(), edges.end());
+
+		for (auto edge = 0u; edge < edges.size();) {
+			auto next = edge + 1;
+			while (next < edges.size() && edges[next] == edges[edge]) {
+				++next;
+			}
+			if (next - edge != 2) {
+				m_Locked[edges[edge].first] = 1;
+				m_Locked[edges[edge].second] = 1;
+			}
+			edge = next;
+		}
+	}
+
+	void BuildAdjacency()
+	{
+		const auto verticesCount = unsigned(m_Positions.size());
+		m_AdjacencyOffsets.assign(verticesCount + 1, 0);
+		for (auto triangle = 0u; triangle < m_TrianglesCount; ++triangle) {
+			if (!m_LiveTriangles[triangle])
+				continue;
+			for (auto corner = 0u; corner < 3; ++corner) {
+				++m_AdjacencyOffsets[m_Topology[triangle * 3 + corner] + 1];
+			}
+		}
+		for (auto vertex = 0u; vertex < verticesCount; ++vertex) {
+			m_AdjacencyOffsets[vertex + 1] += m_AdjacencyOffsets[vertex];
+		}
+
+		m_Adjacency.resize(m_AdjacencyOffsets.back());
+		std::vector<unsigned> fill(m_AdjacencyOffsets.begin(), m_AdjacencyOffsets.end() - 1);
+		for (auto triangle = 0u; triangle < m_TrianglesCount; ++triangle) {
+			if (!m_LiveTriangles[triangle])
+				continue;
+			for (auto corner = 0u; corner < 3; ++corner) {
+				m_Adjacency[fill[m_Topology[triangle * 3 + corner]]++] = triangle;
+			}
+		}
+	}
+
+	bool CollapsePass(float maxErrorSq)
+	{
+		BuildAdjacency();
+
+		m_Collapses.clear();
+		for (auto triangle = 0u; triangle < m_TrianglesCount; ++triangle) {
+			if (!m_LiveTriangles[triangle])
+				continue;
+			const auto* tri = &m_Topology[triangle * 3];
+			for (auto corner = 0u; corner < 3; ++corner) {
+				const auto a = tri[corner];
+				const auto b = tri[(corner + 1) % 3];
+				AddCollapseCandidate(a, b, maxErrorSq);
+				AddCollapseCandidate(b, a, maxErrorSq);
+			}
+		}
+		std::sort(m_Collapses.begin(), m_Collapses.end());
+
+		m_Touched.assign(m_Positions.size(), 0);
+		auto collapsesDone = 0u;
+		for (auto collapse = m_Collapses.cbegin(); collapse != m_Collapses.cend(); ++collapse) {
+			if (m_Touched[collapse->From] || m_Touched[collapse->To])
+				continue;
+			if (!IsCollapseValid(collapse->From, collapse->To))
+				continue;
+
+			DoCollapse(collapse->From, collapse->To);
+			++collapsesDone;
+		}
+
+		return collapsesDone > 0;
+	}
+
+	void AddCollapseCandidate(unsigned from, unsigned to, float maxErrorSq)
+	{
+		if (m_Locked[from] || m_CollapseKeys[from] != m_CollapseKeys[to])
+			return;
+
+		Collapse collapse;
+		collapse.From = from;
+		collapse.To = to;
+		collapse.Error = m_Quadrics[from].Evaluate(m_Positions[to]);
+		if (collapse.Error <= maxErrorSq) {
+			m_Collapses.push_back(collapse);
+		}
+	}
+
+	bool IsCollapseValid(unsigned from, unsigned to)
+	{
+		// link condition - the only vertices shared by the neighbourhoods of
+		// "from" and "to" must be the ones opposite to their common edge
+		m_FromNeighbours.clear();
+		auto sharedTriangles = 0u;
+		for (auto adj = m_AdjacencyOffsets[from]; adj < m_AdjacencyOffsets[from + 1]; ++adj) {
+			const auto* tri = &m_Topology[m_Adjacency[adj] * 3];
+			if (tri[0] == to || tri[1] == to || tri[2] == to) {
+				++sharedTriangles;
+			}
+			for (auto corner = 0u; corner < 3; ++corner) {
+				if (tri[corner] != from && tri[corner] != to) {
+					m_FromNeighbours.push_back(tri[corner]);
+				}
+			}
+		}
+		std::sort(m_FromNeighbours.begin(), m_FromNeighbours.end());
+		m_FromNeighbours.erase(std::unique(m_FromNeighbours.begin(), m_FromNeighbours.end()), m_FromNeighbours.end());
+
+		m_ToNeighbours.clear();
+		for (auto adj = m_AdjacencyOffsets[to]; adj < m_AdjacencyOffsets[to + 1]; ++adj) {
+			const auto* tri = &m_Topology[m_Adjacency[adj] * 3];
+			for (auto corner = 0u; corner < 3; ++corner) {
+				if (tri[corner] != from && tri[corner] != to) {
+					m_ToNeighbours.push_back(tri[corner]);
+				}
+			}
+		}
+		std::sort(m_ToNeighbours.begin(), m_ToNeighbours.end());
+		m_ToNeighbours.erase(std::unique(m_ToNeighbours.begin(), m_ToNeighbours.end()), m_ToNeighbours.end());
+
+		m_SharedNeighbours.clear();
+		std::set_intersection(m_FromNeighbours.cbegin(), m_FromNeighbours.cend(),
+			m_ToNeighbours.cbegin(), m_ToNeighbours.cend(),
+			std::back_inserter(m_SharedNeighbours));
+		if (m_SharedNeighbours.size() != sharedTriangles)
+			return false;
+
+		// the remaining triangles must not flip
+		const auto& newPosition = m_Positions[to];
+		for (auto adj = m_AdjacencyOffsets[from]; adj < m_AdjacencyOffsets[from + 1]; ++adj) {
+			const auto* tri = &m_Topology[m_Adjacency[adj] * 3];
+			if (tri[0] == to || tri[1] == to || tri[2] == to)
+				continue;
+
+			glm::vec3 corners[3];
+			for (auto corner = 0u; corner < 3; ++corner) {
+				corners[corner] = m_Positions[tri[corner]];
+			}
+			const auto oldNormal = glm::cross(corners[1] - corners[0], corners[2] - corners[0]);
+			for (auto corner = 0u; corner < 3; ++corner) {
+				if (tri[corner] == from) {
+					corners[corner] = newPosition;
+				}
+			}
+			const auto newNormal = glm::cross(corners[1] - corners[0], corners[2] - corners[0]);
+			if (glm::dot(oldNormal, newNormal) <= 0.0f)
+				return false;
+		}
+
+		return true;
+	}
+
+	void DoCollapse(unsigned from, unsigned to)
+	{
+		for (auto adj = m_AdjacencyOffsets[from]; adj < m_AdjacencyOffsets[from + 1]; ++adj) {
+			const auto triangle = m_Adjacency[adj];
+			auto* tri = &m_Topology[triangle * 3];
+			auto* outputTri = m_Indices + triangle * 3;
+			bool hasTo = false;
+			for (auto corner = 0u; corner < 3; ++corner) {
+				hasTo |= tri[corner] == to;
+				// the neighbourhood changes so the adjacency of these vertices is stale
+				m_Touched[tri[corner]] = 1;
+			}
+			if (hasTo) {
+				m_LiveTriangles[triangle] = false;
+				continue;
+			}
+			for (auto corner = 0u; corner < 3; ++corner) {
+				if (tri[corner] == from) {
+					tri[corner] = to;
+					outputTri[corner] = to;
+				}
+			}
+		}
+
+		m_Quadrics[to] += m_Quadrics[from];
+	}
+
+	unsigned* m_Indices;
+	std::vector<unsigned> m_Topology;
+	unsigned m_TrianglesCount;
+	const std::vector<glm::vec3>& m_Positions;
+	const std::vector<unsigned>& m_CollapseKeys;
+	std::vector<char> m_Locked;
+	std::vector<Quadric> m_Quadrics;
+	std::vector<bool> m_LiveTriangles;
+
+	std::vector<unsigned> m_AdjacencyOffsets;
+	std::vector<unsigned> m_Adjacency;
+	std::vector<Collapse> m_Collapses;
+	std::vector<char> m_Touched;
+
+	std::vector<unsigned> m_FromNeighbours;
+	std::vector<unsigned> m_ToNeighbours;
+	std::vector<unsigned> m_SharedNeighbours;
+};
+
+}
+
+unsigned SimplifyMesh(unsigned* indices
+					, unsigned indicesCount
+					, const std::vector<glm::vec3>& positions
+					, const std::vector<char>& locked
+					, const std::vector<unsigned>& collapseKeys
+					, float maxError)
+{
+	if (indicesCount < 3 || maxError <= 0.0f)
+		return indicesCount;
+
+	return EdgeCollapser(indices, indicesCount, positions, locked, collapseKeys).Execute(maxError);
+}
+
+namespace
+{
+
+class MeshletBuilder
+{
+public:
+	MeshletBuilder(const unsigned* indices
+		, unsigned indicesCount
+		, unsigned verticesCount
+		, unsigned maxVertices
+		, unsigned maxTriangles)
+		: m_Indices(indices)
+		, m_TrianglesCount(indicesCount / 3)
+		, m_VerticesCount(verticesCount)
+		, m_MaxVertices(maxVertices)
+		, m_MaxTriangles(maxTriangles)
+		, m_AdjacencyOffsets(verticesCount + 1, 0)
+		, m_VertexMeshlet(verticesCount, 0)
+		, m_CandidateMeshlet(indicesCount / 3, 0)
+		, m_Emitted(indicesCount / 3, false)
+		, m_Meshlet(0)
+		, m_Cursor(0)
+	{
+		BuildAdjacency();
+	}
+
+	void Execute(unsigned firstIndex, std::vector<unsigned>& output, std::vector<MeshletRange>& meshlets)
+	{
+		output.reserve(m_TrianglesCount * 3);
+
+		while (output.size() < m_TrianglesCount * 3) {
+			// the vertices and the candidates are marked with the current meshlet
+			++m_Meshlet;
+			m_Candidates.clear();
+
+			MeshletRange meshlet;
+			meshlet.FirstIndex = firstIndex + unsigned(output.size());
+			meshlet.IndicesCount = 0;
+			meshlet.VerticesCount = 0;
+			while (meshlet.IndicesCount < m_MaxTriangles * 3) {
+				unsigned newVertices;
+				auto triangle = GetNextCandidate(newVertices);
+				if (triangle == INVALID_VERTEX) {
+					// the meshlet continues with the next triangle in the original
+					// order, which is close to the last ones in most cases
+					triangle = SkipEmitted();
+					if (triangle == INVALID_VERTEX)
+						break;
+					newVertices = CountNewVertices(triangle);
+				}
+				if (meshlet.VerticesCount + newVertices > m_MaxVertices)
+					break;
+
+				for (auto corner = 0u; corner < 3; ++corner) {
+					const auto vertex = m_Indices[triangle * 3 + corner];
+					output.push_back(vertex);
+					if (m_VertexMeshlet[vertex] != m_Meshlet) {
+						m_VertexMeshlet[vertex] = m_Meshlet;
+						++meshlet.VerticesCount;
+						AddCandidates(vertex);
+					}
+				}
+				m_Emitted[triangle] = true;
+				meshlet.IndicesCount += 3;
+			}
+
+			assert(meshlet.IndicesCount);
+			meshlets.push_back(meshlet);
+		}
+	}
+
+private:
+	void BuildAdjacency()
+	{
+		std::vector<unsigned> counts(m_VerticesCount, 0);
+		for (auto i = 0u; i < m_TrianglesCount * 3; ++i) {
+			++counts[m_Indices[i]];
+		}
+		for (auto vertex = 0u; vertex < m_VerticesCount; ++vertex) {
+			m_AdjacencyOffsets[vertex + 1] = m_AdjacencyOffsets[vertex] + counts[vertex];
+		}
+
+		m_Adjacency.resize(m_TrianglesCount * 3);
+		std::vector<unsigned> fill(m_AdjacencyOffsets.begin(), m_AdjacencyOffsets.end() - 1);
+		for (auto triangle = 0u; triangle < m_TrianglesCount; ++triangle) {
+			for (auto corner = 0u; corner < 3; ++corner) {
+				m_Adjacency[fill[m_Indices[triangle * 3 + corner]]++] = triangle;
+			}
+		}
+	}
+
+	void AddCandidates(unsigned vertex)
+	{
+		for (auto adj = m_AdjacencyOffsets[vertex]; adj < m_AdjacencyOffsets[vertex + 1]; ++adj) {
+			const auto triangle = m_Adjacency[adj];
+			if (!m_Emitted[triangle] && m_CandidateMeshlet[triangle] != m_Meshlet) {
+				m_CandidateMeshlet[triangle] = m_Meshlet;
+				m_Candidates.push_back(triangle);
+			}
+		}
+	}
+
+	unsigned CountNewVertices(unsigned triangle) const
+	{
+		auto count = 0u;
+		for (auto corner = 0u; corner < 3; ++corner) {
+			count += m_VertexMeshlet[m_Indices[triangle * 3 + corner]] != m_Meshlet;
+		}
+		return count;
+	}
+
+	// The candidate that adds the fewest vertices to the meshlet - the earliest
+	// added one among equal ones, so that the meshlet grows evenly around its start
+	unsigned GetNextCandidate(unsigned& newVertices)
+	{
+		auto bestTriangle = INVALID_VERTEX;
+		newVertices = 3;
+		auto outputCandidate = 0u;
+		for (auto it = m_Candidates.cbegin(); it != m_Candidates.cend(); ++it) {
+			const auto triangle = *it;
+			if (m_Emitted[triangle])
+				continue;
+
+			m_Candidates[outputCandidate++] = triangle;
+			const auto count = CountNewVertices(triangle);
+			if (bestTriangle == INVALID_VERTEX || count < newVertices) {
+				bestTriangle = triangle;
+				newVertices = count;
+			}
+		}
+		m_Candidates.resize(outputCandidate);
+
+		return bestTriangle;
+	}
+
+	// The first triangle not emitted yet
+	unsigned SkipEmitted()
+	{
+		while (m_Cursor < m_TrianglesCount && m_Emitted[m_Cursor]) {
+			++m_Cursor;
+		}
+
+		return m_Cursor < m_TrianglesCount ? m_Cursor : INVALID_VERTEX;
+	}
+
+	const unsigned* m_Indices;
+	unsigned m_TrianglesCount;
+	unsigned m_VerticesCount;
+	unsigned m_MaxVertices;
+	unsigned m_MaxTriangles;
+
+	std::vector<unsigned> m_AdjacencyOffsets;
+	std::vector<unsigned> m_Adjacency;
+	std::vector<unsigned> m_VertexMeshlet;
+	std::vector<unsigned> m_CandidateMeshlet;
+	std::vector<bool> m_Emitted;
+	std::vector<unsigned> m_Candidates;
+
+	unsigned m_Meshlet;
+	unsigned m_Cursor;
+};
+
+}
+
+void BuildMeshlets(unsigned* indices
+				, unsigned indicesCount
+				, unsigned verticesCount
+				, unsigned maxVertices
+				, unsigned maxTriangles
+				, unsigned firstIndex
+				, std::vector<MeshletRange>& meshlets)
+{
+	assert(maxVertices >= 3 && maxTriangles > 0);
+	if (indicesCount < 3)
+		return;
+
+	std::vector<unsigned> output;
+	MeshletBuilder(indices, indicesCount, verticesCount, maxVertices, maxTriangles).Execute(firstIndex, output, meshlets);
+
+	assert(output.size() == indicesCount);
+	std::copy(output.cbegin(), output.cend(), indices);
+}
+
+void CalculateClusterBounds(const unsigned* indices
+						, unsigned indicesCount
+						, const std::vector<glm::vec3>& positions
+						, ClusterBounds& bounds)
+{
+	assert(indicesCount >= 3);
+
+	// start with the sphere over the farthest apart pair of the extreme points on the axes
+	unsigned minPoints[3] = { indices[0], indices[0], indices[0] };
+	unsigned maxPoints[3] = { indices[0], indices[0], indices[0] };
+	for (auto i = 1u; i < indicesCount; ++i) {
+		const auto& p = positions[indices[i]];
+		for (auto axis = 0; axis < 3; ++axis) {
+			if (p[axis] < positions[minPoints[axis]][axis])
+				minPoints[axis] = indices[i];
+			if (p[axis] > positions[maxPoints[axis]][axis])
+				maxPoints[axis] = indices[i];
+		}
+	}
+	auto widestAxis = 0;
+	auto widestDistance = -1.0f;
+	for (auto axis = 0; axis < 3; ++axis) {
+		const auto extent = positions[maxPoints[axis]] - positions[minPoints[axis]];
+		const auto distance = glm::dot(extent, extent);
+		if (distance > widestDistance) {
+			widestDistance = distance;
+			widestAxis = axis;
+		}
+	}
+	auto center = (positions[minPoints[widestAxis]] + positions[maxPoints[widestAxis]]) * 0.5f;
+	auto radius = std::sqrt(widestDistance) * 0.5f;
+
+	// grow it to enclose the rest of the points
+	for (auto i = 0u; i < indicesCount; ++i) {
+		const auto& p = positions[indices[i]];
+		const auto distance = glm::length(p - center);
+		if (distance > radius) {
+			const auto newRadius = (radius + distance) * 0.5f;
+			center += (p - center) * ((newRadius - radius) / distance);
+			radius = newRadius;
+		}
+	}
+	bounds.Center = center;
+	bounds.Radius = radius;
+
+	// the axis of the cone is the average direction of the triangles. The polygons
+	// face the side opposite to (v1 - v0) x (v2 - v0), where their vertex normals point.
+	glm::vec3 axis(0.0f);
+	for (auto i = 0u; i < indicesCount; i += 3) {
+		const auto& p0 = positions[indices[i]];
+		const auto normal = glm::cross(positions[indices[i + 2]] - p0, positions[indices[i + 1]] - p0);
+		const auto length = glm::length(normal);
+		if (length > 0.0f) {
+			axis += normal / length;
+		}
+	}
+	const auto axisLength = glm::length(axis);
+
+	bounds.ConeApex = center;
+	bounds.ConeAxis = glm::vec3(0.0f);
+	bounds.ConeCutoff = 1.0f;
+	if (axisLength <= 0.0f)
+		return;
+	axis /= axisLength;
+
+	// the apex is moved back along the axis until all the triangles are in front of it
+	auto minDot = 1.0f;
+	auto maxOffset = 0.0f;
+	for (auto i = 0u; i < indicesCount; i += 3) {
+		const auto& p0 = positions[indices[i]];
+		auto normal = glm::cross(positions[indices[i + 2]] - p0, positions[indices[i + 1]] - p0);
+		const auto length = glm::length(normal);
+		if (length <= 0.0f)
+			continue;
+		normal /= length;
+
+		const auto axisDot = glm::dot(normal, axis);
+		minDot = std::min(minDot, axisDot);
+		// the test is meaningless for cones wider than a hemisphere
+		if (minDot <= 0.1f)
+			return;
+
+		maxOffset = std::max(maxOffset, glm::dot(center - p0, normal) / axisDot);
+	}
+
+	bounds.ConeApex = center - axis * maxOffset;
+	bounds.ConeAxis = axis;
+	bounds.ConeCutoff = std::sqrt(1.0f - minDot * minDot);
+}
+
+}
@@ -0,0 +1,117 @@
+// Copyright (c) 2013-2016, Stoyan Nikolov
+// All rights reserved.
+// Voxels Library, please see LICENSE for licensing details.
+#pragma once
+
+namespace Voxels
+{
+
+// Size of the FIFO post-transform cache the triangles are optimized for
+// and the ACMR statistics are measured with
+static const unsigned VERTEX_CACHE_SIZE = 16;
+
+// Counts the misses of a FIFO post-transform vertex cache when drawing
+// the triangle list
+unsigned CalculateVertexCacheMisses(const unsigned* indices
+								, unsigned indicesCount
+								, unsigned verticesCount
+								, unsigned cacheSize = VERTEX_CACHE_SIZE);
+
+// Reorders the triangles of the list in-place for post-transform vertex cache
+// locality. Implements "Tipsify" from Sander, Nehab & Barczak,
+// "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw"
+void OptimizeVertexCache(unsigned* indices
+						, unsigned indicesCount
+						, unsigned verticesCount
+						, unsigned cacheSize = VERTEX_CACHE_SIZE);
+
+// Calculates new vertex positions so that the vertices are laid out in
+// the order they are first referenced. Unreferenced vertices go last.
+void CalculateVertexFetchRemap(const unsigned* indices
+							, unsigned indicesCount
+							, unsigned verticesCount
+							, std::vector<unsigned>& remap);
+
+// Calculates new vertex positions that keep the order of the vertices but
+// drop the unreferenced ones. Returns the count of the referenced vertices,
+// the unreferenced ones are remapped after them.
+unsigned CalculateUnusedVerticesRemap(const unsigned* indices
+									, unsigned indicesCount
+									, unsigned verticesCount
+									, std::vector<unsigned>& remap);
+
+// Simplifies the triangle list in-place with half-edge collapses guided by
+// quadric error metrics (Garland & Heckbert). Locked vertices never move.
+// Vertices on open borders of the mesh are locked as well. A vertex collapses
+// only onto a neighbour with the same collapse key. Collapses with a squared error
+// above maxError^2 are never done.
+// Returns the new count of indices
+unsigned SimplifyMesh(unsigned* indices
+					, unsigned indicesCount
+					, const std::vector<glm::vec3>& positions
+					, const std::vector<char>& locked
+					, const std::vector<unsigned>& collapseKeys
+					, float maxError);
+
+// A cluster of triangles built by BuildMeshlets - its triangles are
+// consecutive in the triangle list
+struct MeshletRange
+{
+	unsigned FirstIndex;
+	unsigned IndicesCount;
+	unsigned VerticesCount; // the count of distinct vertices of the triangles
+};
+
+// Reorders the triangles of the list in-place into clusters of adjacent triangles
+// with at most "maxVertices" distinct vertices and "maxTriangles" triangles each.
+// A cluster grows with the triangles that add the fewest vertices to it.
+// Appends the clusters to "meshlets" with "firstIndex" added to their first index.
+void BuildMeshlets(unsigned* indices
+				, unsigned indicesCount
+				, unsigned verticesCount
+				, unsigned maxVertices
+				, unsigned maxTriangles
+				, unsigned firstIndex
+				, std::vector<MeshletRange>& meshlets);
+
+// Bounds of a cluster of triangles for culling
+struct ClusterBounds
+{
+	// the bounding sphere
+	glm::vec3 Center;
+	float Radius;
+
+	// the normal cone - all the triangles face away from a viewer at position V if
+	// dot(normalize(ConeApex - V), ConeAxis) >= ConeCutoff. ConeAxis is zero if the
+	// triangles face too different directions.
+	glm::vec3 ConeApex;
+	glm::vec3 ConeAxis;
+	float ConeCutoff;
+};
+
+// Calculates the bounds of the triangles in the list. The bounding sphere is
+// built with Ritter's algorithm, the normal cone from the triangle normals.
+void CalculateClusterBounds(const unsigned* indices
+						, unsigned indicesCount
+						, const std::vector<glm::vec3>& positions
+						, ClusterBounds& bounds);
+
+// Moves the vertices to their remapped positions and updates the indices
+template<typename Vertex>
+void RemapVertices(std::vector<Vertex>& vertices
+				, unsigned* indices
+				, unsigned indicesCount
+				, const std::vector<unsigned>& remap)
+{
+	std::vector<Vertex> remapped(vertices.size());
+	for (auto i = 0u; i < vertices.size(); ++i) {
+		remapped[remap[i]] = vertices[i];
+	}
+	vertices.swap(remapped);
+
+	for (auto i = 0u; i < indicesCount; ++i) {
+		indices[i] = remap[indices[i]];
+	}
+}
+
+}
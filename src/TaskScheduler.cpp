@@ -0,0 +1,156 @@
+// Copyright (c) 2013-2016, Stoyan Nikolov
+// All rights reserved.
+// Voxels Library, please see LICENSE for licensing details.
+#include "stdafx.h"
+#include "TaskScheduler.h"
+
+#include <thread>
+
+namespace Voxels
+{
+
+TaskScheduler::TaskScheduler(unsigned tasksCount)
+	: m_TasksCount(tasksCount)
+	, m_Dependents(tasksCount)
+	, m_DependenciesCount(tasksCount, 0)
+	, m_PendingDependencies(new std::atomic<unsigned>[tasksCount])
+	, m_WorkersCount(0)
+	, m_RemainingTasks(0)
+	, m_Function(nullptr)
+	, m_ShouldStop(nullptr)
+{}
+
+void TaskScheduler::AddDependency(unsigned task, unsigned dependency)
+{
+	assert(task < m_TasksCount && dependency < m_TasksCount);
+	m_Dependents[dependency].push_back(task);
+	++m_DependenciesCount[task];
+}
+
+void TaskScheduler::Execute(TaskExecutor& executor, unsigned workersCount, const TaskFunction& function)
+{
+	Start(workersCount);
+	Run(executor, function, nullptr);
+}
+
+void TaskScheduler::Start(unsigned workersCount)
+{
+	m_WorkersCount = std::max(workersCount, 1u);
+	m_RemainingTasks = m_TasksCount;
+	if (!m_TasksCount)
+		return;
+
+	m_Queues.reset(new WorkerQueue[m_WorkersCount]);
+
+	// split the initially ready tasks in contiguous ranges, so that every worker
+	// starts with tasks that are close to each other
+	std::vector<unsigned> readyTasks;
+	for (auto task = 0u; task < m_TasksCount; ++task) {
+		m_PendingDependencies[task] = m_DependenciesCount[task];
+		if (!m_DependenciesCount[task]) {
+			readyTasks.push_back(task);
+		}
+	}
+	assert(!readyTasks.empty() && "The task graph has a cycle!");
+
+	const auto readyCount = unsigned(readyTasks.size());
+	for (auto worker = 0u; worker < m_WorkersCount; ++worker) {
+		const auto rangeStart = unsigned(size_t(readyCount) * worker / m_WorkersCount);
+		const auto rangeEnd = unsigned(size_t(readyCount) * (worker + 1) / m_WorkersCount);
+		// the owner takes the last task first
+		m_Queues[worker].Tasks.assign(readyTasks.rbegin() + (readyCount - rangeEnd), readyTasks.rbegin() + (readyCount - rangeStart));
+	}
+}
+
+bool TaskScheduler::Run(TaskExecutor& executor, const TaskFunction& function, const StopFunction* shouldStop)
+{
+	if (!m_RemainingTasks)
+		return true;
+
+	m_Function = &function;
+	m_ShouldStop = shouldStop;
+
+	executor.Run(m_WorkersCount, &TaskScheduler::RunWorker, this);
+
+	m_Function = nullptr;
+	m_ShouldStop = nullptr;
+	if (m_RemainingTasks)
+		return false;
+
+	m_Queues.reset();
+	return true;
+}
+
+void TaskScheduler::RunWorker(void* context, unsigned workerIndex)
+{
+	static_cast<TaskScheduler*>(context)->WorkerLoop(workerIndex);
+}
+
+void TaskScheduler::WorkerLoop(unsigned workerIndex)
+{
+	assert(workerIndex < m_WorkersCount);
+
+	while (m_RemainingTasks) {
+		// the tasks in progress complete, the rest wait for the next run
+		if (m_ShouldStop && (*m_ShouldStop)())
+			break;
+
+		unsigned task;
+		if (PopTask(workerIndex, task) || StealTask(workerIndex, task)) {
+			(*m_Function)(task, workerIndex);
+			CompleteTask(workerIndex, task);
+		} else {
+			// all the ready tasks are taken - wait for some to complete
+			std::this_thread::yield();
+		}
+	}
+}
+
+bool TaskScheduler::PopTask(unsigned workerIndex, unsigned& task)
+{
+	auto& queue = m_Queues[workerIndex];
+	std::lock_guard<std::mutex> lock(queue.Lock);
+	if (queue.Tasks.empty())
+		return false;
+
+	task = queue.Tasks.back();
+	queue.Tasks.pop_back();
+	return true;
+}
+
+bool TaskScheduler::StealTask(unsigned workerIndex, unsigned& task)
+{
+	for (auto i = 1u; i < m_WorkersCount; ++i) {
+		auto& queue = m_Queues[(workerIndex + i) % m_WorkersCount];
+		std::lock_guard<std::mutex> lock(queue.Lock);
+		if (queue.Tasks.empty())
+			continue;
+
+		task = queue.Tasks.front();
+		queue.Tasks.pop_front();
+		return true;
+	}
+
+	return false;
+}
+
+void TaskScheduler::PushTask(unsigned workerIndex, unsigned task)
+{
+	auto& queue = m_Queues[workerIndex];
+	std::lock_guard<std::mutex> lock(queue.Lock);
+	queue.Tasks.push_back(task);
+}
+
+void TaskScheduler::CompleteTask(unsigned workerIndex, unsigned task)
+{
+	const auto& dependents = m_Dependents[task];
+	for (auto dependent = dependents.cbegin(); dependent != dependents.cend(); ++dependent) {
+		if (--m_PendingDependencies[*dependent] == 0) {
+			PushTask(workerIndex, *dependent);
+		}
+	}
+
+	--m_RemainingTasks;
+}
+
+}
@@ -0,0 +1,73 @@
+// Copyright (c) 2013-2016, Stoyan Nikolov
+// All rights reserved.
+// Voxels Library, please see LICENSE for licensing details.
+#pragma once
+
+#include "../include/TaskExecutor.h"
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <mutex>
+
+namespace Voxels
+{
+
+// Runs a graph of tasks on the workers of a TaskExecutor. Every worker
+// owns a queue - it takes its most recently added task first and when the
+// queue is empty steals the oldest task from the other workers. A task is
+// queued on the worker that completed its last dependency.
+class TaskScheduler
+{
+public:
+	typedef std::function<void(unsigned task, unsigned workerIndex)> TaskFunction;
+	typedef std::function<bool()> StopFunction;
+
+	explicit TaskScheduler(unsigned tasksCount);
+
+	// "task" will start only after "dependency" has completed
+	void AddDependency(unsigned task, unsigned dependency);
+
+	// Runs all the tasks and returns after they have completed
+	void Execute(TaskExecutor& executor, unsigned workersCount, const TaskFunction& function);
+
+	// Queues the tasks without dependencies on the workers
+	void Start(unsigned workersCount);
+
+	// Runs tasks until all of them have completed or "shouldStop" returns true.
+	// The tasks not started yet stay queued for the next call.
+	// Returns true when all the tasks have completed.
+	bool Run(TaskExecutor& executor, const TaskFunction& function, const StopFunction* shouldStop);
+
+private:
+	TaskScheduler(const TaskScheduler&);
+	TaskScheduler& operator=(const TaskScheduler&);
+
+	static void RunWorker(void* context, unsigned workerIndex);
+
+	void WorkerLoop(unsigned workerIndex);
+	bool PopTask(unsigned workerIndex, unsigned& task);
+	bool StealTask(unsigned workerIndex, unsigned& task);
+	void PushTask(unsigned workerIndex, unsigned task);
+	void CompleteTask(unsigned workerIndex, unsigned task);
+
+	struct WorkerQueue
+	{
+		std::mutex Lock;
+		std::deque<unsigned> Tasks;
+	};
+
+	unsigned m_TasksCount;
+	std::vector<std::vector<unsigned>> m_Dependents;
+	std::vector<unsigned> m_DependenciesCount;
+	std::unique_ptr<std::atomic<unsigned>[]> m_PendingDependencies;
+
+	unsigned m_WorkersCount;
+	std::unique_ptr<WorkerQueue[]> m_Queues;
+	std::atomic<unsigned> m_RemainingTasks;
+
+	const TaskFunction* m_Function;
+	const StopFunction* m_ShouldStop;
+};
+
+}
@@ -8,33 +8,30 @@
 #include "../include/MaterialMap.h"
 #include "../include/Grid.h"
 
-#include <../dx11-framework/Utilities/MathInlines.h>
+#include "MathInlines.h"
 
 #include "StdAllocatorAligned.h"
 #include "StructConversions.h"
 #include "Aligned.h"
+#include "MeshOptimization.h"
+#include "TaskScheduler.h"
 
 #include <glm/gtx/norm.hpp>
+#include <bitset>
+#include <chrono>
 #include <iterator>
-
-#ifndef PROFI_ENABLE
-	#ifndef _DEBUG
-		#define USE_OPENMAP
-	#endif
-#endif
+#include <thread>
 
 #define SURFACE_SHIFTING_CORRECTION 1
 
 #define USE_MATERIAL_CACHE
 
-#include <concurrent_unordered_map.h>
-
 namespace Voxels
 {
 
-static const glm::vec3 UNIT_X = glm::vec3(1.f, 0.f, 0.f);
-static const glm::vec3 UNIT_Y = glm::vec3(0.f, 1.f, 0.f);
-static const glm::vec3 UNIT_Z = glm::vec3(0.f, 0.f, 1.f);
+static const glm::ivec3 UNIT_X = glm::ivec3(1, 0, 0);
+static const glm::ivec3 UNIT_Y = glm::ivec3(0, 1, 0);
+static const glm::ivec3 UNIT_Z = glm::ivec3(0, 0, 1);
 
 typedef union {
 	float asFloat;
@@ -52,12 +49,36 @@ static const char* LEVEL_STRS[] =
 	"Polygonize block Level 4",
 	"Polygonize block Level 5",
 	"Polygonize block Level 6",
+	"Polygonize block Level 7",
+	"Polygonize block Level 8",
+	"Polygonize block Level 9",
 };
 #endif
 
-static const unsigned BLOCK_EXTENT = 16;
-static const unsigned BLOCK_EXTENT_POWER = 4;
+static const unsigned BLOCK_EXTENT = VoxelGrid::BLOCK_EXTENTS;
+static const unsigned BLOCK_EXTENT_POWER = VoxelGrid::BLOCK_EXTENTS_POWER;
+static const unsigned BLOCK_EXTENT_MASK = BLOCK_EXTENT - 1;
 static const float TRANSITION_CELL_COEFF = 0.25f;
+static const unsigned MATERIALS_COUNT = 1u << (8 * sizeof(MaterialId));
+
+// The values at the ends of an edge with a crossing have different signs, so the
+// difference between them, that the crossing is interpolated with, is below 256.
+// The division by it is done with a multiplication by its rounded up reciprocal,
+// which is exact for all the values, see CalcEdgeInterpolation.
+static const unsigned EDGE_RECIPROCAL_SHIFT = 24;
+struct EdgeReciprocals
+{
+	EdgeReciprocals()
+	{
+		Values[0] = 0;
+		for (auto divisor = 1u; divisor < 256u; ++divisor) {
+			Values[divisor] = ((1u << EDGE_RECIPROCAL_SHIFT) + divisor - 1) / divisor;
+		}
+	}
+
+	unsigned Values[256];
+};
+static const EdgeReciprocals EDGE_RECIPROCALS;
 
 ///////// PUBLIC INTERFACE //////////////
 
@@ -78,6 +99,69 @@ PolygonSurface* Polygonizer::Execute(const Grid& grid,
 	return m_Impl->Execute(*grid.GetInternalRepresentation(), materials, modification);
 }
 
+PolygonSurface* Polygonizer::Execute(const Grid& grid,
+	const MaterialMap* materials,
+	const PolygonizationRegion& region)
+{
+	return m_Impl->Execute(*grid.GetInternalRepresentation(), materials, nullptr, &region);
+}
+
+AsyncPolygonization* Polygonizer::ExecuteAsync(const Grid& grid,
+	const MaterialMap* materials,
+	Modification* modification,
+	PolygonizationListener* listener,
+	int priority)
+{
+	return m_Impl->ExecuteAsync(*grid.GetInternalRepresentation(), materials, modification, listener, priority);
+}
+
+PolygonizationProgress* Polygonizer::ExecuteIncremental(const Grid& grid,
+	const MaterialMap* materials,
+	Modification* modification,
+	const PolygonizationBudget& budget)
+{
+	return m_Impl->ExecuteIncremental(*grid.GetInternalRepresentation(), materials, modification, budget);
+}
+
+void Polygonizer::SetOptions(const PolygonizationOptions& options)
+{
+	m_Impl->SetOptions(options);
+}
+
+const PolygonizationOptions& Polygonizer::GetOptions() const
+{
+	return m_Impl->GetOptions();
+}
+
+PolygonizationOptions::PolygonizationOptions()
+	: OutputFormat(VF_Full)
+	, Method(MM_TransVoxel)
+	, OptimizeVertexCache(false)
+	, GroupIndicesByMaterial(false)
+	, BuildMeshlets(false)
+	, ThreadsCount(0)
+	, Executor(nullptr)
+	, MaxRetainedScratchBytes(64 * 1024 * 1024)
+{
+	std::fill(SimplificationError, SimplificationError + LEVELS_COUNT, 0.0f);
+}
+
+PolygonizationBudget::PolygonizationBudget()
+	: Milliseconds(0.0f)
+	, Cells(0)
+{}
+
+PolygonizationRegion::PolygonizationRegion()
+	: Blocks(nullptr)
+	, BlocksCount(0)
+	, UseViewer(false)
+	, ViewerPosition(0, 0, 0)
+	, MinLevel(0)
+	, MaxLevel(PolygonizationOptions::LEVELS_COUNT - 1)
+{
+	std::fill(LodDistances, LodDistances + PolygonizationOptions::LEVELS_COUNT, 0.0f);
+}
+
 Modification* Modification::Create()
 {
 	auto result = new MapModification;
@@ -111,11 +195,72 @@ const unsigned* MapModification::GetModifiedBlocks(unsigned* count) const
 	return sz ? &ModifiedBlocks[0] : nullptr;
 }
 
+const unsigned* MapModification::GetBlocks(BlockChange change, unsigned* count) const
+{
+	const auto sz = change < BC_Count ? Changes[change].size() : 0;
+	if (count)
+		*count = sz;
+	return sz ? &Changes[change][0] : nullptr;
+}
+
 void MapModification::Destroy()
 {
 	delete this;
 }
 
+AsyncRequest::AsyncRequest(const Voxels::VoxelGrid& grid
+						, const MaterialMap* materials
+						, Modification* modification
+						, PolygonizationListener* listener
+						, const PolygonizationOptions& options
+						, int priority
+						, unsigned sequence)
+	: Grid(grid)
+	, Materials(materials)
+	, Modif(modification)
+	, Listener(listener)
+	, Options(options)
+	, Priority(priority)
+	, Sequence(sequence)
+	, Cancelled(false)
+	, m_Completed(false)
+	, m_Result(nullptr)
+{}
+
+void AsyncRequest::Cancel()
+{
+	Cancelled = true;
+}
+
+bool AsyncRequest::IsCompleted() const
+{
+	std::lock_guard<std::mutex> lock(m_Lock);
+	return m_Completed;
+}
+
+PolygonSurface* AsyncRequest::Wait()
+{
+	std::unique_lock<std::mutex> lock(m_Lock);
+	m_CompletedCondition.wait(lock, [this] { return m_Completed; });
+	return m_Result;
+}
+
+void AsyncRequest::Destroy()
+{
+	Cancel();
+	Wait();
+	delete this;
+}
+
+void AsyncRequest::Complete(PolygonSurface* result)
+{
+	// the request might be destroyed as soon as the lock is released
+	std::lock_guard<std::mutex> lock(m_Lock);
+	m_Result = result;
+	m_Completed = true;
+	m_CompletedCondition.notify_all();
+}
+
 PolygonMap::Statistics::Statistics()
 {
 	Reset();
@@ -127,45 +272,164 @@ void PolygonMap::Statistics::Reset()
 	NonTrivialCells = 0;
 	DegenerateTrianglesRemoved = 0;
 	BlocksCalculated = 0;
+	CacheOptimizedTriangles = 0;
+	VertexCacheMissesBefore = 0;
+	VertexCacheMissesAfter = 0;
+	SimplificationTrianglesRemoved = 0;
 	
 	std::fill(PerCaseCellsCount, PerCaseCellsCount + _countof(PerCaseCellsCount), 0);
 }
 
 PolygonMap::PolygonMap()
 	: Extents(0, 0, 0)
-	, m_NextId(0)
+	, Format(VF_Full)
+	, Method(MM_TransVoxel)
+	, HasPendingModification(false)
+	, PendingMinCorner(0, 0, 0)
+	, PendingMaxCorner(0, 0, 0)
 {
 	Stats.Reset();
 }
 
 PolygonMap::PolygonMap(PolygonMap&& lhs)
-	: Stats(lhs.Stats)
-	, Levels(std::move(lhs.Levels))
+	: Levels(std::move(lhs.Levels))
 	, Extents(std::move(lhs.Extents))
+	, Format(lhs.Format)
+	, Method(lhs.Method)
 	, Cache(std::move(lhs.Cache))
-	, m_NextId(std::move(lhs.m_NextId))
+	, Stats(lhs.Stats)
+	, HasPendingModification(lhs.HasPendingModification)
+	, PendingMinCorner(lhs.PendingMinCorner)
+	, PendingMaxCorner(lhs.PendingMaxCorner)
 {}
 
-unsigned PolygonMap::GetNextBlockId()
+unsigned PolygonMap::GetBlockId(unsigned level, unsigned coordId) const
+{
+	return Levels[level].FirstBlockId + coordId;
+}
+
+void PolygonMap::AddPendingModification(const float3& minCorner, const float3& maxCorner)
 {
-	return m_NextId++;
+	if (HasPendingModification) {
+		PendingMinCorner = float3(std::min(PendingMinCorner.x, minCorner.x), std::min(PendingMinCorner.y, minCorner.y), std::min(PendingMinCorner.z, minCorner.z));
+		PendingMaxCorner = float3(std::max(PendingMaxCorner.x, maxCorner.x), std::max(PendingMaxCorner.y, maxCorner.y), std::max(PendingMaxCorner.z, maxCorner.z));
+	} else {
+		PendingMinCorner = minCorner;
+		PendingMaxCorner = maxCorner;
+		HasPendingModification = true;
+	}
 }
 
 PolygonMap::LodLevel::LodLevel()
+	: FirstBlockId(0)
 {}
 
 PolygonMap::LodLevel::LodLevel(LodLevel&& l)
 	: Blocks(std::move(l.Blocks))
+	, FirstBlockId(l.FirstBlockId)
+	, BlockModes(std::move(l.BlockModes))
+	, BlockIndices(std::move(l.BlockIndices))
 {}
 
+const unsigned PolygonMap::LodLevel::NO_BLOCK;
+
+void PolygonMap::LodLevel::RemoveBlock(unsigned coordId)
+{
+	const auto index = BlockIndices[coordId];
+	if (index == NO_BLOCK)
+		return;
+
+	// move the last block in the place of the removed one
+	if (index != Blocks.size() - 1) {
+		Blocks[index] = std::move(Blocks.back());
+		BlockIndices[Blocks[index].CoordId] = index;
+	}
+	Blocks.pop_back();
+	BlockIndices[coordId] = NO_BLOCK;
+}
+
 PolygonMap::MaterialCache::MaterialCache()
 {}
 
 PolygonMap::MaterialCache::MaterialCache(MaterialCache&& m)
 	: Level0ConsistencyCache(std::move(m.Level0ConsistencyCache))
+	, Level0EmptyBlocks(std::move(m.Level0EmptyBlocks))
 	, LevelMaterialCache(std::move(m.LevelMaterialCache))
 {}
 
+namespace
+{
+	inline bool CellMaterialLess(const PolygonMap::MaterialCache::CellMaterial& lhs, const PolygonMap::MaterialCache::CellMaterial& rhs)
+	{
+		return lhs.LocalId < rhs.LocalId;
+	}
+}
+
+bool PolygonMap::MaterialCache::HasLevel0Surface(unsigned blockCoordId, unsigned localId) const
+{
+	const auto& cells = Level0ConsistencyCache[blockCoordId];
+	return std::binary_search(cells.cbegin(), cells.cend(), (unsigned short)localId);
+}
+
+MaterialInfo PolygonMap::MaterialCache::GetCellMaterial(unsigned level, unsigned blockCoordId, unsigned localId) const
+{
+	assert(level > 0);
+	const auto& cells = LevelMaterialCache[level - 1][blockCoordId];
+	CellMaterial key;
+	key.LocalId = (unsigned short)localId;
+	auto cell = std::lower_bound(cells.cbegin(), cells.cend(), key, &CellMaterialLess);
+	if (cell == cells.cend() || cell->LocalId != localId)
+		return MaterialInfo(VoxelGrid::EMPTY_MATERIAL, 0);
+
+	return cell->Material;
+}
+
+void PolygonMap::MaterialCache::SetCellMaterial(unsigned level, unsigned blockCoordId, unsigned localId, const MaterialInfo& material)
+{
+	CellMaterial cell;
+	cell.LocalId = (unsigned short)localId;
+	cell.Material = material;
+	if (level == 0) {
+		Level0ConsistencyCache[blockCoordId].push_back(cell.LocalId);
+	} else {
+		LevelMaterialCache[level - 1][blockCoordId].push_back(cell);
+	}
+}
+
+void PolygonMap::MaterialCache::ClearBlock(unsigned level, unsigned blockCoordId)
+{
+	if (level == 0) {
+		ConsistencyVec().swap(Level0ConsistencyCache[blockCoordId]);
+	} else {
+		CellMaterialVec().swap(LevelMaterialCache[level - 1][blockCoordId]);
+	}
+}
+
+void PolygonMap::MaterialCache::CompactBlock(unsigned level, unsigned blockCoordId)
+{
+	// the transition cells might set again a cell of the block
+	if (level == 0) {
+		auto& cells = Level0ConsistencyCache[blockCoordId];
+		std::sort(cells.begin(), cells.end());
+		cells.erase(std::unique(cells.begin(), cells.end()), cells.end());
+		ConsistencyVec(cells).swap(cells);
+	} else {
+		auto& cells = LevelMaterialCache[level - 1][blockCoordId];
+		std::stable_sort(cells.begin(), cells.end(), &CellMaterialLess);
+		// keep the material set last
+		auto last = cells.begin();
+		for (auto cell = cells.begin(); cell != cells.end(); ++cell) {
+			if (last != cells.begin() && (last - 1)->LocalId == cell->LocalId) {
+				*(last - 1) = *cell;
+			} else {
+				*last++ = *cell;
+			}
+		}
+		cells.erase(last, cells.end());
+		CellMaterialVec(cells).swap(cells);
+	}
+}
+
 float3 PolygonMap::GetExtents() const
 {
 	return float3(Extents.x, Extents.y, Extents.z);
@@ -188,6 +452,19 @@ const BlockPolygons* PolygonMap::GetBlockForLevel(unsigned level, unsigned id) c
 	return &Levels[level].Blocks[id];
 }
 
+const BlockPolygons* PolygonMap::GetBlockById(unsigned id) const
+{
+	for (auto level = Levels.cbegin(); level != Levels.cend(); ++level) {
+		if (id < level->FirstBlockId || id - level->FirstBlockId >= level->BlockIndices.size())
+			continue;
+
+		const auto index = level->BlockIndices[id - level->FirstBlockId];
+		return index != LodLevel::NO_BLOCK ? &level->Blocks[index] : nullptr;
+	}
+
+	return nullptr;
+}
+
 const PolygonizationStatistics* PolygonMap::GetStatistics() const
 {
 	return &Stats;
@@ -195,24 +472,26 @@ const PolygonizationStatistics* PolygonMap::GetStatistics() const
 
 unsigned PolygonMap::GetCacheSizeBytes() const
 {
-	size_t total = 0;
+	// count the allocated memory, not only the used part
+	size_t total = Cache.Level0ConsistencyCache.capacity() * sizeof(MaterialCache::ConsistencyVec);
 	for (auto blockCache = Cache.Level0ConsistencyCache.cbegin(), blockEnd = Cache.Level0ConsistencyCache.cend(); blockCache != blockEnd; ++blockCache)
 	{
-		total += blockCache->size();
+		total += blockCache->capacity() * sizeof(MaterialCache::ConsistencyVec::value_type);
 	}
-	// divide by 8 to take into account that the values are bools
-	total >>= 3;
+	total += Cache.Level0EmptyBlocks.capacity() * sizeof(unsigned char);
 
+	total += Cache.LevelMaterialCache.capacity() * sizeof(MaterialCache::BlockMaterialVec);
 	for (auto block = Cache.LevelMaterialCache.cbegin(),
 		blockEnd = Cache.LevelMaterialCache.cend();
 		block != blockEnd;
 		++block)
 	{
+		total += block->capacity() * sizeof(MaterialCache::CellMaterialVec);
 		for (auto cell = block->cbegin(), cellEnd = block->cend();
 			cell != cellEnd;
 			++cell)
 		{
-			total += cell->size() * sizeof(MaterialCache::CellMaterialVec::value_type);
+			total += cell->capacity() * sizeof(MaterialCache::CellMaterialVec::value_type);
 		}
 	}
 
@@ -226,38 +505,101 @@ unsigned PolygonMap::GetPolygonDataSizeBytes() const
 		for (auto block = level->Blocks.cbegin(), blockEnd = level->Blocks.cend(); block != blockEnd; ++block) {
 			result += block->Vertices.size() * sizeof(VerticesVec::value_type);
 			result += block->Indices.size() * sizeof(IndicesVec::value_type);
-			result += block->TransitionVertices.size() * sizeof(TransitionVerticesVec::value_type);
-			result += block->TransitionIndices.size() * sizeof(TransitionIndicesVec::value_type);
+			for (auto face = 0u; face < block->TransitionVertices.size(); ++face) {
+				result += block->TransitionVertices[face].size() * sizeof(VerticesVec::value_type);
+				result += block->TransitionIndices[face].size() * sizeof(IndicesVec::value_type);
+			}
+			result += block->Compact.GetSizeBytes();
+			for (auto face = block->TransitionCompact.cbegin(); face != block->TransitionCompact.cend(); ++face) {
+				result += face->GetSizeBytes();
+			}
+			result += block->Positions.size() * sizeof(PositionsVec::value_type);
+			result += block->MaterialRanges.size() * sizeof(MaterialRangesVec::value_type);
+			result += block->Meshlets.size() * sizeof(MeshletsVec::value_type);
 		}
 	}
 
 	return unsigned(result);
 }
 
+VertexFormat PolygonMap::GetVertexFormat() const
+{
+	return Format;
+}
+
 void PolygonMap::Destroy()
 {
 	delete this;
 }
 
-TransVoxelImpl::TransVoxelImpl()
+void TransVoxelImpl::SetOptions(const PolygonizationOptions& options)
+{
+	m_Options = options;
+}
+
+const PolygonizationOptions& TransVoxelImpl::GetOptions() const
+{
+	return m_Options;
+}
+
+CompactMesh::CompactMesh()
 {}
 
+CompactMesh::CompactMesh(CompactMesh&& mesh)
+	: Vertices(std::move(mesh.Vertices))
+	, Indices(std::move(mesh.Indices))
+	, SecondaryPositions(std::move(mesh.SecondaryPositions))
+{}
+
+CompactMesh& CompactMesh::operator=(CompactMesh&& mesh)
+{
+	if (this != &mesh)
+	{
+		std::swap(Vertices, mesh.Vertices);
+		std::swap(Indices, mesh.Indices);
+		std::swap(SecondaryPositions, mesh.SecondaryPositions);
+	}
+
+	return *this;
+}
+
+size_t CompactMesh::GetSizeBytes() const
+{
+	return Vertices.size() * sizeof(VerticesVec::value_type)
+		+ Indices.size() * sizeof(IndicesVec::value_type)
+		+ SecondaryPositions.size() * sizeof(SecondaryVec::value_type);
+}
+
 PolygonBlock::PolygonBlock(unsigned id
+						, unsigned coordId
 						, const float3& min
 						, const float3& max)
-	: MinimalCorner(min)
+	: Id(id)
+	, CoordId(coordId)
+	, ContentHash(0)
+	, MinimalCorner(min)
 	, MaximalCorner(max)
-	, Id(id)
+	, PolygonsMinimalCorner(min)
+	, PolygonsMaximalCorner(max)
 {}
 
 PolygonBlock::PolygonBlock(PolygonBlock&& block)
 	: Id(block.Id)
+	, CoordId(block.CoordId)
+	, ContentHash(block.ContentHash)
 	, Vertices(std::move(block.Vertices))
 	, Indices(std::move(block.Indices))
 	, TransitionVertices(std::move(block.TransitionVertices))
 	, TransitionIndices(std::move(block.TransitionIndices))
+	, Compact(std::move(block.Compact))
+	, TransitionCompact(std::move(block.TransitionCompact))
+	, Positions(std::move(block.Positions))
+	, MaterialRanges(std::move(block.MaterialRanges))
+	, Meshlets(std::move(block.Meshlets))
 	, MinimalCorner(std::move(block.MinimalCorner))
 	, MaximalCorner(std::move(block.MaximalCorner))
+	, PolygonsMinimalCorner(std::move(block.PolygonsMinimalCorner))
+	, PolygonsMaximalCorner(std::move(block.PolygonsMaximalCorner))
 {}
 
 PolygonBlock& PolygonBlock::operator=(PolygonBlock&& block)
@@ -265,13 +607,22 @@ PolygonBlock& PolygonBlock::operator=(PolygonBlock&& block)
 	if (this != &block)
 	{
 		Id = block.Id;
+		CoordId = block.CoordId;
+		ContentHash = block.ContentHash;
 		std::swap(Vertices, block.Vertices);
 		std::swap(Indices, block.Indices);
 		std::swap(TransitionVertices, block.TransitionVertices);
 		std::swap(TransitionIndices, block.TransitionIndices);
+		std::swap(Compact, block.Compact);
+		std::swap(TransitionCompact, block.TransitionCompact);
+		std::swap(Positions, block.Positions);
+		std::swap(MaterialRanges, block.MaterialRanges);
+		std::swap(Meshlets, block.Meshlets);
 
 		MinimalCorner = block.MinimalCorner;
 		MaximalCorner = block.MaximalCorner;
+		PolygonsMinimalCorner = block.PolygonsMinimalCorner;
+		PolygonsMaximalCorner = block.PolygonsMaximalCorner;
 	}
 
 	return *this;
@@ -300,7 +651,7 @@ const unsigned* PolygonBlock::GetIndices(unsigned* count) const
 
 const PolygonVertex* PolygonBlock::GetTransitionVertices(TransitionFaceId face, unsigned* count) const
 {
-	const auto sz = TransitionVertices[face].size();
+	const auto sz = TransitionVertices.empty() ? 0 : TransitionVertices[face].size();
 	if (count)
 		*count = sz;
 	return sz ? &TransitionVertices[face][0] : nullptr;
@@ -308,7 +659,7 @@ const PolygonVertex* PolygonBlock::GetTransitionVertices(TransitionFaceId face,
 
 const unsigned* PolygonBlock::GetTransitionIndices(TransitionFaceId face, unsigned* count) const
 {
-	const auto sz = TransitionIndices[face].size();
+	const auto sz = TransitionIndices.empty() ? 0 : TransitionIndices[face].size();
 	if (count)
 		*count = sz;
 	return sz ? &TransitionIndices[face][0] : nullptr;
@@ -324,6 +675,88 @@ float3 PolygonBlock::GetMaximalCorner() const
 	return float3(MaximalCorner.x, MaximalCorner.y, MaximalCorner.z);
 }
 
+float3 PolygonBlock::GetPolygonsMinimalCorner() const
+{
+	return PolygonsMinimalCorner;
+}
+
+float3 PolygonBlock::GetPolygonsMaximalCorner() const
+{
+	return PolygonsMaximalCorner;
+}
+
+const CompactPolygonVertex* PolygonBlock::GetCompactVertices(unsigned* count) const
+{
+	const auto sz = Compact.Vertices.size();
+	if (count)
+		*count = sz;
+	return sz ? &Compact.Vertices[0] : nullptr;
+}
+
+const unsigned short* PolygonBlock::GetCompactIndices(unsigned* count) const
+{
+	const auto sz = Compact.Indices.size();
+	if (count)
+		*count = sz;
+	return sz ? &Compact.Indices[0] : nullptr;
+}
+
+const CompactSecondaryPosition* PolygonBlock::GetCompactSecondaryPositions(unsigned* count) const
+{
+	const auto sz = Compact.SecondaryPositions.size();
+	if (count)
+		*count = sz;
+	return sz ? &Compact.SecondaryPositions[0] : nullptr;
+}
+
+const CompactPolygonVertex* PolygonBlock::GetCompactTransitionVertices(TransitionFaceId face, unsigned* count) const
+{
+	const auto sz = TransitionCompact.empty() ? 0 : TransitionCompact[face].Vertices.size();
+	if (count)
+		*count = sz;
+	return sz ? &TransitionCompact[face].Vertices[0] : nullptr;
+}
+
+const unsigned short* PolygonBlock::GetCompactTransitionIndices(TransitionFaceId face, unsigned* count) const
+{
+	const auto sz = TransitionCompact.empty() ? 0 : TransitionCompact[face].Indices.size();
+	if (count)
+		*count = sz;
+	return sz ? &TransitionCompact[face].Indices[0] : nullptr;
+}
+
+const CompactSecondaryPosition* PolygonBlock::GetCompactTransitionSecondaryPositions(TransitionFaceId face, unsigned* count) const
+{
+	const auto sz = TransitionCompact.empty() ? 0 : TransitionCompact[face].SecondaryPositions.size();
+	if (count)
+		*count = sz;
+	return sz ? &TransitionCompact[face].SecondaryPositions[0] : nullptr;
+}
+
+const float3* PolygonBlock::GetPositions(unsigned* count) const
+{
+	const auto sz = Positions.size();
+	if (count)
+		*count = sz;
+	return sz ? &Positions[0] : nullptr;
+}
+
+const MaterialIndexRange* PolygonBlock::GetMaterialRanges(unsigned* count) const
+{
+	const auto sz = MaterialRanges.size();
+	if (count)
+		*count = sz;
+	return sz ? &MaterialRanges[0] : nullptr;
+}
+
+const Meshlet* PolygonBlock::GetMeshlets(unsigned* count) const
+{
+	const auto sz = Meshlets.size();
+	if (count)
+		*count = sz;
+	return sz ? &Meshlets[0] : nullptr;
+}
+
 inline unsigned fastlog2i(unsigned value)
 {
 	unsigned ret = 0;
@@ -334,134 +767,261 @@ inline unsigned fastlog2i(unsigned value)
 
 struct TransVoxelRun
 {
-	typedef std::vector<glm::vec4, StdAllocatorAligned<glm::vec4, 16>> SSEVectors;
-	typedef std::vector<SSEVectors> SSEVectorsVec;
-
-	typedef std::vector<glm::vec3, StdAllocatorAligned<glm::vec3, 16>> SSEVectors3;
-	typedef std::vector<SSEVectors3> SSEVectors3Vec;
-
-	typedef IndicesVec IndicesVec;
-	typedef std::vector<IndicesVec> IndicesVecVec;
-	
-	typedef MaterialInfo MaterialInfo;
 	typedef std::vector<MaterialInfo> MaterialsInfo;
 
 	typedef PolygonMap ResultType;
 	typedef MapModification ModificationType;
 	
-	typedef glm::vec3 Coord;
+	// All cell, block and cache indexing is done in integer coordinates.
+	// Floats are used only for the final vertex positions.
+	typedef glm::ivec3 Coord;
+
+	struct Scratch;
 
 	TransVoxelRun(const Voxels::VoxelGrid& grid
 				, const MaterialMap* materials
-				, ModificationType* modification)
+				, ModificationType* modification
+				, const PolygonizationRegion* region
+				, const PolygonizationOptions& options
+				, TaskExecutor& defaultExecutor
+				, Scratch& scratch
+				, PolygonizationListener* listener
+				, const std::atomic<bool>* cancelled)
 		: m_Grid(grid)
 		, m_Materials(materials)
-		, m_Modification(modification)
+		, m_Options(options)
+		, m_LevelBlocks(scratch.LevelBlocks)
+		, m_LevelsCount(0)
+		, m_DefaultExecutor(defaultExecutor)
+		, m_WorkerContexts(scratch.Workers)
 		, m_Result(nullptr)
+		, m_Modification(modification)
+		, m_Region(modification ? nullptr : region)
+		, m_Listener(listener)
+		, m_Cancelled(cancelled)
+		, m_WasCancelled(false)
 	{
 		if(m_Modification) {
 			m_Result = static_cast<PolygonMap*>(m_Modification->Map);
 		}
 	}
 
-	~TransVoxelRun()
-	{
-		std::for_each(m_PerThreadCaches.cbegin(),
-			m_PerThreadCaches.cend(),
-			[](const GridBlockMap::value_type& value)
-		{
-			delete value.second;
-		});
-		m_PerThreadCaches.clear();
-		ts_BlocksCache = nullptr;
-	}
-
-	void GetBlocksCount(unsigned levelMultiplier, Coord& count) {
-		count.x = float((m_Grid.GetWidth() >> BLOCK_EXTENT_POWER) / levelMultiplier);
-		count.y = float((m_Grid.GetDepth() >> BLOCK_EXTENT_POWER) / levelMultiplier);
-		count.z = float((m_Grid.GetHeight() >> BLOCK_EXTENT_POWER) / levelMultiplier);
+	void GetBlocksCount(unsigned level, Coord& count) {
+		count.x = int((m_Grid.GetWidth() >> BLOCK_EXTENT_POWER) >> level);
+		count.y = int((m_Grid.GetDepth() >> BLOCK_EXTENT_POWER) >> level);
+		count.z = int((m_Grid.GetHeight() >> BLOCK_EXTENT_POWER) >> level);
 	}
 
 	void GenerateBlockListForLevel(unsigned level) {
 		// we create a new fresh map
-		m_LoadedBlocks.clear();
-		auto multiplier = 1 << level;
-		m_BlockCounts.resize(std::max(m_BlockCounts.size(), size_t(level + 1)));
-		GetBlocksCount(multiplier, m_BlockCounts[level]);
-		const auto totBlockCnt = m_BlockCounts[level].x * m_BlockCounts[level].y * m_BlockCounts[level].z;
+		auto& loadedBlocks = m_LevelBlocks[level];
+		const auto& blockModes = m_Result->Levels[level].BlockModes;
+		const auto& blocksCnt = m_BlockCounts[level];
+		const auto totBlockCnt = blocksCnt.x * blocksCnt.y * blocksCnt.z;
 		if(!m_Modification) {
-			m_LoadedBlocks.reserve(size_t(totBlockCnt));
+			loadedBlocks.reserve(size_t(totBlockCnt));
+			if (level) {
+				const auto& previousCnt = m_BlockCounts[level - 1];
+				m_Result->Levels[level].FirstBlockId = m_Result->Levels[level - 1].FirstBlockId + unsigned(previousCnt.x * previousCnt.y * previousCnt.z);
+			}
 
-			for(unsigned blockZ = 0; blockZ < m_BlockCounts[level].z; ++blockZ)
-			for(unsigned blockY = 0; blockY < m_BlockCounts[level].y; ++blockY)	
-			for(unsigned blockX = 0; blockX < m_BlockCounts[level].x; ++blockX)
+			for(int blockZ = 0; blockZ < blocksCnt.z; ++blockZ)
+			for(int blockY = 0; blockY < blocksCnt.y; ++blockY)	
+			for(int blockX = 0; blockX < blocksCnt.x; ++blockX)
 			{
-				unsigned coordId = unsigned(blockZ * m_BlockCounts[level].y * m_BlockCounts[level].x + blockY * m_BlockCounts[level].x + blockX);
-				m_LoadedBlocks.push_back(Block(m_Result->GetNextBlockId(), coordId, level, Coord(blockX, blockY, blockZ)));
+				unsigned coordId = unsigned(blockZ * blocksCnt.y * blocksCnt.x + blockY * blocksCnt.x + blockX);
+				if (blockModes[coordId] == ResultType::LodLevel::BM_Skipped)
+					continue;
+
+				loadedBlocks.push_back(Block(m_Result->GetBlockId(level, coordId), coordId, level, Coord(blockX, blockY, blockZ)));
+				loadedBlocks.back().CacheOnly = blockModes[coordId] == ResultType::LodLevel::BM_CacheOnly;
 			}
+			m_Result->Levels[level].BlockIndices.assign(size_t(totBlockCnt), ResultType::LodLevel::NO_BLOCK);
 
-			const auto totalBlockExt = BLOCK_EXTENT*BLOCK_EXTENT*BLOCK_EXTENT;
-			// allocate the caches
+			// allocate the caches - every block fills its own cells when polygonized
 			if (level == 0)
 			{
 				assert(m_Result->Cache.Level0ConsistencyCache.empty());
-				m_Result->Cache.Level0ConsistencyCache.reserve(size_t(totBlockCnt));
-				for (auto i = 0; i < totBlockCnt; ++i)
-				{
-					m_Result->Cache.Level0ConsistencyCache.push_back(ResultType::MaterialCache::ConsistencyVec());
-					m_Result->Cache.Level0ConsistencyCache.back().resize(totalBlockExt);
-				}
+				m_Result->Cache.Level0ConsistencyCache.resize(size_t(totBlockCnt));
+				m_Result->Cache.Level0EmptyBlocks.assign(size_t(totBlockCnt), 0);
 			}
 			else
 			{
 				assert(level > m_Result->Cache.LevelMaterialCache.size());
 				m_Result->Cache.LevelMaterialCache.push_back(ResultType::MaterialCache::BlockMaterialVec());
-				auto& blocksCache = m_Result->Cache.LevelMaterialCache.back();
-				blocksCache.reserve(size_t(totBlockCnt));
-				for (auto i = 0; i < totBlockCnt; ++i)
-				{
-					blocksCache.push_back(ResultType::MaterialCache::CellMaterialVec());
-					blocksCache.back().resize(totalBlockExt, MaterialInfo(VoxelGrid::EMPTY_MATERIAL, 0));
-				}
+				m_Result->Cache.LevelMaterialCache.back().resize(size_t(totBlockCnt));
 			}
 		} 
 		// we want to modify an existing map
+		// the old blocks are replaced only when their polygons have changed
 		else {
-			// NOTE: Here we calculate everything in "outer" coordinates - with Y up
+			std::vector<unsigned> dirtyBlocks;
+			CollectDirtyBlocks(level, dirtyBlocks);
+
+			for (auto coordId = dirtyBlocks.cbegin(); coordId != dirtyBlocks.cend(); ++coordId) {
+				// the parts of the surface that were never polygonized stay so
+				if (blockModes[*coordId] == ResultType::LodLevel::BM_Skipped)
+					continue;
+
+				const int blockX = int(*coordId) % blocksCnt.x;
+				const int blockY = (int(*coordId) / blocksCnt.x) % blocksCnt.y;
+				const int blockZ = int(*coordId) / (blocksCnt.x * blocksCnt.y);
+				loadedBlocks.push_back(Block(m_Result->GetBlockId(level, *coordId), *coordId, level, Coord(blockX, blockY, blockZ)));
+				loadedBlocks.back().CacheOnly = blockModes[*coordId] == ResultType::LodLevel::BM_CacheOnly;
+			}
+		}
+	}
 
-			// find the extended cube that includes the dirty region - we also include the neighbors!
-			const float blockMult = float(multiplier * BLOCK_EXTENT);
-			
-			const glm::vec3 extentsMin = glm::vec3(0.0f);
-			const glm::vec3 extentsMax = tovec3(m_Result->Extents);
-			const glm::vec3 minModified = tovec3(m_Modification->MinCornerModified);
-			const glm::vec3 maxModified = tovec3(m_Modification->MaxCornerModified);
-			const glm::vec3 blockMultVec = glm::vec3(blockMult);
-			const glm::vec3 minCornerDirtyVec = glm::clamp(((glm::floor(minModified / blockMultVec - glm::vec3(1.0f))) * blockMult), extentsMin, extentsMax);
-			const glm::vec3 maxCornerDirtyVec = glm::clamp(((glm::floor(maxModified / blockMultVec + glm::vec3(2.0f))) * blockMult), extentsMin, extentsMax);
-
-			auto& oldLevelBlocks = static_cast<PolygonMap*>(m_Modification->Map)->Levels[level].Blocks;
-			// delete all the old blocks
-			oldLevelBlocks.erase(std::remove_if(oldLevelBlocks.begin(), oldLevelBlocks.end(), [&](PolygonBlock& block) {
-				const glm::vec3 blockMin = tovec3(block.MinimalCorner);
-				return glm::all(glm::greaterThanEqual(blockMin, minCornerDirtyVec)) && glm::all(glm::lessThan(blockMin, maxCornerDirtyVec));
-			}), oldLevelBlocks.end());
-
-			oldLevelBlocks.shrink_to_fit();
-
-			const glm::vec3 minBlockCoord = minCornerDirtyVec / blockMultVec;
-			const glm::vec3 maxBlockCoord = maxCornerDirtyVec / blockMultVec;
-
-			// NOTE: Here we move again to the "inner" coordinates - with Z up
-			for(unsigned blockZ = unsigned(minBlockCoord.y); blockZ < unsigned(maxBlockCoord.y); ++blockZ)
-			for(unsigned blockY = unsigned(minBlockCoord.z); blockY < unsigned(maxBlockCoord.z); ++blockY)	
-			for(unsigned blockX = unsigned(minBlockCoord.x); blockX < unsigned(maxBlockCoord.x); ++blockX)
+	// Decides which blocks of a new map get polygonized - all of them or only the
+	// ones in the region and the finer blocks their material caches depend on
+	void SelectBlocks()
+	{
+		typedef ResultType::LodLevel LodLevel;
+		for (auto level = 0u; level < m_LevelsCount; ++level) {
+			const auto& blocksCnt = m_BlockCounts[level];
+			m_Result->Levels[level].BlockModes.assign(size_t(blocksCnt.x * blocksCnt.y * blocksCnt.z),
+				(unsigned char)(m_Region ? LodLevel::BM_Skipped : LodLevel::BM_Polygonized));
+		}
+		if (!m_Region)
+			return;
+
+		for (auto block = 0u; block < m_Region->BlocksCount; ++block) {
+			const auto& address = m_Region->Blocks[block];
+			const Coord coords(address.X, address.Y, address.Z);
+			if (address.Level >= m_LevelsCount || glm::any(glm::greaterThanEqual(coords, m_BlockCounts[address.Level]))) {
+				char buffer[VOXELS_LOG_SIZE];
+				snprintf(buffer, VOXELS_LOG_SIZE, "Unable to polygonize block %u %u %u of level %u - it is outside of the grid",
+					address.X, address.Y, address.Z, address.Level);
+				VOXLOG(LS_Warning, buffer);
+				continue;
+			}
+			SetBlockMode(address.Level, coords, LodLevel::BM_Polygonized);
+		}
+
+		if (m_Region->UseViewer) {
+			const auto maxLevel = std::min(m_Region->MaxLevel, m_LevelsCount - 1);
+			const auto& blocksCnt = m_BlockCounts[maxLevel];
+			for (int blockZ = 0; blockZ < blocksCnt.z; ++blockZ)
+			for (int blockY = 0; blockY < blocksCnt.y; ++blockY)
+			for (int blockX = 0; blockX < blocksCnt.x; ++blockX)
+			{
+				const Coord coords(blockX, blockY, blockZ);
+				if (GetViewerDistance(maxLevel, coords) < m_Region->LodDistances[maxLevel]) {
+					SelectViewerBlocks(maxLevel, coords);
+				}
+			}
+		}
+
+		// the coarse cells take their materials from the caches of the finer blocks
+		for (auto level = m_LevelsCount - 1; level > 0; --level) {
+			const auto& blocksCnt = m_BlockCounts[level];
+			const auto& blockModes = m_Result->Levels[level].BlockModes;
+			for (int blockZ = 0; blockZ < blocksCnt.z; ++blockZ)
+			for (int blockY = 0; blockY < blocksCnt.y; ++blockY)
+			for (int blockX = 0; blockX < blocksCnt.x; ++blockX)
+			{
+				if (blockModes[blockZ * blocksCnt.y * blocksCnt.x + blockY * blocksCnt.x + blockX] == LodLevel::BM_Skipped)
+					continue;
+
+				for (auto child = 0; child < 8; ++child) {
+					const auto childCoords = (Coord(blockX, blockY, blockZ) << 1) + Cell::GetCornerOffset(child);
+					if (glm::all(glm::lessThan(childCoords, m_BlockCounts[level - 1]))) {
+						SetBlockMode(level - 1, childCoords, LodLevel::BM_CacheOnly);
+					}
+				}
+			}
+		}
+	}
+
+	void SelectViewerBlocks(unsigned level, const Coord& coords)
+	{
+		const auto minLevel = std::min(m_Region->MinLevel, m_LevelsCount - 1);
+		if (level <= minLevel || GetViewerDistance(level, coords) >= m_Region->LodDistances[level - 1]) {
+			SetBlockMode(level, coords, ResultType::LodLevel::BM_Polygonized);
+			return;
+		}
+
+		for (auto child = 0; child < 8; ++child) {
+			const auto childCoords = (coords << 1) + Cell::GetCornerOffset(child);
+			if (glm::all(glm::lessThan(childCoords, m_BlockCounts[level - 1]))) {
+				SelectViewerBlocks(level - 1, childCoords);
+			}
+		}
+	}
+
+	// the distance from the viewer to the closest point of the block
+	float GetViewerDistance(unsigned level, const Coord& coords) const
+	{
+		const auto blockExtent = float(BLOCK_EXTENT << level);
+		const auto minCorner = glm::vec3(coords) * blockExtent;
+		const auto viewer = tovec3(m_Region->ViewerPosition);
+		return glm::distance(viewer, glm::clamp(viewer, minCorner, minCorner + blockExtent));
+	}
+
+	// the mode of a block only grows - a selected block is never turned into a cache only one
+	void SetBlockMode(unsigned level, const Coord& coords, ResultType::LodLevel::BlockMode mode)
+	{
+		const auto& blocksCnt = m_BlockCounts[level];
+		auto& blockMode = m_Result->Levels[level].BlockModes[coords.z * blocksCnt.y * blocksCnt.x + coords.y * blocksCnt.x + coords.x];
+		blockMode = std::max(blockMode, (unsigned char)mode);
+	}
+
+	// Finds the blocks of a level that depend on the modified voxels. The cells of
+	// a block read the voxels up to its far faces and the normals one voxel further
+	// in every direction. On the coarser levels the transition cells and the surface
+	// shifting read up to a fine cell outside the block.
+	void CollectDirtyBlocks(unsigned level, std::vector<unsigned>& dirtyBlocks) const
+	{
+		const auto& blocksCnt = m_BlockCounts[level];
+		const int blockExtent = int(BLOCK_EXTENT) << level;
+		const int margin = level ? (1 << level) + 1 : 1;
+
+		// NOTE: The modified region is in "outer" coordinates - with Y up
+		const glm::vec3 minModified = tovec3(m_ModifiedMinCorner);
+		const glm::vec3 maxModified = tovec3(m_ModifiedMaxCorner);
+		const Coord minVoxel = glm::clamp(Coord(glm::floor(glm::vec3(minModified.x, minModified.z, minModified.y))), Coord(0), m_MaxExtents);
+		const Coord maxVoxel = glm::clamp(Coord(glm::ceil(glm::vec3(maxModified.x, maxModified.z, maxModified.y))), Coord(0), m_MaxExtents);
+
+		// a block reads the voxels from its minimal corner - margin up to its maximal corner + margin
+		const Coord minBlock = glm::max((minVoxel - margin + blockExtent - 1) / blockExtent - 1, Coord(0));
+		const Coord maxBlock = glm::min((maxVoxel + margin) / blockExtent, blocksCnt - 1);
+
+		for (int blockZ = minBlock.z; blockZ <= maxBlock.z; ++blockZ)
+		for (int blockY = minBlock.y; blockY <= maxBlock.y; ++blockY)
+		for (int blockX = minBlock.x; blockX <= maxBlock.x; ++blockX)
+		{
+			dirtyBlocks.push_back(unsigned(blockZ * blocksCnt.y * blocksCnt.x + blockY * blocksCnt.x + blockX));
+		}
+
+		if (level == 0) {
+			// the empty blocks are skipped only when their neighbors are empty too, so
+			// the blocks around the modified ones change if the check gives another answer
+			const Coord minNeighbor = glm::max((minVoxel >> int(BLOCK_EXTENT_POWER)) - 1, Coord(0));
+			const Coord maxNeighbor = glm::min((maxVoxel >> int(BLOCK_EXTENT_POWER)) + 1, blocksCnt - 1);
+			for (int blockZ = minNeighbor.z; blockZ <= maxNeighbor.z; ++blockZ)
+			for (int blockY = minNeighbor.y; blockY <= maxNeighbor.y; ++blockY)
+			for (int blockX = minNeighbor.x; blockX <= maxNeighbor.x; ++blockX)
 			{
-				auto id = m_Result->GetNextBlockId();
-				unsigned coordId = unsigned(blockZ * m_BlockCounts[level].y * m_BlockCounts[level].x + blockY * m_BlockCounts[level].x + blockX);
-				m_LoadedBlocks.push_back(Block(id, coordId, level, Coord(blockX, blockY, blockZ)));
-				m_Modification->ModifiedBlocks.push_back(id);
+				const Coord coords(blockX, blockY, blockZ);
+				if (glm::all(glm::greaterThanEqual(coords, minBlock)) && glm::all(glm::lessThanEqual(coords, maxBlock)))
+					continue;
+
+				const unsigned coordId = unsigned(blockZ * blocksCnt.y * blocksCnt.x + blockY * blocksCnt.x + blockX);
+				if (AreBlockAndNeighborsEmpty(coords) != (m_Result->Cache.Level0EmptyBlocks[coordId] != 0)) {
+					dirtyBlocks.push_back(coordId);
+				}
+			}
+		} else {
+			// the materials of the coarse cells come from the caches of the finer blocks
+			const auto& childBlocks = m_LevelBlocks[level - 1];
+			for (auto child = childBlocks.cbegin(); child != childBlocks.cend(); ++child) {
+				const auto coords = child->Coords >> 1;
+				if (glm::all(glm::lessThan(coords, blocksCnt))) {
+					dirtyBlocks.push_back(unsigned(coords.z * blocksCnt.y * blocksCnt.x + coords.y * blocksCnt.x + coords.x));
+				}
 			}
+			std::sort(dirtyBlocks.begin(), dirtyBlocks.end());
+			dirtyBlocks.erase(std::unique(dirtyBlocks.begin(), dirtyBlocks.end()), dirtyBlocks.end());
 		}
 	}
 	
@@ -469,6 +1029,14 @@ struct TransVoxelRun
 	{
 		PROFI_SCOPE(m_Result ? "Polygonize partial" : "Polygonize full")
 
+		Begin();
+		Continue(nullptr);
+		return Finish();
+	}
+
+	// Prepares the blocks and the tasks to polygonize them
+	void Begin()
+	{
 		const auto gridWidth = m_Grid.GetWidth();
 		const auto gridDepth = m_Grid.GetDepth();
 		const auto gridHeight = m_Grid.GetHeight();
@@ -479,57 +1047,138 @@ struct TransVoxelRun
 			
 			// NOTE: Here the second param is the height, because on output we observe the DX-style components
 			m_Result->Extents = float3(float(gridWidth), float(gridHeight), float(gridDepth));
+			m_Result->Format = m_Options.OutputFormat;
+			// the collision meshes are always built from the regular cells
+			m_Result->Method = m_Options.OutputFormat == VF_Collision ? MM_TransVoxel : m_Options.Method;
 		} else {
 			m_Result->Stats.Reset();
 		}
 		
-		m_BlockCounts.resize(1);
-		m_BlockCounts[0] = m_Grid.GetBlocksCount();
-		m_MaxExtents = glm::vec3(m_Grid.GetWidth() - 1, m_Grid.GetDepth() - 1, m_Grid.GetHeight() - 1);
-
-		const unsigned levelsCount = fastlog2i((gridWidth) >> BLOCK_EXTENT_POWER) + 1;
-		
-		for(auto currentLevel = 0u; currentLevel < levelsCount; ++currentLevel) {
-			if(m_Result->Levels.size() <= currentLevel) {
+		m_MaxExtents = Coord(m_Grid.GetWidth() - 1, m_Grid.GetDepth() - 1, m_Grid.GetHeight() - 1);
+
+		ResolveMaterialTextures();
+
+		// the coarser levels are needed only for rendering
+		const bool singleLevel = m_Result->Format == VF_Collision;
+		m_LevelsCount = singleLevel ? 1 : fastlog2i((gridWidth) >> BLOCK_EXTENT_POWER) + 1;
+		m_LevelBlocks.resize(m_LevelsCount);
+		m_BlockCounts.resize(m_LevelsCount);
+		for (auto level = 0u; level < m_LevelsCount; ++level) {
+			GetBlocksCount(level, m_BlockCounts[level]);
+			if (m_Result->Levels.size() <= level) {
 				m_Result->Levels.push_back(ResultType::LodLevel());
 			}
-			
-			GenerateBlockListForLevel(currentLevel);
-			
-			const int blocksCnt = int(m_LoadedBlocks.size());
-			#ifdef USE_OPENMAP
-			#pragma omp parallel for
-			#endif
-			for (int blockIt = 0; blockIt < blocksCnt; ++blockIt)
-			{
-				Block& block = m_LoadedBlocks[blockIt];
-				{
-					__declspec(thread) static auto tid = 0;
-					tid = ::GetCurrentThreadId();
-					auto cache = m_PerThreadCaches.find(tid);
-					if (cache == m_PerThreadCaches.end()) {
-						auto gridCachePtr = new GridBlocksCache(m_Grid);
-						m_PerThreadCaches.insert(std::make_pair(tid, gridCachePtr));
-						ts_BlocksCache = gridCachePtr;
-					}
-					else {
-						ts_BlocksCache = cache->second;
-					}
-				}
+		}
 
-				const bool isEmpty = block.Level == 0 && AreBlockAndNeighborsEmpty(block);
-				if (!isEmpty) {
-					PolygonizeBlock(block, *m_Result);
-					if (block.Level && (block.Level != levelsCount - 1)) {
-						GenerateTransitionCells(block);
-					}
-				}
+		if (!m_Modification) {
+			SelectBlocks();
+		} else {
+			m_ModifiedMinCorner = m_Modification->MinCornerModified;
+			m_ModifiedMaxCorner = m_Modification->MaxCornerModified;
+			if (m_Result->HasPendingModification) {
+				m_Result->AddPendingModification(m_ModifiedMinCorner, m_ModifiedMaxCorner);
+				m_ModifiedMinCorner = m_Result->PendingMinCorner;
+				m_ModifiedMaxCorner = m_Result->PendingMaxCorner;
+				m_Result->HasPendingModification = false;
+			}
+		}
+		
+		for(auto currentLevel = 0u; currentLevel < m_LevelsCount; ++currentLevel) {
+			GenerateBlockListForLevel(currentLevel);
+		}
+
+		#if SURFACE_SHIFTING_CORRECTION
+		// the coarse levels look up the edge crossings of the level 0 blocks in this run
+		m_Level0BlockIndices.clear();
+		if (m_LevelsCount > 1) {
+			const auto& blocksCnt = m_BlockCounts[0];
+			m_Level0BlockIndices.assign(size_t(blocksCnt.x * blocksCnt.y * blocksCnt.z), unsigned(INVALID_INDEX));
+			const auto& blocks = m_LevelBlocks[0];
+			for (auto blockId = 0u; blockId < blocks.size(); ++blockId) {
+				m_Level0BlockIndices[blocks[blockId].CoordId] = blockId;
+			}
+		}
+		#endif
+
+		PrepareTasks();
+	}
+
+	// Runs the tasks until all have completed or the budget is exhausted.
+	// Returns true when all have completed.
+	bool Continue(const PolygonizationBudget* budget)
+	{
+		PROFI_SCOPE_S2("Run polygonization tasks")
+
+		m_SliceTasks = 0;
+		m_SliceCells = 0;
+		const auto sliceStart = std::chrono::steady_clock::now();
+		const TaskScheduler::StopFunction shouldStop = [this, budget, &sliceStart]() {
+			// every call does some work, so that the polygonization always advances
+			if (!m_SliceTasks)
+				return false;
+			if (budget->Cells && m_SliceCells >= budget->Cells)
+				return true;
+			return budget->Milliseconds > 0.0f
+				&& std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - sliceStart).count() >= budget->Milliseconds;
+		};
+
+		auto& executor = m_Options.Executor ? *m_Options.Executor : m_DefaultExecutor;
+		const auto assemblyTasksOffset = m_LevelTaskOffsets[m_LevelsCount];
+		return m_Scheduler->Run(executor, [this, assemblyTasksOffset](unsigned task, unsigned workerIndex) {
+			assert(workerIndex < m_WorkerContexts.size());
+			++m_SliceTasks;
+			// the remaining tasks of a cancelled run only complete, so that the
+			// levels already pushed to the result stay intact and the rest untouched
+			if (IsCancelled())
+				return;
+
+			if (task >= assemblyTasksOffset) {
+				PushBlocksToResult(task - assemblyTasksOffset);
+				return;
 			}
-			m_Result->Stats.BlocksCalculated += m_LoadedBlocks.size();
-			std::for_each(m_LoadedBlocks.begin(), m_LoadedBlocks.end(), [this](const Block& block) {
+
+			const auto level = unsigned(std::upper_bound(m_LevelTaskOffsets.cbegin(), m_LevelTaskOffsets.cend(), task) - m_LevelTaskOffsets.cbegin()) - 1;
+			auto& block = m_LevelBlocks[level][task - m_LevelTaskOffsets[level]];
+			ProcessBlock(m_WorkerContexts[workerIndex], block);
+			m_SliceCells += block.Stats.TrivialCells + block.Stats.NonTrivialCells;
+		}, budget ? &shouldStop : nullptr);
+	}
+
+	// Collects the results once all the tasks have completed
+	ResultType* Finish()
+	{
+		m_Scheduler.reset();
+
+		unsigned unmappedVertices = 0;
+		UnmappedMaterialsSet unmappedMaterials;
+		for (auto level = m_LevelBlocks.cbegin(); level != m_LevelBlocks.cend(); ++level) {
+			m_Result->Stats.BlocksCalculated += level->size();
+			std::for_each(level->cbegin(), level->cend(), [&](const Block& block) {
 				m_Result->Stats += block.Stats;
+				if (m_Modification && block.Change != BC_Count) {
+					m_Modification->Changes[block.Change].push_back(block.Id);
+					if (block.Change == BC_Added || block.Change == BC_Changed) {
+						m_Modification->ModifiedBlocks.push_back(block.Id);
+					}
+				}
+				unmappedVertices += block.UnmappedMaterialVertices;
+				unmappedMaterials |= block.UnmappedMaterials;
 			});
-			PushBlocksToResult();
+		}
+		if (unmappedVertices) {
+			ReportUnmappedMaterials(unmappedVertices, unmappedMaterials);
+		}
+		// keep only the memory of the block lists for the next run
+		std::for_each(m_LevelBlocks.begin(), m_LevelBlocks.end(), [](BlocksVec& blocks) { blocks.clear(); });
+
+		m_WasCancelled = IsCancelled();
+		if (m_WasCancelled) {
+			// a new map is useless unless complete, a modified one is still valid
+			if (!m_Modification) {
+				m_Result->Destroy();
+				return nullptr;
+			}
+			m_Result->AddPendingModification(m_ModifiedMinCorner, m_ModifiedMaxCorner);
 		}
 		
 		m_Result->Cache.Level0ConsistencyCache.shrink_to_fit();
@@ -537,6 +1186,16 @@ struct TransVoxelRun
 		return m_Result;
 	}
 
+	bool IsCancelled() const
+	{
+		return m_Cancelled && *m_Cancelled;
+	}
+
+	bool WasCancelled() const
+	{
+		return m_WasCancelled;
+	}
+
 private:
 	TransVoxelRun(const TransVoxelRun&);
 	TransVoxelRun& operator=(const TransVoxelRun&);
@@ -567,6 +1226,20 @@ private:
 		bool IsOnBoundary;
 		MaterialInfo Material;
 
+		// bit N is set when corner N is on the face
+		static unsigned char GetCornersMaskForFace(FaceId face) {
+			static const unsigned char FaceCornersMasks[Face_Count] = {
+				0xF0, // ZPos
+				0xCC, // YPos
+				0xAA, // XPos
+				0x0F, // ZNeg
+				0x33, // YNeg
+				0x55  // XNeg
+			};
+
+			return FaceCornersMasks[face];
+		}
+
 		static const char* GetCornerIdsForFace(FaceId face) {
 			static const char FaceCornerIds[Face_Count][4] = {
 				{4, 5, 6, 7}, // ZPos
@@ -581,13 +1254,12 @@ private:
 		}
 
 		static bool IsCornerOnFace(char cornerId, FaceId face) {
-			auto ids = GetCornerIdsForFace(face);
-			const auto end = ids + 4;
-			return end != std::find(ids, end, cornerId);
+			return ((GetCornersMaskForFace(face) >> cornerId) & 1) != 0;
 		}
 
 		static bool IsEdgeOnFace(char corner0, char corner1, FaceId face) {
-			return IsCornerOnFace(corner0, face) && IsCornerOnFace(corner1, face);
+			const auto edgeMask = (1 << corner0) | (1 << corner1);
+			return (GetCornersMaskForFace(face) & edgeMask) == edgeMask;
 		}
 
 		int CornerOnBlockBoundary(char cornerId) const {
@@ -670,7 +1342,7 @@ private:
 			};
 		}
 
-		void GetCornerCoordsForFace(FaceId face, glm::vec3 cornerCoords[4]) const {
+		void GetCornerCoordsForFace(FaceId face, Coord cornerCoords[4]) const {
 			auto ids = GetCornerIdsForFace(face);
 			for(auto i = 0; i < 4; ++i) {
 				cornerCoords[i] = GetCornerCoords(ids[i]);
@@ -680,7 +1352,7 @@ private:
 		// returns a vector directed opposite to the normal of the passed plane and
 		// with the length of the side of the cube. 
 		// NB: the vector is collinear to one of the 3 main axes
-		glm::vec3 GetGlobalDirectionOppositeForFace(FaceId face) const {
+		Coord GetGlobalDirectionOppositeForFace(FaceId face) const {
 			switch(face) {
 			case ZPos:
 				return GetCornerCoords(0) - GetCornerCoords(4);
@@ -702,40 +1374,24 @@ private:
 				break;
 			default:
 				assert(false);
-				return glm::vec3(0);
+				return Coord(0);
 				break;
 			}
 		}
 
-		static glm::vec3 GetCornerCoords(int cornerId, const Coord& base, unsigned levelMultiplier) {
+		// The corner id bits directly encode the offset on every axis - bit 0 is X,
+		// bit 1 is Y and bit 2 is Z
+		static Coord GetCornerOffset(int cornerId) {
 			assert(cornerId >= 0 && cornerId < 8);
+			return Coord(cornerId & 1, (cornerId >> 1) & 1, (cornerId >> 2) & 1);
+		}
 
-			switch(cornerId)
-			{
-			case 0:
-				return base;
-			case 1:
-				return base + UNIT_X * float(levelMultiplier);
-			case 2:
-				return base + UNIT_Y * float(levelMultiplier);
-			case 3:
-				return base + (UNIT_Y + UNIT_X) * float(levelMultiplier);
-			case 4:
-				return base + UNIT_Z * float(levelMultiplier);
-			case 5:
-				return base + (UNIT_Z + UNIT_X) * float(levelMultiplier);
-			case 6:
-				return base + (UNIT_Z + UNIT_Y) * float(levelMultiplier);
-			case 7:
-				return base + (UNIT_Z + UNIT_Y + UNIT_X) * float(levelMultiplier);
-			};
-
-			assert(false);
-			return glm::vec3(FLT_MAX);
+		static Coord GetCornerCoords(int cornerId, const Coord& base, unsigned level) {
+			return base + (GetCornerOffset(cornerId) << int(level));
 		}
 
-		glm::vec3 GetCornerCoords(int cornerId) const {
-			return Cell::GetCornerCoords(cornerId, Base, LevelMultiplier);
+		Coord GetCornerCoords(int cornerId) const {
+			return Cell::GetCornerCoords(cornerId, Base, Level);
 		}
 
 		static unsigned long CalcCaseCode(const char V[8]) {
@@ -750,63 +1406,221 @@ private:
 		}
 	};
 
-	void CalculateMaterialForCellCache(Cell& cell)
+	class GridBlocksCache : public Aligned<16>
+	{
+	public:
+		GridBlocksCache(const Voxels::VoxelGrid& grid)
+		{
+			Reset(grid);
+		}
+
+		// Drops all the cached blocks and starts caching the blocks of "grid"
+		void Reset(const Voxels::VoxelGrid& grid)
+		{
+			m_Grid = &grid;
+			m_CacheToEvict = 0;
+			m_MaterialCacheToEvict = 0;
+			m_GridSzMinusOne = Coord(grid.GetWidth() - 1, grid.GetHeight() - 1, grid.GetDepth() - 1);
+			m_BlocksPerRow = int(grid.GetWidth() >> BLOCK_EXTENT_POWER);
+			m_BlocksPerSlice = int((grid.GetWidth() >> BLOCK_EXTENT_POWER) * (grid.GetHeight() >> BLOCK_EXTENT_POWER));
+
+			std::fill(m_CachedBlocks, m_CachedBlocks + BLOCKS_CACHE_SIZE, std::make_pair(unsigned(FREE_BLOCK), unsigned(FREE_BLOCK)));
+			std::fill(m_MaterialCachedBlocks, m_MaterialCachedBlocks + BLOCKS_CACHE_SIZE, unsigned(FREE_BLOCK));
+		}
+
+		char GetGridValue(unsigned blockLevel,
+			const Coord& blockCoords,
+			const Coord& localCoords) const
+		{
+			return FetchBlock(blockLevel, blockCoords)[CalculatePointId(localCoords)];
+		}
+
+		char GetGridValue(const Coord& coordinates) const
+		{
+			const unsigned blockLevel = 0;
+			Coord clamped;
+			Coord blockCoords;
+
+			CalculateNeededCoords(coordinates,
+				clamped,
+				blockCoords);
+			
+			return GetGridValue(blockLevel, blockCoords, clamped);
+		}
+
+		// The same as GetGridValue for "count" coordinates along X from "start", but
+		// the cached block is looked up only once for all the values in it
+		void GetGridRow(const Coord& start, int count, char* output) const
+		{
+			Coord clamped;
+			Coord blockCoords;
+			CalculateNeededCoords(start, clamped, blockCoords);
+			// the values of a row in a single block are consecutive
+			const int lastX = start.x + count - 1;
+			if (clamped == start && lastX <= m_GridSzMinusOne.x && (lastX >> int(BLOCK_EXTENT_POWER)) == blockCoords.x) {
+				const auto values = FetchBlock(0, blockCoords) + CalculatePointId(clamped);
+				std::copy(values, values + count, output);
+				return;
+			}
+
+			const char* blockFound = nullptr;
+			Coord foundCoords;
+			for (auto i = 0; i < count; ++i) {
+				Coord clamped;
+				Coord blockCoords;
+				CalculateNeededCoords(start + Coord(i, 0, 0), clamped, blockCoords);
+				if (!blockFound || blockCoords != foundCoords) {
+					blockFound = FetchBlock(0, blockCoords);
+					foundCoords = blockCoords;
+				}
+				output[i] = blockFound[CalculatePointId(clamped)];
+			}
+		}
+
+		MaterialInfo GetMaterialGridValue(const Coord& coordinates) const
+		{
+			Coord clamped;
+			Coord blockCoords;
+
+			CalculateNeededCoords(coordinates,
+				clamped,
+				blockCoords);
+
+			const auto blockId = CalculateBlockId(blockCoords);
+
+			const unsigned char* materialBlockFound = nullptr;
+			const unsigned char* blendBlockFound = nullptr;
+			for (auto i = 0u; i < BLOCKS_CACHE_SIZE; ++i)
+			{
+				if (blockId == m_MaterialCachedBlocks[i])
+				{
+					materialBlockFound = m_MaterialCache[i];
+					blendBlockFound = m_BlendCache[i];
+					break;
+				}
+			}
+			if (!materialBlockFound)
+			{
+				PROFI_SCOPE_S3("Fetch material block")
+				m_Grid->GetMaterialBlockData(blockCoords,
+					(unsigned char*)(m_MaterialCache[m_MaterialCacheToEvict]),
+					(unsigned char*)(m_BlendCache[m_MaterialCacheToEvict]));
+				m_MaterialCachedBlocks[m_MaterialCacheToEvict] = blockId;
+				materialBlockFound = m_MaterialCache[m_MaterialCacheToEvict];
+				blendBlockFound = m_BlendCache[m_MaterialCacheToEvict];
+
+				m_MaterialCacheToEvict = (m_MaterialCacheToEvict + 1) % BLOCKS_CACHE_SIZE;
+			}
+
+			const unsigned pointId = CalculatePointId(clamped);
+			return MaterialInfo(materialBlockFound[pointId], blendBlockFound[pointId]);
+		}
+
+	private:
+		// The values of a block - valid until the next block is fetched
+		const char* FetchBlock(unsigned blockLevel, const Coord& blockCoords) const
+		{
+			const auto blockId = CalculateBlockId(blockCoords);
+			for (auto i = 0u; i < BLOCKS_CACHE_SIZE; ++i)
+			{
+				if (blockLevel == m_CachedBlocks[i].first && blockId == m_CachedBlocks[i].second)
+					return m_Cache[i];
+			}
+
+			PROFI_SCOPE_S3("Fetch distance block");
+			m_Grid->GetBlockData(blockCoords, m_Cache[m_CacheToEvict]);
+			m_CachedBlocks[m_CacheToEvict].first = blockLevel;
+			m_CachedBlocks[m_CacheToEvict].second = blockId;
+			const char* blockFound = m_Cache[m_CacheToEvict];
+
+			m_CacheToEvict = (m_CacheToEvict + 1) % BLOCKS_CACHE_SIZE;
+			return blockFound;
+		}
+
+		void CalculateNeededCoords(const Coord& coordinates,
+			Coord& clamped,
+			Coord& blockCoords) const
+		{
+			clamped = glm::clamp(coordinates, Coord(0), m_GridSzMinusOne);
+
+			blockCoords = clamped >> int(BLOCK_EXTENT_POWER);
+		}
+
+		unsigned CalculateBlockId(const Coord& blockCoords) const
+		{
+			return unsigned(blockCoords.x + blockCoords.y * m_BlocksPerRow + blockCoords.z * m_BlocksPerSlice);
+		}
+
+		static unsigned CalculatePointId(const Coord& coords)
+		{
+			// the coordinates might be global - only the in-block part is of interest
+			return MakeLocalId(coords & int(BLOCK_EXTENT_MASK));
+		}
+
+		const Voxels::VoxelGrid* m_Grid;
+		static const unsigned BLOCKS_CACHE_SIZE = 8u;
+		static const unsigned FREE_BLOCK = 0xFFFFFFFF;
+
+		Coord m_GridSzMinusOne;
+		int m_BlocksPerRow;
+		int m_BlocksPerSlice;
+
+		mutable std::pair<unsigned, unsigned> m_CachedBlocks[BLOCKS_CACHE_SIZE];
+		mutable unsigned char m_CacheToEvict;
+		mutable char m_Cache[BLOCKS_CACHE_SIZE][BLOCK_EXTENT*BLOCK_EXTENT*BLOCK_EXTENT];
+
+		mutable unsigned m_MaterialCachedBlocks[BLOCKS_CACHE_SIZE];
+		mutable unsigned char m_MaterialCacheToEvict;
+		mutable unsigned char m_MaterialCache[BLOCKS_CACHE_SIZE][BLOCK_EXTENT*BLOCK_EXTENT*BLOCK_EXTENT];
+		mutable unsigned char m_BlendCache[BLOCKS_CACHE_SIZE][BLOCK_EXTENT*BLOCK_EXTENT*BLOCK_EXTENT];
+	};
+
+	void CalculateMaterialForCellCache(const GridBlocksCache& cache, Cell& cell)
 	{
 		if (cell.LevelMultiplier == 1)
 		{
-			m_Result->Cache.Level0ConsistencyCache[cell.BlockCoordId][cell.LocalId] = 1;
-			cell.Material = GetMaterialInfo(cell.Base);
+			m_Result->Cache.SetCellMaterial(0, cell.BlockCoordId, cell.LocalId, MaterialInfo());
+			cell.Material = cache.GetMaterialGridValue(cell.Base);
 			return;
 		}
 
-		auto baseVec = cell.Base;
-		auto childMult = cell.LevelMultiplier >> 1;
+		const int childLevel = cell.Level - 1;
+		const int childBlockShift = BLOCK_EXTENT_POWER + childLevel;
 
-		const auto childBlockExt = BLOCK_EXTENT * childMult;
-		Coord childBlocksCnt;
-		GetBlocksCount(childMult, childBlocksCnt);
+		const Coord& childBlocksCnt = m_BlockCounts[childLevel];
 		unsigned char materials[8];
 		int counters[8] = { 0 };
 		unsigned blends[8] = { 0 };
 		unsigned count = 0;
 		// calculate the 8 children
-		for (unsigned z = 0; z < 2; ++z)
-		for (unsigned y = 0; y < 2; ++y)
-		for (unsigned x = 0; x < 2; ++x)
+		for (int child = 0; child < 8; ++child)
 		{
-			const auto newBase = baseVec +
-				(UNIT_X * float(x * childMult)) + 
-				(UNIT_Y * float(y * childMult)) + 
-				(UNIT_Z * float(z * childMult));
+			const auto newBase = Cell::GetCornerCoords(child, cell.Base, childLevel);
 
+			const auto childBlock = newBase >> childBlockShift;
 			const unsigned blockId = unsigned(
-				  (unsigned(newBase.z) / childBlockExt) * childBlocksCnt.y * childBlocksCnt.x
-				+ (unsigned(newBase.y) / childBlockExt) * childBlocksCnt.x
-				+ (unsigned(newBase.x) / childBlockExt));
+				  childBlock.z * childBlocksCnt.y * childBlocksCnt.x
+				+ childBlock.y * childBlocksCnt.x
+				+ childBlock.x);
 
-			const auto localCoord = glm::vec3((unsigned)newBase.x % childBlockExt / childMult,
-				(unsigned)newBase.y % childBlockExt / childMult,
-				(unsigned)newBase.z % childBlockExt / childMult);
-
-			const unsigned localId = unsigned(localCoord.z * BLOCK_EXTENT * BLOCK_EXTENT
-				+ localCoord.y * BLOCK_EXTENT
-				+ localCoord.x);
+			const auto localCoord = (newBase >> childLevel) & int(BLOCK_EXTENT_MASK);
+			const unsigned localId = MakeLocalId(localCoord);
 			
 			MaterialInfo childMaterial;
 			if (cell.LevelMultiplier == 2)
 			{
-				if (m_Result->Cache.Level0ConsistencyCache[blockId][localId])
+				if (m_Result->Cache.HasLevel0Surface(blockId, localId))
 				{
-					childMaterial = GetMaterialInfo(newBase);
+					childMaterial = cache.GetMaterialGridValue(newBase);
 				}
 				else
 				{
-					childMaterial.Id = VoxelGrid::EMPTY_MATERIAL;
+					childMaterial = MaterialInfo(VoxelGrid::EMPTY_MATERIAL, 0);
 				}
 			}
 			else
 			{
-				childMaterial = m_Result->Cache.LevelMaterialCache[cell.Level - 2][blockId][localId];
+				childMaterial = m_Result->Cache.GetCellMaterial(childLevel, blockId, localId);
 			}
 
 			bool found = false;
@@ -833,21 +1647,21 @@ private:
 			cell.Material.Id = materials[largestId];
 			cell.Material.Blend = blends[largestId] / *largestCnt;
 
-			m_Result->Cache.LevelMaterialCache[cell.Level - 1][cell.BlockCoordId][cell.LocalId] = cell.Material;
+			m_Result->Cache.SetCellMaterial(cell.Level, cell.BlockCoordId, cell.LocalId, cell.Material);
 		}
 	}
 
-	bool CalculateMaterial(const Coord& base, unsigned multiplier, MaterialInfo& output) {
-		if(multiplier == 1) {
+	bool CalculateMaterial(const GridBlocksCache& cache, const Coord& base, unsigned level, MaterialInfo& output) {
+		if(level == 0) {
 			char V[8];
 			for(auto i = 0; i < 8; ++i) {
-				V[i] = GetGridValue(Cell::GetCornerCoords(i, base, multiplier));	
+				V[i] = cache.GetGridValue(Cell::GetCornerCoords(i, base, level));	
 			}
 			auto caseCode = Cell::CalcCaseCode(V);
 			if(((caseCode ^ ((V[7] >> 7) & 0xFF)) == 0)) {
 				return false; //is trivial
 			}
-			output = GetMaterialInfo(base);
+			output = cache.GetMaterialGridValue(base);
 			return true;
 		}
 
@@ -855,16 +1669,13 @@ private:
 		int counters[8] = {0};
 		unsigned blends[8] = {0};
 		unsigned count = 0;
-		auto childMult = multiplier / 2;
-		Coord nbc; 
+		auto childLevel = level - 1;
 		MaterialInfo childMaterial;
 		// calculate the 8 children
-		for(unsigned z = 0; z < 2; ++z)
-		for(unsigned y = 0; y < 2; ++y)
-		for(unsigned x = 0; x < 2; ++x)
+		for(int child = 0; child < 8; ++child)
 		{
-			auto nb = base + (UNIT_X * float(x * childMult)) + (UNIT_Y * float(y * childMult)) + (UNIT_Z * float(z * childMult));
-			if (CalculateMaterial(nb, childMult, childMaterial)) {
+			auto nb = Cell::GetCornerCoords(child, base, childLevel);
+			if (CalculateMaterial(cache, nb, childLevel, childMaterial)) {
 				bool found = false;
 				for(auto id = 0u; id < count; ++id) {
 					if(materials[id] == childMaterial.Id) {
@@ -894,10 +1705,10 @@ private:
 		}
 	}
 
-	MaterialInfo CalculateMaterialForCell(const Cell& cell) {
+	MaterialInfo CalculateMaterialForCell(const GridBlocksCache& cache, const Cell& cell) {
 		MaterialInfo result;
-		if(!CalculateMaterial(cell.Base, cell.LevelMultiplier, result)) {
-			result = GetMaterialInfo(cell.Base);
+		if(!CalculateMaterial(cache, cell.Base, cell.Level, result)) {
+			result = cache.GetMaterialGridValue(cell.Base);
 		}
 
 		return result;
@@ -913,69 +1724,361 @@ private:
 
 		void Reset()
 		{
-			std::fill(ReuseVertexIndices, ReuseVertexIndices + Size, INVALID_INDEX);
+			std::fill(ReuseVertexIndices, ReuseVertexIndices + Size, unsigned(INVALID_INDEX));
 		}
 
 		unsigned ReuseVertexIndices[Size];
 	};
 
+	typedef GenericFilledCell<4> FilledCell;
+	typedef GenericFilledCell<10> TransitionFilledCell;
+
+	// The samples at the ends of a level 0 edge with a vertex on it. The coarse
+	// levels descend their edges to level 0 to prevent surface shifting and
+	// take the samples from here instead of the grid.
+	struct EdgeCrossing
+	{
+		unsigned Edge; // see MakeEdgeId
+		MaterialInfo Materials[2]; // at the lower and the higher corner
+		glm::vec3 Normals[2];
+		char Values[2];
+	};
+	typedef std::vector<EdgeCrossing> EdgeCrossingsVec;
+
+	// A vertex of a regular cell waiting to be built, see QueueRegularVertex
+	struct PendingVertex
+	{
+		Coord P0;
+		Coord P1; // equal to P0 when the vertex is on a corner of the cell
+		long T; // the weight of P0 in 1/256
+		int Boundaries; // the faces of the block the vertex is on
+		char Values[2]; // the grid values at P0 and P1
+		MaterialInfo Materials[2]; // at P0 and P1
+		const EdgeCrossing* Crossing; // the level 0 samples of the edge
+	};
+	typedef std::vector<PendingVertex> PendingVerticesVec;
+
+	// An edge of a Surface Nets mesh on the faces of its block, see GenerateSurfaceNetsSkirts
+	struct SkirtEdge
+	{
+		unsigned Vertices[2]; // in the winding of their triangle
+		unsigned Faces; // a bit for every face both vertices are on
+	};
+	typedef std::vector<SkirtEdge> SkirtEdgesVec;
+
+	typedef std::bitset<MATERIALS_COUNT> UnmappedMaterialsSet;
+
+	// Vertices are emitted directly in their final output layout. Only the
+	// materials are kept on the side as they are needed for the reuse checks
+	// until the block is finalized. While the block is polygonized all of its
+	// vectors are buffers lent by the worker context.
 	struct Block
 	{
-		// TODO: The data layout of the members in this class is very unoptimal - we should probably move
-		// to a AoS layout as we work with all te props of a vertex
 		Block(unsigned id, unsigned coordId, unsigned level, const Coord& coords)
 			: Id(id)
-			, CoordId(coordId)
 			, Level(level)
 			, LevelMultiplier(1 << level)
+			, CoordId(coordId)
 			, Coords(coords)
-		{
-			TransitionMeshVertices.resize(Cell::Face_Count);
-			TransitionMaterials.resize(Cell::Face_Count);
-			TransitionMeshSecondaryVertices.resize(Cell::Face_Count);
-			TransitionMeshNormals.resize(Cell::Face_Count);
-			TransitionMeshIndices.resize(Cell::Face_Count);
-
-			FilledCells.reserve(BLOCK_EXTENT * BLOCK_EXTENT * BLOCK_EXTENT);
-		}
+			, PolygonsMinimalCorner(0, 0, 0)
+			, PolygonsMaximalCorner(0, 0, 0)
+			, UnmappedMaterialVertices(0)
+			, ContentHash(0)
+			, Change(BC_Count)
+			, CacheOnly(false)
+			, Empty(false)
+		{}
 	
 		unsigned Id;
 		unsigned Level;
 		unsigned LevelMultiplier;
 		unsigned CoordId;
-		typedef GenericFilledCell<4> FilledCell;
 		Coord Coords;
 
-		typedef std::vector<FilledCell> FilledCellsVec;
-		FilledCellsVec FilledCells;
-
 		MaterialsInfo Materials;
-		SSEVectors Vertices;
-		SSEVectors SecondaryVertices;
+		VerticesVec Vertices;
 		IndicesVec Indices;
 		
 		typedef std::vector<MaterialsInfo> MaterialsInfoVec;
-		SSEVectorsVec TransitionMeshVertices;
+		TransitionVerticesVec TransitionVertices;
 		MaterialsInfoVec TransitionMaterials;
-		SSEVectorsVec TransitionMeshSecondaryVertices;
-		SSEVectors3Vec TransitionMeshNormals;
-		IndicesVecVec TransitionMeshIndices;
+		TransitionIndicesVec TransitionIndices;
+
+		CompactMesh Compact;
+		TransitionCompactMeshesVec TransitionCompact;
+
+		// VF_Collision only - indexed by Indices
+		PositionsVec Positions;
+
+		// GroupIndicesByMaterial only - the ranges of Indices with a single material
+		MaterialRangesVec MaterialRanges;
+		// BuildMeshlets only
+		MeshletsVec Meshlets;
+
+		// the bounding box of the polygons, see CalculatePolygonsBounds
+		float3 PolygonsMinimalCorner;
+		float3 PolygonsMaximalCorner;
+
+		// level 0 only - sorted by edge after the block is polygonized
+		EdgeCrossingsVec Crossings;
+
+		unsigned UnmappedMaterialVertices;
+		UnmappedMaterialsSet UnmappedMaterials;
 
-		SSEVectors3 Normals;
+		unsigned long long ContentHash;
+		BlockChange Change; // BC_Count when the block had no polygons before and after the run
+		bool CacheOnly;
+		bool Empty; // skipped as the block and its neighbors have no surface
 
 		ResultType::Statistics Stats;
 	};
 
-	Cell MakeCell(const Coord& globalCoords, unsigned levelMultiplier)
+	// Everything a worker needs to polygonize blocks. The contexts are
+	// indexed by the worker index and aligned to separate cache lines, so
+	// that the workers never share them. They are kept between runs and their
+	// buffers grow until they fit the largest block, so polygonizing a block
+	// doesn't allocate memory other than its final meshes.
+	struct alignas(64) WorkerContext
+	{
+		explicit WorkerContext(const Voxels::VoxelGrid& grid)
+			: Cache(grid)
+		{}
+
+		// Lends the buffers to a block that is about to be polygonized
+		void BeginBlock(Block& block)
+		{
+			assert(block.Vertices.empty() && block.TransitionVertices.empty());
+
+			TransitionMaterials.resize(Cell::Face_Count);
+			TransitionVertices.resize(Cell::Face_Count);
+			TransitionIndices.resize(Cell::Face_Count);
+
+			block.Materials.swap(Materials);
+			block.TransitionMaterials.swap(TransitionMaterials);
+			block.Vertices.swap(Vertices);
+			block.Indices.swap(Indices);
+			block.TransitionVertices.swap(TransitionVertices);
+			block.TransitionIndices.swap(TransitionIndices);
+			block.Positions.swap(Positions);
+		}
+
+		// Takes back the buffers needed only while the cells are polygonized
+		void ReclaimScratch(Block& block)
+		{
+			Materials.swap(block.Materials);
+			Materials.clear();
+			TransitionMaterials.swap(block.TransitionMaterials);
+			std::for_each(TransitionMaterials.begin(), TransitionMaterials.end(), [](MaterialsInfo& materials) { materials.clear(); });
+		}
+
+		// Leaves the block with tightly sized copies of its meshes and takes back the buffers
+		void EndBlock(Block& block)
+		{
+			ReclaimMesh(block.Vertices, Vertices);
+			ReclaimMesh(block.Indices, Indices);
+			ReclaimMesh(block.Positions, Positions);
+
+			TransitionVertices.resize(Cell::Face_Count);
+			TransitionIndices.resize(Cell::Face_Count);
+			for (auto face = 0u; face < Cell::Face_Count; ++face) {
+				ReclaimMesh(block.TransitionVertices[face], TransitionVertices[face]);
+				ReclaimMesh(block.TransitionIndices[face], TransitionIndices[face]);
+			}
+		}
+
+		// Takes back all the buffers of a block whose polygons are not needed
+		void DiscardBlock(Block& block)
+		{
+			ReclaimScratch(block);
+			Vertices.swap(block.Vertices);
+			Vertices.clear();
+			Indices.swap(block.Indices);
+			Indices.clear();
+			TransitionVertices.swap(block.TransitionVertices);
+			std::for_each(TransitionVertices.begin(), TransitionVertices.end(), [](VerticesVec& vertices) { vertices.clear(); });
+			TransitionIndices.swap(block.TransitionIndices);
+			std::for_each(TransitionIndices.begin(), TransitionIndices.end(), [](IndicesVec& indices) { indices.clear(); });
+			Positions.swap(block.Positions);
+			Positions.clear();
+		}
+
+		// Frees the buffers, the grid cache is kept
+		void Release()
+		{
+			FreeVector(Materials);
+			FreeVector(TransitionMaterials);
+			FreeVector(Vertices);
+			FreeVector(Indices);
+			FreeVector(TransitionVertices);
+			FreeVector(TransitionIndices);
+			FreeVector(Positions);
+			FreeVector(PendingVertices);
+			FreeVector(PendingNormals);
+			FreeVector(TriangleMaterials);
+			FreeVector(GroupedIndices);
+			FreeVector(MeshletPositions);
+			FreeVector(MeshletRanges);
+			FreeVector(SkirtVertexFaces);
+			FreeVector(SkirtEdges);
+			FreeVector(SkirtVertices);
+		}
+
+		size_t GetSizeBytes() const
+		{
+			return sizeof(WorkerContext)
+				+ GetCapacityBytes(Materials)
+				+ GetNestedCapacityBytes(TransitionMaterials)
+				+ GetCapacityBytes(Vertices)
+				+ GetCapacityBytes(Indices)
+				+ GetNestedCapacityBytes(TransitionVertices)
+				+ GetNestedCapacityBytes(TransitionIndices)
+				+ GetCapacityBytes(Positions)
+				+ GetCapacityBytes(PendingVertices)
+				+ GetCapacityBytes(PendingNormals)
+				+ GetCapacityBytes(TriangleMaterials)
+				+ GetCapacityBytes(GroupedIndices)
+				+ GetCapacityBytes(MeshletPositions)
+				+ GetCapacityBytes(MeshletRanges)
+				+ GetCapacityBytes(SkirtVertexFaces)
+				+ GetCapacityBytes(SkirtEdges)
+				+ GetCapacityBytes(SkirtVertices);
+		}
+
+		// The regular cells can reuse vertices only from the previous cell in x,
+		// y or z, so only the reuse data of two z-slices of the block is kept
+		FilledCell& GetFilledCell(const Coord& localCoords)
+		{
+			return FilledCellDecks[localCoords.z & 1][(localCoords.y << BLOCK_EXTENT_POWER) | localCoords.x];
+		}
+
+		GridBlocksCache Cache;
+
+		FilledCell FilledCellDecks[2][BLOCK_EXTENT * BLOCK_EXTENT];
+		MaterialsInfo Materials;
+		Block::MaterialsInfoVec TransitionMaterials;
+		VerticesVec Vertices;
+		IndicesVec Indices;
+		TransitionVerticesVec TransitionVertices;
+		TransitionIndicesVec TransitionIndices;
+		PositionsVec Positions;
+
+		// the regular vertices of the block being polygonized and the normals
+		// at the ends of their edges
+		PendingVerticesVec PendingVertices;
+		std::vector<glm::vec3> PendingNormals;
+
+		// the material of every triangle of the block and the indices ordered
+		// by it, see GroupTrianglesByMaterial
+		std::vector<MaterialId> TriangleMaterials;
+		IndicesVec GroupedIndices;
+
+		// the positions of the vertices of the block and its clusters of
+		// triangles, see BuildBlockMeshlets
+		std::vector<glm::vec3> MeshletPositions;
+		std::vector<MeshletRange> MeshletRanges;
+
+		// level 0 - the samples of the block with one more layer around it, which
+		// the normals are calculated from, see SampleGradientField
+		char GradientSamples[(BLOCK_EXTENT + 3) * (BLOCK_EXTENT + 3) * (BLOCK_EXTENT + 3)];
+
+		// the samples on a face of the block at the resolution of the neighbor
+		char TransitionPlane[2 * BLOCK_EXTENT + 1][2 * BLOCK_EXTENT + 1];
+		// the previous and the current row of transition cells on a face
+		TransitionFilledCell TransitionFilledRows[2][BLOCK_EXTENT];
+
+		// Surface Nets - the samples of the block and of the cells one layer
+		// outside of its maximal faces, see GetSurfaceNetsSampleId
+		char SurfaceNetsSamples[(BLOCK_EXTENT + 2) * (BLOCK_EXTENT + 2) * (BLOCK_EXTENT + 2)];
+		// the index in the block vertices of every cell's vertex or INVALID_INDEX
+		unsigned SurfaceNetsVertices[(BLOCK_EXTENT + 1) * (BLOCK_EXTENT + 1) * (BLOCK_EXTENT + 1)];
+		// the materials of the cells of the block, by local id
+		MaterialInfo SurfaceNetsMaterials[BLOCK_EXTENT * BLOCK_EXTENT * BLOCK_EXTENT];
+		// the faces every vertex of the block is on, the edges of the mesh on them and
+		// the skirt vertices of every vertex on the current face, see GenerateSurfaceNetsSkirts
+		std::vector<unsigned char> SkirtVertexFaces;
+		SkirtEdgesVec SkirtEdges;
+		IndicesVec SkirtVertices;
+
+		// VF_Collision - the index of the vertex on every edge and corner of
+		// the block or INVALID_INDEX, see MakeCollisionVertexKey
+		unsigned CollisionVertices[(BLOCK_EXTENT + 1) * (BLOCK_EXTENT + 1) * (BLOCK_EXTENT + 1) * 4];
+
+	private:
+		template<typename Container>
+		static void ReclaimMesh(Container& blockData, Container& buffer)
+		{
+			buffer.swap(blockData);
+			Container(buffer.cbegin(), buffer.cend()).swap(blockData);
+			buffer.clear();
+		}
+
+		template<typename Container>
+		static size_t GetCapacityBytes(const Container& container)
+		{
+			return container.capacity() * sizeof(typename Container::value_type);
+		}
+
+		template<typename Container>
+		static size_t GetNestedCapacityBytes(const std::vector<Container>& containers)
+		{
+			size_t result = containers.capacity() * sizeof(Container);
+			std::for_each(containers.cbegin(), containers.cend(), [&result](const Container& container) {
+				result += GetCapacityBytes(container);
+			});
+			return result;
+		}
+	};
+
+	typedef std::vector<Block> BlocksVec;
+	typedef std::vector<WorkerContext, StdAllocatorAligned<WorkerContext, alignof(WorkerContext)>> WorkerContextsVec;
+
+public:
+	// The memory of a run that is kept for the next runs
+	struct Scratch
+	{
+		std::vector<BlocksVec> LevelBlocks;
+		WorkerContextsVec Workers;
+
+		// Releases memory until at most "maxBytes" are retained. The buffers
+		// of the workers with higher indices are released first.
+		void Trim(size_t maxBytes)
+		{
+			size_t retained = LevelBlocks.capacity() * sizeof(BlocksVec);
+			std::for_each(LevelBlocks.cbegin(), LevelBlocks.cend(), [&retained](const BlocksVec& blocks) {
+				retained += blocks.capacity() * sizeof(Block);
+			});
+			if (retained > maxBytes) {
+				FreeVector(LevelBlocks);
+				retained = 0;
+			}
+
+			for (auto worker = 0u; worker < Workers.size(); ++worker) {
+				auto& context = Workers[worker];
+				if (retained + context.GetSizeBytes() > maxBytes) {
+					context.Release();
+				}
+				if (retained + context.GetSizeBytes() > maxBytes) {
+					Workers.erase(Workers.begin() + worker, Workers.end());
+					break;
+				}
+				retained += context.GetSizeBytes();
+			}
+			if (Workers.empty()) {
+				FreeVector(Workers);
+			}
+		}
+	};
+
+private:
+	Cell MakeCell(const GridBlocksCache& cache, const Coord& globalCoords, unsigned level)
 	{
 		PROFI_SCOPE_S3("MakeCell - coords")
 
 			Cell result;
 		result.Base = globalCoords;
-		result.LevelMultiplier = levelMultiplier;
-		result.LocalBase = glm::vec3((int)globalCoords.x % (BLOCK_EXTENT * levelMultiplier) / levelMultiplier,
-			(int)globalCoords.y % (BLOCK_EXTENT * levelMultiplier) / levelMultiplier,
-			(int)globalCoords.z % (BLOCK_EXTENT * levelMultiplier) / levelMultiplier);
+		result.Level = char(level);
+		result.LevelMultiplier = 1 << level;
+		result.LocalBase = (globalCoords >> int(level)) & int(BLOCK_EXTENT_MASK);
 		result.IsOnBoundary = result.LocalBase.x == 0 || result.LocalBase.x == BLOCK_EXTENT - 1
 			|| result.LocalBase.y == 0 || result.LocalBase.y == BLOCK_EXTENT - 1
 			|| result.LocalBase.z == 0 || result.LocalBase.z == BLOCK_EXTENT - 1;
@@ -983,58 +2086,31 @@ private:
 		result.Material = MaterialInfo(VoxelGrid::EMPTY_MATERIAL, 0);
 
 		for (auto i = 0; i < 8; ++i) {
-			result.V[i] = GetGridValue(result.GetCornerCoords(i));
+			result.V[i] = cache.GetGridValue(result.GetCornerCoords(i));
 		}
 
 #ifndef USE_MATERIAL_CACHE
 		if (result.LevelMultiplier == 1)
 		{
-			cell.Material = GetMaterialInfo(result.LocalBase);
+			cell.Material = cache.GetMaterialGridValue(result.LocalBase);
 		}
 		else
 		{
-			cell.Material = CalculateMaterialForCell(result);
+			cell.Material = CalculateMaterialForCell(cache, result);
 		}
 #endif
 
 		return result;
 	}
 
-	glm::vec3 GetLocalCornerCoords(int cornerId, const Cell& cell, glm::vec3& blockCoords) const {
-		assert(cornerId >= 0 && cornerId < 8);
-
-		glm::vec3 localCoords = cell.LocalBase;
-
-		switch (cornerId)
-		{
-		case 1:
-			localCoords += UNIT_X;
-			break;
-		case 2:
-			localCoords += UNIT_Y;
-			break;
-		case 3:
-			localCoords += (UNIT_Y + UNIT_X);
-			break;
-		case 4:
-			localCoords += UNIT_Z;
-			break;
-		case 5:
-			localCoords += (UNIT_Z + UNIT_X);
-			break;
-		case 6:
-			localCoords += (UNIT_Z + UNIT_Y);
-			break;
-		case 7:
-			localCoords += (UNIT_Z + UNIT_Y + UNIT_X);
-			break;
-		};
+	Coord GetLocalCornerCoords(int cornerId, const Cell& cell, Coord& blockCoords) const {
+		Coord localCoords = cell.LocalBase + Cell::GetCornerOffset(cornerId);
 
-		for (auto i = 0u; i < 3u; ++i) {
-			if (localCoords[i] < BLOCK_EXTENT)
+		for (auto i = 0; i < 3; ++i) {
+			if (localCoords[i] < int(BLOCK_EXTENT))
 				continue;
 
-			auto remainder = long(localCoords[i]) % (BLOCK_EXTENT - 1);
+			auto remainder = localCoords[i] % int(BLOCK_EXTENT - 1);
 			if (remainder) {
 				auto newBlockCoord = blockCoords[i] + remainder;
 				if (newBlockCoord < m_BlockCounts[cell.Level][i]) {
@@ -1049,14 +2125,11 @@ private:
 		return localCoords;
 	}
 
-	Cell MakeCell(const Block& block, const Coord& localCoords)
+	// Sets up a cell of the block without sampling its values
+	Cell MakeCellWithoutValues(const Block& block, const Coord& localCoords) const
 	{
-		PROFI_SCOPE_S3("MakeCell - block")
-
-			Cell result;
-		result.Base = Coord((localCoords.x + block.Coords.x * BLOCK_EXTENT) * block.LevelMultiplier
-			, (localCoords.y + block.Coords.y * BLOCK_EXTENT) * block.LevelMultiplier
-			, (localCoords.z + block.Coords.z * BLOCK_EXTENT) * block.LevelMultiplier);
+		Cell result;
+		result.Base = ((block.Coords << int(BLOCK_EXTENT_POWER)) + localCoords) << int(block.Level);
 
 		result.LevelMultiplier = block.LevelMultiplier;
 		result.Level = block.Level;
@@ -1066,367 +2139,866 @@ private:
 			|| result.LocalBase.z == 0 || result.LocalBase.z == BLOCK_EXTENT - 1;
 
 		result.BlockCoordId = block.CoordId;
-		result.LocalId = unsigned(result.LocalBase.z * BLOCK_EXTENT*BLOCK_EXTENT
-			+ result.LocalBase.y * BLOCK_EXTENT
-			+ result.LocalBase.x);
+		result.LocalId = MakeLocalId(result.LocalBase);
 
-		if (block.Level == 0) {
+		return result;
+	}
+
+	template <bool FinestLevel>
+	Cell MakeCell(const GridBlocksCache& cache, const Block& block, const Coord& localCoords)
+	{
+		PROFI_SCOPE_S3("MakeCell - block")
+
+		assert(FinestLevel == (block.Level == 0));
+		Cell result = MakeCellWithoutValues(block, localCoords);
+		if (FinestLevel) {
 			for (auto i = 0; i < 8; ++i) {
 				auto blockCoords = block.Coords;
 				const auto localCoords = GetLocalCornerCoords(i, result, blockCoords);
-				result.V[i] = GetGridValue(block.Level, blockCoords, localCoords);
+				result.V[i] = cache.GetGridValue(block.Level, blockCoords, localCoords);
 			}
 		}
 		else {
 			for (auto i = 0; i < 8; ++i) {
-				result.V[i] = GetGridValue(result.GetCornerCoords(i));
+				result.V[i] = cache.GetGridValue(result.GetCornerCoords(i));
 			}
 		}
 		return result;
 	}
 
-	class GridBlocksCache : public Aligned<16>
+	glm::vec3 CalcNormal(const GridBlocksCache& cache, const Coord& coord) const
 	{
-	public:
-		GridBlocksCache(const Voxels::VoxelGrid& grid)
-			: m_Grid(grid)
-			, m_CacheToEvict(0)
-			, m_MaterialCacheToEvict(0)
-			, m_GridSzMinusOne(glm::vec3(m_Grid.GetWidth() - 1, m_Grid.GetHeight() - 1, m_Grid.GetDepth() - 1))
-			, m_BlockExt(glm::vec3(float(BLOCK_EXTENT)))
-			, m_BlockCoeffs(glm::vec3(1,
-										(m_Grid.GetWidth() / BLOCK_EXTENT),
-										(m_Grid.GetWidth() / BLOCK_EXTENT) * (m_Grid.GetHeight() / BLOCK_EXTENT)))
-			, m_BlockIdCoeffs(glm::vec3(1, BLOCK_EXTENT, BLOCK_EXTENT * BLOCK_EXTENT))
-		{
-			Reset();
-		}
-
-		void Reset()
-		{
-			std::fill(m_CachedBlocks, m_CachedBlocks + BLOCKS_CACHE_SIZE, std::make_pair(FREE_BLOCK, FREE_BLOCK));
-			std::fill(m_MaterialCachedBlocks, m_MaterialCachedBlocks + BLOCKS_CACHE_SIZE, FREE_BLOCK);
-		}
+		const Coord minVec(0);
+		auto normal = glm::vec3(  (cache.GetGridValue(glm::clamp(coord + UNIT_X, minVec, m_MaxExtents)) - cache.GetGridValue(glm::clamp(coord - UNIT_X, minVec, m_MaxExtents))) * 0.5f,
+								  (cache.GetGridValue(glm::clamp(coord + UNIT_Z, minVec, m_MaxExtents)) - cache.GetGridValue(glm::clamp(coord - UNIT_Z, minVec, m_MaxExtents))) * 0.5f,
+								  (cache.GetGridValue(glm::clamp(coord + UNIT_Y, minVec, m_MaxExtents)) - cache.GetGridValue(glm::clamp(coord - UNIT_Y, minVec, m_MaxExtents))) * 0.5f);
+		return normalizeFixZero(normal);
+	}
 
-		char GetGridValue(unsigned blockLevel,
-			const glm::vec3& blockCoordsf3,
-			const glm::vec3& localCoords) const
-		{
-			const auto blockId = unsigned(glm::dot(blockCoordsf3, m_BlockCoeffs));
-			const char* blockFound = nullptr;
-			for (int i = 0u; i < BLOCKS_CACHE_SIZE; ++i)
-			{
-				if (blockLevel == m_CachedBlocks[i].first && blockId == m_CachedBlocks[i].second)
-				{
-					blockFound = m_Cache[i];
-					break;
-				}
+	// Looks up the material map once for every material id, so that the vertices
+	// take their packed texture indices without a call to the map
+	void ResolveMaterialTextures() {
+		for (auto id = 0u; id < MATERIALS_COUNT; ++id) {
+			auto& textures = m_MaterialTextures[id];
+			const auto m = m_Materials->GetMaterial(MaterialId(id));
+			textures.Mapped = m != nullptr;
+			if (!m) {
+				textures.TI[0] = textures.TI[1] = 0;
+				continue;
 			}
-			if (!blockFound)
-			{
-				PROFI_SCOPE_S3("Fetch distance block");
-				m_Grid.GetBlockData(blockCoordsf3, m_Cache[m_CacheToEvict]);
-				m_CachedBlocks[m_CacheToEvict].first = blockLevel;
-				m_CachedBlocks[m_CacheToEvict].second = blockId;
-				blockFound = m_Cache[m_CacheToEvict];
 
-				m_CacheToEvict = (m_CacheToEvict + 1) % BLOCKS_CACHE_SIZE;
+			PolygonVertex packed;
+			packed.Textures.TI[0] = packed.Textures.TI[1] = 0;
+			packed.Textures.TextureIndices.Txz = m->DiffuseIds0[1];
+			packed.Textures.TextureIndices.Tpy = m->DiffuseIds0[0];
+			packed.Textures.TextureIndices.Tny = m->DiffuseIds0[2];
+
+			packed.Textures.TextureIndices.Uxz = m->DiffuseIds1[1];
+			packed.Textures.TextureIndices.Upy = m->DiffuseIds1[0];
+			packed.Textures.TextureIndices.Uny = m->DiffuseIds1[2];
+
+			textures.TI[0] = packed.Textures.TI[0];
+			textures.TI[1] = packed.Textures.TI[1];
+		}
+	}
+
+	static void ReportUnmappedMaterials(unsigned vertices, const UnmappedMaterialsSet& materials) {
+		char buffer[VOXELS_LOG_SIZE];
+		auto written = snprintf(buffer, VOXELS_LOG_SIZE, "Unable to assign textures on %u vertices with material ids", vertices);
+		for (auto id = 0u; id < MATERIALS_COUNT && written > 0 && written < VOXELS_LOG_SIZE; ++id) {
+			if (materials[id]) {
+				written += snprintf(buffer + written, size_t(VOXELS_LOG_SIZE - written), " %u", id);
+			}
+		}
+		VOXLOG(LS_Error, buffer);
+	}
+	
+	// Transforms a vertex from the internal grid space (scaled by 256 and Z up)
+	// to the output one and appends it
+	unsigned EmitVertex(Block& block,
+		VerticesVec& output,
+		const glm::vec3& position,
+		const glm::vec4& secondaryPosition,
+		const glm::vec3& normal,
+		const MaterialInfo& material)
+	{
+		static const float normFactor = 1 / 256.f;
+
+		output.push_back(PolygonVertex());
+		auto& finalVertex = output.back();
+
+		finalVertex.Position = tofloat3(position * normFactor);
+		// swap z & y so that the returned polygon surface matches the popular DX notation
+		std::swap(finalVertex.Position.y, finalVertex.Position.z);
+
+		#ifdef _DEBUG
+		const auto len = glm::length(normal);
+		assert((len - 1.0f) < 0.01f && "Un-normalized normal detected!");
+		#endif
+		finalVertex.Normal = tofloat3(normal);
+
+		// NB: We swap the last three bits with the three prior to them to 
+		// match the output transition faces enum
+		FloatInt transitionFlags;
+		transitionFlags.asFloat = secondaryPosition.w;
+		if (transitionFlags.asUnsigned) {
+			auto temp3bits = transitionFlags.asUnsigned & 0x7;
+			transitionFlags.asUnsigned >>= 3;
+			transitionFlags.asUnsigned |= (temp3bits << 3);
+		}
+		
+		finalVertex.SecondaryPosition = tofloat4(secondaryPosition * normFactor);
+		finalVertex.SecondaryPosition.w = transitionFlags.asFloat;
+		std::swap(finalVertex.SecondaryPosition.y, finalVertex.SecondaryPosition.z);
+
+		//define the textures
+		const auto& textures = m_MaterialTextures[material.Id];
+		if (textures.Mapped) {
+			finalVertex.Textures.TI[0] = textures.TI[0];
+			finalVertex.Textures.TI[1] = textures.TI[1];
+			finalVertex.Textures.TextureIndices.Blend = material.Blend;
+		} else {
+			++block.UnmappedMaterialVertices;
+			block.UnmappedMaterials.set(material.Id);
+		}
+
+		return unsigned(output.size() - 1);
+	}
+
+	// Called as soon as a block is polygonized - removes the degenerate triangles and
+	// releases all the data needed only during the polygonization
+	void FinalizeBlock(WorkerContext& context, Block& block)
+	{
+		PROFI_SCOPE_S2("Finalize block")
+		if (m_Result->Format == VF_Collision) {
+			const auto& positions = block.Positions;
+			RemoveDegenerateTriangles(block, [&positions](unsigned index) { return tovec3(positions[index]); }, [](const unsigned*) {});
+			// the simplification and the vertex cache optimization need the full vertices
+			context.ReclaimScratch(block);
+
+			if (m_Options.BuildMeshlets) {
+				auto& meshletPositions = context.MeshletPositions;
+				meshletPositions.clear();
+				std::transform(positions.cbegin(), positions.cend(), std::back_inserter(meshletPositions), [](const float3& position) { return tovec3(position); });
+				BuildBlockMeshlets(context, block);
+			}
+			CalculatePolygonsBounds(block);
+		} else {
+			const auto& vertices = block.Vertices;
+			if (m_Options.GroupIndicesByMaterial) {
+				// the materials of the triangles are taken in the same pass
+				const auto& materials = block.Materials;
+				auto& triangleMaterials = context.TriangleMaterials;
+				RemoveDegenerateTriangles(block, [&vertices](unsigned index) { return tovec3(vertices[index].Position); },
+					[&materials, &triangleMaterials](const unsigned* triangle) { triangleMaterials.push_back(GetTriangleMaterial(materials, triangle)); });
+				GroupTrianglesByMaterial(context, block);
+			} else {
+				RemoveDegenerateTriangles(block, [&vertices](unsigned index) { return tovec3(vertices[index].Position); }, [](const unsigned*) {});
+			}
+
+			if (block.Level < PolygonizationOptions::LEVELS_COUNT && m_Options.SimplificationError[block.Level] > 0.0f) {
+				SimplifyBlock(block, m_Options.SimplificationError[block.Level]);
+			}
+
+			context.ReclaimScratch(block);
+
+			if (m_Options.BuildMeshlets) {
+				auto& meshletPositions = context.MeshletPositions;
+				meshletPositions.clear();
+				std::transform(vertices.cbegin(), vertices.cend(), std::back_inserter(meshletPositions), [](const PolygonVertex& vertex) { return tovec3(vertex.Position); });
+				BuildBlockMeshlets(context, block);
+			}
+			CalculatePolygonsBounds(block);
+
+			if (m_Options.OptimizeVertexCache) {
+				if (!block.Meshlets.empty()) {
+					OptimizeMesh(block, block.Vertices, block.Indices, block.Meshlets);
+				} else {
+					OptimizeMesh(block, block.Vertices, block.Indices, block.MaterialRanges);
+				}
+				for (auto face = 0u; face < Cell::Face_Count; ++face) {
+					OptimizeMesh(block, block.TransitionVertices[face], block.TransitionIndices[face], MaterialRangesVec());
+				}
 			}
 
-			const unsigned pointId = unsigned(glm::dot(glm::mod(localCoords, m_BlockExt), m_BlockIdCoeffs));
-			return blockFound[pointId];
+			if (m_Result->Format == VF_Compact) {
+				CompactBlock(block);
+			}
 		}
 
-		char GetGridValue(const glm::vec3& coordinates) const
-		{
-			const unsigned blockLevel = 0;
-			glm::vec3 clamped;
-			glm::vec3 blockCoordsf3;
+		context.EndBlock(block);
 
-			CalculateNeededCoords(coordinates,
-				clamped,
-				blockCoordsf3);
-			
-			return GetGridValue(blockLevel, blockCoordsf3, clamped);
+		// only modifications compare the blocks with their previous polygons - the blocks
+		// of a new surface are hashed the first time a modification compares them
+		if (m_Modification) {
+			block.ContentHash = CalculateContentHash(block);
 		}
+	}
 
-		MaterialInfo GetMaterialGridValue(const glm::vec3& coordinates) const
+	// Calls "keepTriangle" with the indices of every triangle that is kept
+	template<typename GetPosition, typename KeepTriangle>
+	static void RemoveDegenerateTriangles(Block& block, const GetPosition& getPosition, const KeepTriangle& keepTriangle)
+	{
+		auto& indices = block.Indices;
+
+		// positions are already scaled down by 256 on output, so is the threshold
+		const float posScale = 1 / 256.f;
+		const auto eps = std::numeric_limits<float>::epsilon() * (posScale * posScale) * (posScale * posScale);
+		const auto indSz = indices.size();
+		auto outputIndex = 0u;
+		for(auto i = 0u; i < indSz; i += 3)
 		{
-			glm::vec3 clamped;
-			glm::vec3 blockCoordsf3;
+			const auto v0 = getPosition(indices[i]);
+			const auto v1 = getPosition(indices[i + 1]);
+			const auto v2 = getPosition(indices[i + 2]);
 
-			CalculateNeededCoords(coordinates,
-				clamped,
-				blockCoordsf3);
-
-			const auto blockId = unsigned(glm::dot(blockCoordsf3, m_BlockCoeffs));
+			const auto len = glm::length2(glm::cross(v1 - v0, v2 - v0));
 
-			const unsigned char* materialBlockFound = nullptr;
-			const unsigned char* blendBlockFound = nullptr;
-			for (int i = 0u; i < BLOCKS_CACHE_SIZE; ++i)
+			if(len >= eps)
 			{
-				if (blockId == m_MaterialCachedBlocks[i])
-				{
-					materialBlockFound = m_MaterialCache[i];
-					blendBlockFound = m_BlendCache[i];
-					break;
-				}
+				keepTriangle(&indices[i]);
+				indices[outputIndex++] = indices[i];
+				indices[outputIndex++] = indices[i + 1];
+				indices[outputIndex++] = indices[i + 2];
 			}
-			if (!materialBlockFound)
+			else
 			{
-				PROFI_SCOPE_S3("Fetch material block")
-				const auto vec3coords = glm::vec3(blockCoordsf3.x, blockCoordsf3.y, blockCoordsf3.z);
-				m_Grid.GetMaterialBlockData(vec3coords,
-					(unsigned char*)(m_MaterialCache[m_MaterialCacheToEvict]),
-					(unsigned char*)(m_BlendCache[m_MaterialCacheToEvict]));
-				m_MaterialCachedBlocks[m_MaterialCacheToEvict] = blockId;
-				materialBlockFound = m_MaterialCache[m_MaterialCacheToEvict];
-				blendBlockFound = m_BlendCache[m_MaterialCacheToEvict];
+				++block.Stats.DegenerateTrianglesRemoved;
+			}
+		}
+		indices.resize(outputIndex);
+	}
 
-				m_MaterialCacheToEvict = (m_MaterialCacheToEvict + 1) % BLOCKS_CACHE_SIZE;
+	template<typename Vector>
+	static void HashVector(unsigned long long& hash, const Vector& data)
+	{
+		// FNV-1a over the raw bytes, with the size hashed first
+		const auto size = data.size();
+		const auto sizeBytes = reinterpret_cast<const unsigned char*>(&size);
+		const auto dataBytes = reinterpret_cast<const unsigned char*>(data.data());
+		for (auto i = 0u; i < sizeof(size); ++i) {
+			hash = (hash ^ sizeBytes[i]) * 1099511628211ull;
+		}
+		for (auto i = size_t(0); i < size * sizeof(typename Vector::value_type); ++i) {
+			hash = (hash ^ dataBytes[i]) * 1099511628211ull;
+		}
+	}
+
+	template<typename BlockType>
+	static unsigned long long CalculateContentHash(const BlockType& block)
+	{
+		unsigned long long hash = 14695981039346656037ull;
+		HashVector(hash, block.Vertices);
+		HashVector(hash, block.Indices);
+		for (auto face = 0u; face < block.TransitionVertices.size(); ++face) {
+			HashVector(hash, block.TransitionVertices[face]);
+			HashVector(hash, block.TransitionIndices[face]);
+		}
+		HashVector(hash, block.Compact.Vertices);
+		HashVector(hash, block.Compact.Indices);
+		HashVector(hash, block.Compact.SecondaryPositions);
+		for (auto face = block.TransitionCompact.cbegin(); face != block.TransitionCompact.cend(); ++face) {
+			HashVector(hash, face->Vertices);
+			HashVector(hash, face->Indices);
+			HashVector(hash, face->SecondaryPositions);
+		}
+		HashVector(hash, block.Positions);
+		HashVector(hash, block.MaterialRanges);
+		HashVector(hash, block.Meshlets);
+
+		return hash;
+	}
+
+	// Splits the triangles in meshlets - inside the material ranges when there are any.
+	// The positions of the vertices are expected in the MeshletPositions of the context.
+	static void BuildBlockMeshlets(WorkerContext& context, Block& block)
+	{
+		PROFI_SCOPE_S2("Build meshlets")
+
+		auto& indices = block.Indices;
+		const auto& positions = context.MeshletPositions;
+		const auto verticesCount = unsigned(positions.size());
+		auto& ranges = context.MeshletRanges;
+		ranges.clear();
+		if (block.MaterialRanges.empty()) {
+			if (!indices.empty()) {
+				BuildMeshlets(&indices[0], unsigned(indices.size()), verticesCount, Meshlet::MAX_VERTICES, Meshlet::MAX_TRIANGLES, 0, ranges);
 			}
+		} else {
+			std::for_each(block.MaterialRanges.cbegin(), block.MaterialRanges.cend(), [&](const MaterialIndexRange& material) {
+				BuildMeshlets(&indices[material.FirstIndex], material.IndicesCount, verticesCount, Meshlet::MAX_VERTICES, Meshlet::MAX_TRIANGLES, material.FirstIndex, ranges);
+			});
+		}
 
-			const unsigned pointId = unsigned(glm::dot(glm::mod(clamped, m_BlockExt), m_BlockIdCoeffs));
-			return MaterialInfo(materialBlockFound[pointId], blendBlockFound[pointId]);
+		auto& meshlets = block.Meshlets;
+		meshlets.resize(ranges.size());
+		for (auto i = 0u; i < ranges.size(); ++i) {
+			const auto& range = ranges[i];
+			ClusterBounds bounds;
+			CalculateClusterBounds(&indices[range.FirstIndex], range.IndicesCount, positions, bounds);
+
+			auto& meshlet = meshlets[i];
+			meshlet.FirstIndex = range.FirstIndex;
+			meshlet.IndicesCount = range.IndicesCount;
+			meshlet.VerticesCount = range.VerticesCount;
+			meshlet.Center = tofloat3(bounds.Center);
+			meshlet.Radius = bounds.Radius;
+			meshlet.ConeApex = tofloat3(bounds.ConeApex);
+			meshlet.ConeAxis = tofloat3(bounds.ConeAxis);
+			meshlet.ConeCutoff = bounds.ConeCutoff;
 		}
+	}
 
-	private:
-		void CalculateNeededCoords(const glm::vec3& coordinates,
-			glm::vec3& clamped,
-			glm::vec3& blockCoordsf3) const
-		{
-			clamped = glm::clamp(coordinates, glm::vec3(0.f), m_GridSzMinusOne);
+	// The box around the vertices, the transition vertices and the secondary positions
+	// of the vertices on the transition faces - a renderer draws inside it whichever
+	// of them it uses. A block without any points gets its extents.
+	static void CalculatePolygonsBounds(Block& block)
+	{
+		bool hasPoints = false;
+		glm::vec3 minCorner;
+		glm::vec3 maxCorner;
+		auto addPoint = [&hasPoints, &minCorner, &maxCorner](const glm::vec3& point) {
+			if (!hasPoints) {
+				minCorner = point;
+				maxCorner = point;
+				hasPoints = true;
+			}
+			minCorner = glm::min(minCorner, point);
+			maxCorner = glm::max(maxCorner, point);
+		};
+		std::for_each(block.Positions.cbegin(), block.Positions.cend(), [&addPoint](const float3& position) { addPoint(tovec3(position)); });
+		std::for_each(block.Vertices.cbegin(), block.Vertices.cend(), [&addPoint](const PolygonVertex& vertex) {
+			addPoint(tovec3(vertex.Position));
+			if (GetOutputTransitionFlags(vertex)) {
+				addPoint(glm::vec3(vertex.SecondaryPosition.x, vertex.SecondaryPosition.y, vertex.SecondaryPosition.z));
+			}
+		});
+		std::for_each(block.TransitionVertices.cbegin(), block.TransitionVertices.cend(), [&addPoint](const VerticesVec& vertices) {
+			std::for_each(vertices.cbegin(), vertices.cend(), [&addPoint](const PolygonVertex& vertex) { addPoint(tovec3(vertex.Position)); });
+		});
 
-			blockCoordsf3 = glm::floor(clamped / m_BlockExt);
+		if (!hasPoints) {
+			GetBlockCorners(block, block.PolygonsMinimalCorner, block.PolygonsMaximalCorner);
+			return;
 		}
+		block.PolygonsMinimalCorner = tofloat3(minCorner);
+		block.PolygonsMaximalCorner = tofloat3(maxCorner);
+	}
 
-		const Voxels::VoxelGrid& m_Grid;
-		static const unsigned BLOCKS_CACHE_SIZE = 8u;
-		static const unsigned FREE_BLOCK = 0xFFFFFFFF;
+	// The material of at least two of the vertices of a triangle or of the
+	// first one if all three differ
+	static MaterialId GetTriangleMaterial(const MaterialsInfo& materials, const unsigned* triangle)
+	{
+		const auto m1 = materials[triangle[1]].Id;
+		return m1 == materials[triangle[2]].Id ? m1 : materials[triangle[0]].Id;
+	}
 
-		glm::vec3 m_GridSzMinusOne;
-		glm::vec3 m_BlockExt;
-		glm::vec3 m_BlockIdCoeffs;
-		glm::vec3 m_BlockCoeffs;
+	// Orders the triangles of the block by the materials in TriangleMaterials with
+	// a counting sort, so that the triangles of a material keep their order
+	static void GroupTrianglesByMaterial(WorkerContext& context, Block& block)
+	{
+		PROFI_SCOPE_S2("Group triangles by material")
+
+		auto& triangleMaterials = context.TriangleMaterials;
+		auto& indices = block.Indices;
+		assert(triangleMaterials.size() * 3 == indices.size());
+
+		unsigned firstIndices[MATERIALS_COUNT] = {};
+		std::for_each(triangleMaterials.cbegin(), triangleMaterials.cend(), [&firstIndices](MaterialId material) { firstIndices[material] += 3; });
+
+		// resize value-initializes the ranges, so that their padding is hashed as zeroes
+		block.MaterialRanges.clear();
+		auto firstIndex = 0u;
+		for (auto material = 0u; material < MATERIALS_COUNT; ++material) {
+			const auto count = firstIndices[material];
+			firstIndices[material] = firstIndex;
+			if (!count)
+				continue;
 
-		mutable std::pair<unsigned, unsigned> m_CachedBlocks[BLOCKS_CACHE_SIZE];
-		mutable char m_CacheToEvict;
-		mutable char m_Cache[BLOCKS_CACHE_SIZE][BLOCK_EXTENT*BLOCK_EXTENT*BLOCK_EXTENT];
+			block.MaterialRanges.resize(block.MaterialRanges.size() + 1);
+			auto& range = block.MaterialRanges.back();
+			range.Material = MaterialId(material);
+			range.FirstIndex = firstIndex;
+			range.IndicesCount = count;
+			firstIndex += count;
+		}
 
-		mutable unsigned m_MaterialCachedBlocks[BLOCKS_CACHE_SIZE];
-		mutable char m_MaterialCacheToEvict;
-		mutable unsigned char m_MaterialCache[BLOCKS_CACHE_SIZE][BLOCK_EXTENT*BLOCK_EXTENT*BLOCK_EXTENT];
-		mutable unsigned char m_BlendCache[BLOCKS_CACHE_SIZE][BLOCK_EXTENT*BLOCK_EXTENT*BLOCK_EXTENT];
-	};
+		auto& grouped = context.GroupedIndices;
+		grouped.resize(indices.size());
+		for (auto triangle = 0u; triangle < triangleMaterials.size(); ++triangle) {
+			auto& output = firstIndices[triangleMaterials[triangle]];
+			std::copy(&indices[triangle * 3], &indices[triangle * 3] + 3, &grouped[output]);
+			output += 3;
+		}
+		indices.swap(grouped);
+		grouped.clear();
+		triangleMaterials.clear();
+	}
+
+	static void SimplifyBlock(Block& block, float maxError)
+	{
+		PROFI_SCOPE_S2("Simplify block")
+
+		auto& vertices = block.Vertices;
+		auto& indices = block.Indices;
+		if (indices.empty())
+			return;
+
+		// the vertices in the boundary cells are shared with the neighbours
+		// and the transition meshes
+		float3 minCorner;
+		float3 maxCorner;
+		GetBlockCorners(block, minCorner, maxCorner);
+		const glm::vec3 cellSize(float(block.LevelMultiplier));
+		const glm::vec3 innerMin = tovec3(minCorner) + cellSize;
+		const glm::vec3 innerMax = tovec3(maxCorner) - cellSize;
+
+		const auto verticesCount = unsigned(vertices.size());
+		std::vector<glm::vec3> positions(verticesCount);
+		std::vector<char> locked(verticesCount);
+		std::vector<unsigned> collapseKeys(verticesCount);
+		for (auto i = 0u; i < verticesCount; ++i) {
+			positions[i] = tovec3(vertices[i].Position);
+			locked[i] = GetOutputTransitionFlags(vertices[i])
+				|| glm::any(glm::lessThanEqual(positions[i], innerMin))
+				|| glm::any(glm::greaterThanEqual(positions[i], innerMax));
+			// don't collapse over material borders
+			collapseKeys[i] = block.Materials[i].Id;
+		}
+
+		const auto indicesCount = SimplifyMesh(&indices[0], unsigned(indices.size()), positions, locked, collapseKeys, maxError);
+		block.Stats.SimplificationTrianglesRemoved += unsigned(indices.size() - indicesCount) / 3;
+		indices.resize(indicesCount);
+
+		// the remaining triangles keep their order and their materials, as only vertices
+		// with the same material are collapsed - count them again
+		if (!block.MaterialRanges.empty()) {
+			auto& ranges = block.MaterialRanges;
+			std::for_each(ranges.begin(), ranges.end(), [](MaterialIndexRange& range) { range.IndicesCount = 0; });
+			auto range = ranges.begin();
+			for (auto i = 0u; i < indicesCount; i += 3) {
+				const auto material = GetTriangleMaterial(block.Materials, &indices[i]);
+				while (range != ranges.end() && range->Material != material) {
+					++range;
+				}
+				assert(range != ranges.end());
+				if (range == ranges.end())
+					break;
+				range->IndicesCount += 3;
+			}
+			ranges.erase(std::remove_if(ranges.begin(), ranges.end(), [](const MaterialIndexRange& range) { return !range.IndicesCount; }), ranges.end());
+			auto firstIndex = 0u;
+			std::for_each(ranges.begin(), ranges.end(), [&firstIndex](MaterialIndexRange& range) {
+				range.FirstIndex = firstIndex;
+				firstIndex += range.IndicesCount;
+			});
+		}
+
+		std::vector<unsigned> remap;
+		const auto usedCount = CalculateUnusedVerticesRemap(indices.empty() ? nullptr : &indices[0], indicesCount, verticesCount, remap);
+		RemapVertices(vertices, indices.empty() ? nullptr : &indices[0], indicesCount, remap);
+		vertices.resize(usedCount);
+	}
 
-	char GetGridValue(unsigned blockLevel,
-		const glm::vec3& blockCoordsf3,
-		const glm::vec3& localCoords) const
+	// The triangles are reordered only inside the ranges, when there are any
+	template<typename Ranges>
+	static void OptimizeMesh(Block& block, VerticesVec& vertices, IndicesVec& indices, const Ranges& ranges)
 	{
-		return ts_BlocksCache->GetGridValue(blockLevel, blockCoordsf3, localCoords);
+		PROFI_SCOPE_S2("Optimize vertex cache")
+
+		if (indices.empty())
+			return;
+
+		const auto verticesCount = unsigned(vertices.size());
+		const auto indicesCount = unsigned(indices.size());
+
+		block.Stats.CacheOptimizedTriangles += indicesCount / 3;
+		block.Stats.VertexCacheMissesBefore += CalculateVertexCacheMisses(&indices[0], indicesCount, verticesCount);
+
+		if (ranges.empty()) {
+			OptimizeVertexCache(&indices[0], indicesCount, verticesCount);
+		} else {
+			// every range is optimized with its vertices numbered from zero, so that the
+			// optimization of small ranges doesn't depend on the count of all the vertices
+			std::vector<unsigned> localVertices(verticesCount, std::numeric_limits<unsigned>::max());
+			std::vector<unsigned> rangeVertices;
+			std::vector<unsigned> rangeIndices;
+			std::for_each(ranges.cbegin(), ranges.cend(), [&](const typename Ranges::value_type& range) {
+				rangeVertices.clear();
+				rangeIndices.clear();
+				for (auto i = range.FirstIndex; i < range.FirstIndex + range.IndicesCount; ++i) {
+					auto& local = localVertices[indices[i]];
+					if (local == std::numeric_limits<unsigned>::max()) {
+						local = unsigned(rangeVertices.size());
+						rangeVertices.push_back(indices[i]);
+					}
+					rangeIndices.push_back(local);
+				}
+				if (rangeIndices.empty())
+					return;
+
+				// the triangles of a meshlet are often in a good order already
+				const auto rangeVerticesCount = unsigned(rangeVertices.size());
+				const auto missesBefore = CalculateVertexCacheMisses(&rangeIndices[0], range.IndicesCount, rangeVerticesCount);
+				OptimizeVertexCache(&rangeIndices[0], range.IndicesCount, rangeVerticesCount);
+				if (CalculateVertexCacheMisses(&rangeIndices[0], range.IndicesCount, rangeVerticesCount) < missesBefore) {
+					for (auto i = 0u; i < range.IndicesCount; ++i) {
+						indices[range.FirstIndex + i] = rangeVertices[rangeIndices[i]];
+					}
+				}
+				std::for_each(rangeVertices.cbegin(), rangeVertices.cend(), [&localVertices](unsigned vertex) { localVertices[vertex] = std::numeric_limits<unsigned>::max(); });
+			});
+		}
+
+		std::vector<unsigned> remap;
+		CalculateVertexFetchRemap(&indices[0], indicesCount, verticesCount, remap);
+		RemapVertices(vertices, &indices[0], indicesCount, remap);
+
+		block.Stats.VertexCacheMissesAfter += CalculateVertexCacheMisses(&indices[0], indicesCount, verticesCount);
 	}
 
-	char GetGridValue(const glm::vec3& coord) const
+	// Returns the corners of the block in output (DX-style) coordinates
+	static void GetBlockCorners(const Block& block, float3& minCorner, float3& maxCorner)
 	{
-		return ts_BlocksCache->GetGridValue(coord);
+		const int blockShift = BLOCK_EXTENT_POWER + block.Level;
+		Coord coords = block.Coords << blockShift;
+		minCorner = tofloat3(glm::vec3(coords));
+		coords += Coord(1 << blockShift);
+		maxCorner = tofloat3(glm::vec3(coords));
+		// NOTE: here we swap z & y because on output we want DX-style dimensions
+		std::swap(minCorner.y, minCorner.z);
+		std::swap(maxCorner.y, maxCorner.z);
 	}
 
-	MaterialInfo GetMaterialInfo(const Coord& coord) const
+	// The corners the polygons of a block are output with. The Surface Nets quads over
+	// the maximal faces reach a cell outside of the block and the skirts hang below
+	// the faces.
+	void GetPolygonsCorners(const Block& block, float3& minCorner, float3& maxCorner) const
 	{
-		return ts_BlocksCache->GetMaterialGridValue(coord);
+		GetBlockCorners(block, minCorner, maxCorner);
+		if (m_Result->Method == MM_SurfaceNets) {
+			const auto cellSize = float(block.LevelMultiplier);
+			const auto skirtDepth = GetSkirtDepth(block);
+			minCorner = tofloat3(tovec3(minCorner) - skirtDepth);
+			maxCorner = tofloat3(tovec3(maxCorner) + cellSize + skirtDepth);
+		}
 	}
 
-	glm::vec3 CalcNormal(const glm::vec3& coord) const
+	void CompactBlock(Block& block)
 	{
-		const glm::vec3 minVec(0.f);
-		auto normal = glm::vec3(  (GetGridValue(glm::clamp(coord + UNIT_X, minVec, m_MaxExtents)) - GetGridValue(glm::clamp(coord - UNIT_X, minVec, m_MaxExtents))) * 0.5f,
-								  (GetGridValue(glm::clamp(coord + UNIT_Z, minVec, m_MaxExtents)) - GetGridValue(glm::clamp(coord - UNIT_Z, minVec, m_MaxExtents))) * 0.5f,
-								  (GetGridValue(glm::clamp(coord + UNIT_Y, minVec, m_MaxExtents)) - GetGridValue(glm::clamp(coord - UNIT_Y, minVec, m_MaxExtents))) * 0.5f);
-		return normalizeFixZero(normal);
+		PROFI_SCOPE_S2("Compact block")
+
+		float3 minCorner;
+		float3 maxCorner;
+		GetPolygonsCorners(block, minCorner, maxCorner);
+
+		const glm::vec3 origin = tovec3(minCorner);
+		const glm::vec3 scale = glm::vec3(float(std::numeric_limits<unsigned short>::max())) / (tovec3(maxCorner) - origin);
+
+		BuildCompactMesh(block.Vertices, block.Indices, origin, scale, block.Compact);
+		block.TransitionCompact.resize(Cell::Face_Count);
+		for (auto face = 0u; face < Cell::Face_Count; ++face) {
+			BuildCompactMesh(block.TransitionVertices[face], block.TransitionIndices[face], origin, scale, block.TransitionCompact[face]);
+		}
 	}
 
-	bool FillTextureIdsForVertex(unsigned material, unsigned char blend, PolygonVertex& output) {
-		auto m = m_Materials->GetMaterial(material);
-		if(!m)
-			return false;
+	// Quantizes the vertices and moves the ones with a transition mask to the front,
+	// so that their index is also their index in the secondary positions table.
+	// The full vertices are cleared. The 32-bit indices are kept only if the
+	// vertices can't be addressed with 16 bits.
+	static void BuildCompactMesh(VerticesVec& vertices,
+		IndicesVec& indices,
+		const glm::vec3& origin,
+		const glm::vec3& scale,
+		CompactMesh& output)
+	{
+		const auto vertexCount = unsigned(vertices.size());
 
-		output.Textures.TextureIndices.Txz = m->DiffuseIds0[1];
-		output.Textures.TextureIndices.Tpy = m->DiffuseIds0[0];
-		output.Textures.TextureIndices.Tny = m->DiffuseIds0[2];
+		std::vector<unsigned> remap(vertexCount);
+		unsigned secondaryCount = 0;
+		for (auto i = 0u; i < vertexCount; ++i) {
+			if (GetOutputTransitionFlags(vertices[i])) {
+				++secondaryCount;
+			}
+		}
+		unsigned nextSecondary = 0;
+		unsigned nextPrimary = secondaryCount;
+		for (auto i = 0u; i < vertexCount; ++i) {
+			remap[i] = GetOutputTransitionFlags(vertices[i]) ? nextSecondary++ : nextPrimary++;
+		}
 
-		output.Textures.TextureIndices.Uxz = m->DiffuseIds1[1];
-		output.Textures.TextureIndices.Upy = m->DiffuseIds1[0];
-		output.Textures.TextureIndices.Uny = m->DiffuseIds1[2];
+		output.Vertices.resize(vertexCount);
+		output.SecondaryPositions.resize(secondaryCount);
+		for (auto i = 0u; i < vertexCount; ++i) {
+			const auto& vertex = vertices[i];
+			auto& compactVertex = output.Vertices[remap[i]];
+
+			QuantizePosition(tovec3(vertex.Position), origin, scale, compactVertex.Position);
+			EncodeOctahedralNormal(tovec3(vertex.Normal), compactVertex.Normal);
+
+			compactVertex.TransitionFlags = (unsigned char)GetOutputTransitionFlags(vertex);
+			if (compactVertex.TransitionFlags) {
+				const auto& secondaryPosition = vertex.SecondaryPosition;
+				auto& secondary = output.SecondaryPositions[remap[i]];
+				QuantizePosition(glm::vec3(secondaryPosition.x, secondaryPosition.y, secondaryPosition.z), origin, scale, secondary.Position);
+				secondary.Reserved = 0;
+			}
 
-		output.Textures.TextureIndices.Blend = blend;
+			const auto& textures = vertex.Textures.TextureIndices;
+			compactVertex.Blend = textures.Blend;
+			compactVertex.Uxz = textures.Uxz;
+			compactVertex.Txz = textures.Txz;
+			compactVertex.Uny = textures.Uny;
+			compactVertex.Upy = textures.Upy;
+			compactVertex.Tny = textures.Tny;
+			compactVertex.Tpy = textures.Tpy;
+		}
+		vertices.clear();
 
-		return true;
+		const auto indexCount = unsigned(indices.size());
+		if (vertexCount <= unsigned(std::numeric_limits<unsigned short>::max()) + 1) {
+			output.Indices.resize(indexCount);
+			for (auto i = 0u; i < indexCount; ++i) {
+				output.Indices[i] = (unsigned short)remap[indices[i]];
+			}
+			indices.clear();
+		} else {
+			for (auto i = 0u; i < indexCount; ++i) {
+				indices[i] = remap[indices[i]];
+			}
+		}
 	}
-	
-	void PushBlocksToResult()
+
+	static unsigned GetOutputTransitionFlags(const PolygonVertex& vertex)
 	{
-		PROFI_SCOPE_S2("Push blocks to result")
-		const float normFactor = 1 / 256.f;
-		const float transitionNormFactor = 1 / 256.f;
+		FloatInt transitionFlags;
+		transitionFlags.asFloat = vertex.SecondaryPosition.w;
+		return transitionFlags.asUnsigned;
+	}
 
-		const auto totalSize = m_LoadedBlocks.size();
-				
-		for(auto id = 0u; id < totalSize; ++id) {
-			auto& loadedBlock = m_LoadedBlocks[id];
-			auto& indices = loadedBlock.Indices;
-			auto& vertices = loadedBlock.Vertices;
-			if(!vertices.size())
-				continue;
+	static void QuantizePosition(const glm::vec3& position,
+		const glm::vec3& origin,
+		const glm::vec3& scale,
+		unsigned short output[3])
+	{
+		const auto quantized = glm::clamp(glm::round((position - origin) * scale),
+			glm::vec3(0.0f),
+			glm::vec3(float(std::numeric_limits<unsigned short>::max())));
+		for (auto i = 0; i < 3; ++i) {
+			output[i] = (unsigned short)quantized[i];
+		}
+	}
+
+	static void EncodeOctahedralNormal(const glm::vec3& normal, signed char output[2])
+	{
+		const auto l1Norm = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+		glm::vec2 encoded(0.0f);
+		if (l1Norm > 0.0f) {
+			encoded = glm::vec2(normal.x, normal.y) / l1Norm;
+		}
+		// fold the lower hemisphere over the diagonals
+		if (normal.z < 0.0f) {
+			const glm::vec2 folded(1.0f - std::abs(encoded.y), 1.0f - std::abs(encoded.x));
+			encoded.x = encoded.x >= 0.0f ? folded.x : -folded.x;
+			encoded.y = encoded.y >= 0.0f ? folded.y : -folded.y;
+		}
+		for (auto i = 0; i < 2; ++i) {
+			output[i] = (signed char)(glm::round(glm::clamp(encoded[i], -1.0f, 1.0f) * 127.0f));
+		}
+	}
 
-			auto& outputBlocks = m_Result->Levels[loadedBlock.Level].Blocks;
+	template<typename Container>
+	static void FreeVector(Container& container)
+	{
+		Container().swap(container);
+	}
 	
-			unsigned levelMultiplier = loadedBlock.LevelMultiplier;
-			glm::vec3 coords = loadedBlock.Coords;
-			coords *= levelMultiplier * BLOCK_EXTENT;
-			float3 minCorner = tofloat3(coords);
-			coords += glm::vec3(float(levelMultiplier * BLOCK_EXTENT));
-			float3 maxCorner = tofloat3(coords);
-			// NOTE: here we swap z & y because on output we want DX-style dimensions
-			std::swap(minCorner.y, minCorner.z);
-			std::swap(maxCorner.y, maxCorner.z);
-
-			outputBlocks.push_back(PolygonBlock(loadedBlock.Id, minCorner, maxCorner));
-			
-			const auto indSz = indices.size();
-			const auto eps = std::numeric_limits<float>::epsilon();
-			auto& outputIndices = outputBlocks.back().Indices;
-			outputIndices.reserve(indSz);
+	// Every block is a task and every level has a task that moves its blocks to
+	// the result. A coarse block needs only the material cache of its 8 children,
+	// so it starts as soon as they are done instead of waiting for the whole
+	// finer level.
+	void PrepareTasks()
+	{
+		m_LevelTaskOffsets.resize(m_LevelsCount + 1);
+		m_LevelTaskOffsets[0] = 0;
+		for (auto level = 0u; level < m_LevelsCount; ++level) {
+			m_LevelTaskOffsets[level + 1] = m_LevelTaskOffsets[level] + unsigned(m_LevelBlocks[level].size());
+		}
+		const auto assemblyTasksOffset = m_LevelTaskOffsets[m_LevelsCount];
+
+		m_Scheduler.reset(new TaskScheduler(assemblyTasksOffset + m_LevelsCount));
+		auto& scheduler = *m_Scheduler;
+		std::vector<unsigned> childTasks;
+		for (auto level = 0u; level < m_LevelsCount; ++level) {
+			const auto& blocks = m_LevelBlocks[level];
+			for (auto blockId = 0u; blockId < blocks.size(); ++blockId) {
+				const auto task = m_LevelTaskOffsets[level] + blockId;
+				scheduler.AddDependency(assemblyTasksOffset + level, task);
+
+				if (!level)
+					continue;
+
+				const auto& childBlocksCnt = m_BlockCounts[level - 1];
+				for (auto child = 0; child < 8; ++child) {
+					const auto childCoords = (blocks[blockId].Coords << 1) + Cell::GetCornerOffset(child);
+					if (glm::any(glm::greaterThanEqual(childCoords, childBlocksCnt)))
+						continue;
 
-			for(auto i = 0u; i < indSz; i += 3)
-			{
-				const auto& v0 = vertices[indices[i]];
-				const auto& v1 = vertices[indices[i + 1]];
-				const auto& v2 = vertices[indices[i + 2]];
+					const auto childCoordId = childCoords.z * childBlocksCnt.y * childBlocksCnt.x + childCoords.y * childBlocksCnt.x + childCoords.x;
+					const auto childTask = childTasks[childCoordId];
+					if (childTask != INVALID_INDEX) {
+						scheduler.AddDependency(task, childTask);
+					}
+				}
+			}
 
-				auto a = v1 - v0;
-				auto b = v2 - v0;
+			// the blocks of this level by coordinates - only the ones being polygonized
+			const auto& blocksCnt = m_BlockCounts[level];
+			childTasks.assign(size_t(blocksCnt.x * blocksCnt.y * blocksCnt.z), unsigned(INVALID_INDEX));
+			for (auto blockId = 0u; blockId < blocks.size(); ++blockId) {
+				childTasks[blocks[blockId].CoordId] = m_LevelTaskOffsets[level] + blockId;
+			}
+		}
 
-				const auto len = glm::length2(glm::cross(glm::vec3(a), glm::vec3(b)));
+		const auto workersCount = m_Options.ThreadsCount ? m_Options.ThreadsCount : std::max(std::thread::hardware_concurrency(), 1u);
 
-				if(len >= eps)
-				{
-					outputIndices.push_back(indices[i]);
-					outputIndices.push_back(indices[i + 1]);
-					outputIndices.push_back(indices[i + 2]);
-				}
-				else
-				{
-					++(m_Result->Stats.DegenerateTrianglesRemoved);
-				}
+		m_WorkerContexts.reserve(workersCount);
+		for (auto worker = 0u; worker < workersCount; ++worker) {
+			if (worker < m_WorkerContexts.size()) {
+				// the grid might have changed since the last run
+				m_WorkerContexts[worker].Cache.Reset(m_Grid);
+			} else {
+				m_WorkerContexts.emplace_back(m_Grid);
 			}
+		}
 
-			auto& outputBlock = m_Result->Levels[loadedBlock.Level].Blocks.back();
-			auto& secondaryVertices = loadedBlock.SecondaryVertices;
-			auto& resultVertices = outputBlock.Vertices;
-			auto& normals = loadedBlock.Normals;
-			auto& materials = loadedBlock.Materials;
-			const auto vertsSize = vertices.size();
-			resultVertices.reserve(vertsSize);
-			for (auto i = 0u; i < vertsSize; ++i)
-			{
-				auto& fv = vertices[i];
-				resultVertices.push_back(PolygonVertex());
-				auto& finalVertex = resultVertices.back(); 
-
-				finalVertex.Position = tofloat3(glm::vec3(fv) * normFactor);
-				// swap z & y so that the returned polygon surface matches the popular DX notation
-				std::swap(finalVertex.Position.y, finalVertex.Position.z);
-
-				// calculate the normal
-				#ifdef _DEBUG
-				const auto len = glm::length(normals[i]);
-				assert((len - 1.0f) < 0.01f && "Un-normalized normal detected!");
-				#endif
-				finalVertex.Normal = tofloat3(normals[i]);
-
-				auto& secondaryFv = secondaryVertices[i];
-				// NB: We swap the last three bits with the three prior to them to 
-				// match the output transition faces enum
-				FloatInt transitionFlags;
-				transitionFlags.asFloat = secondaryFv.w;
-				if (transitionFlags.asUnsigned) {
-					auto temp3bits = transitionFlags.asUnsigned & 0x7;
-					transitionFlags.asUnsigned >>= 3;
-					transitionFlags.asUnsigned |= (temp3bits << 3);
+		scheduler.Start(workersCount);
+	}
+
+	void ProcessBlock(WorkerContext& context, Block& block)
+	{
+		block.Empty = block.Level == 0 && AreBlockAndNeighborsEmpty(block.Coords);
+		#ifdef USE_MATERIAL_CACHE
+		// only this task touches the cells of the block, the coarser blocks read them after it completes
+		m_Result->Cache.ClearBlock(block.Level, block.CoordId);
+		#endif
+		if (!block.Empty) {
+			context.BeginBlock(block);
+			if (m_Result->Format == VF_Collision) {
+				PolygonizeCollisionBlock(context, block);
+			} else if (m_Result->Method == MM_SurfaceNets) {
+				PolygonizeBlockSurfaceNets(context, block);
+				if (block.Level != m_LevelsCount - 1) {
+					GenerateSurfaceNetsSkirts(context, block);
 				}
-				
-				finalVertex.SecondaryPosition = tofloat4(secondaryFv * normFactor);
-				finalVertex.SecondaryPosition.w = transitionFlags.asFloat;
-				std::swap(finalVertex.SecondaryPosition.y, finalVertex.SecondaryPosition.z);
-
-				//define the textures
-				const auto matId = materials[i].Id;
-				if(!FillTextureIdsForVertex(matId, materials[i].Blend, finalVertex)) {
-					char buffer[VOXELS_LOG_SIZE];
-					snprintf(buffer, VOXELS_LOG_SIZE, "Unable to assign textures on vertex with material id %u", matId);
-					VOXLOG(LS_Error, buffer);
+			} else {
+				// level 0 has its own instantiation without the LOD handling
+				if (block.Level) {
+					PolygonizeBlock<false>(context, block);
+				} else {
+					PolygonizeBlock<true>(context, block);
 				}
+				if (block.Level && (block.Level != m_LevelsCount - 1)) {
+					GenerateTransitionCells(context, block);
+				}
+			}
+			#ifdef USE_MATERIAL_CACHE
+			m_Result->Cache.CompactBlock(block.Level, block.CoordId);
+			#endif
+			if (!block.Level) {
+				SortEdgeCrossings(block);
+			}
+			if (block.CacheOnly) {
+				context.DiscardBlock(block);
+			} else {
+				FinalizeBlock(context, block);
 			}
+		}
 
-			// Transform and set the transition meshes
-			outputBlock.TransitionVertices.reserve(6);
-			outputBlock.TransitionIndices.reserve(6);
-			for(auto trans = 0; trans < 6; ++trans) {
-				outputBlock.TransitionVertices.push_back(VerticesVec());
-				outputBlock.TransitionIndices.push_back(IndicesVec());
-
-				auto& outputTransVertices = outputBlock.TransitionVertices.back();
-				auto& outputTransIndices = outputBlock.TransitionIndices.back();
-
-				auto& transVertices = loadedBlock.TransitionMeshVertices[trans];
-				auto& transMaterials = loadedBlock.TransitionMaterials[trans];
-				auto& transSecondaryVertices = loadedBlock.TransitionMeshSecondaryVertices[trans];
-				auto& transNormals  = loadedBlock.TransitionMeshNormals[trans];
-				auto& transIndices  = loadedBlock.TransitionMeshIndices[trans];
-
-				assert(transNormals.size() == transVertices.size());
-
-				const auto vertsCount = transNormals.size();
-				outputTransVertices.reserve(vertsCount);
-				for(auto i = 0u; i < vertsCount; ++i) {
-					outputTransVertices.push_back(PolygonVertex());
-					auto& finalVertex = outputTransVertices.back();
-
-					finalVertex.Position = tofloat3(glm::vec3(transVertices[i]) * transitionNormFactor);
-					// swap z & y so that the returned polygon surface matches the popular DX notation
-					std::swap(finalVertex.Position.y, finalVertex.Position.z);
-
-					FloatInt transitionFlags;
-					transitionFlags.asFloat = transSecondaryVertices[i].w;
-					if (transitionFlags.asUnsigned) {
-						auto temp3bits = transitionFlags.asUnsigned & 0x7;
-						transitionFlags.asUnsigned >>= 3;
-						transitionFlags.asUnsigned |= (temp3bits << 3);
-					}
-					finalVertex.SecondaryPosition = tofloat4(transSecondaryVertices[i] * transitionNormFactor);
-					finalVertex.SecondaryPosition.w = transitionFlags.asFloat;
-					std::swap(finalVertex.SecondaryPosition.y, finalVertex.SecondaryPosition.z);
+		if (m_Listener && !block.CacheOnly) {
+			float3 minCorner;
+			float3 maxCorner;
+			GetPolygonsCorners(block, minCorner, maxCorner);
 
-					#ifdef _DEBUG
-					const auto len = glm::length(transNormals[i]);
-					assert((len - 1.0f) < 0.01f && "Un-normalized normal detected!");
-					#endif
-					finalVertex.Normal = tofloat3(transNormals[i]);
-
-					//define the textures
-					const auto matId = transMaterials[i].Id;
-					if(!FillTextureIdsForVertex(matId, transMaterials[i].Blend, finalVertex)) {
-						char buffer[VOXELS_LOG_SIZE];
-						snprintf(buffer, VOXELS_LOG_SIZE, "Unable to assign textures on vertex with material id %u", matId);
-						VOXLOG(LS_Error, buffer);
-					}
-				}
+			// lend the polygons to the listener and take them back
+			PolygonBlock polygons(block.Id, block.CoordId, minCorner, maxCorner);
+			HandOverPolygons(block, polygons);
+			m_Listener->OnBlockPolygonized(block.Level, &polygons);
+			HandOverPolygons(block, polygons);
+		}
+	}
+
+	void PushBlocksToResult(unsigned level)
+	{
+		PROFI_SCOPE_S2("Push blocks to result")
+
+		auto& loadedBlocks = m_LevelBlocks[level];
+		auto& outputLevel = m_Result->Levels[level];
+		auto& outputBlocks = outputLevel.Blocks;
+		const auto totalSize = loadedBlocks.size();
+				
+		for(auto id = 0u; id < totalSize; ++id) {
+			auto& loadedBlock = loadedBlocks[id];
+			// written here and not when the block is polygonized, so that a cancelled run doesn't change it
+			if (level == 0) {
+				m_Result->Cache.Level0EmptyBlocks[loadedBlock.CoordId] = loadedBlock.Empty;
+			}
+			if (loadedBlock.CacheOnly)
+				continue;
 
-				std::copy(transIndices.cbegin(), transIndices.cend(), std::back_inserter(outputTransIndices));
+			const bool hasPolygons = !loadedBlock.Vertices.empty() || !loadedBlock.Compact.Vertices.empty() || !loadedBlock.Positions.empty();
+			const auto oldIndex = outputLevel.BlockIndices[loadedBlock.CoordId];
+			if (oldIndex == ResultType::LodLevel::NO_BLOCK) {
+				if (!hasPolygons)
+					continue;
+
+				float3 minCorner;
+				float3 maxCorner;
+				GetPolygonsCorners(loadedBlock, minCorner, maxCorner);
+
+				outputLevel.BlockIndices[loadedBlock.CoordId] = unsigned(outputBlocks.size());
+				outputBlocks.push_back(PolygonBlock(loadedBlock.Id, loadedBlock.CoordId, minCorner, maxCorner));
+				HandOverPolygons(loadedBlock, outputBlocks.back());
+				loadedBlock.Change = BC_Added;
+			} else if (!hasPolygons) {
+				outputLevel.RemoveBlock(loadedBlock.CoordId);
+				loadedBlock.Change = BC_Removed;
+			} else if (GetContentHash(outputBlocks[oldIndex]) == loadedBlock.ContentHash) {
+				// the client already has these polygons
+				loadedBlock.Change = BC_Unchanged;
+			} else {
+				HandOverPolygons(loadedBlock, outputBlocks[oldIndex]);
+				loadedBlock.Change = BC_Changed;
 			}
 		}
 	}
 
+	static unsigned long long GetContentHash(PolygonBlock& block)
+	{
+		if (!block.ContentHash) {
+			block.ContentHash = CalculateContentHash(block);
+		}
+		return block.ContentHash;
+	}
+
+	// Swaps the polygons of the blocks - a second call gives them back
+	static void HandOverPolygons(Block& loadedBlock, PolygonBlock& outputBlock)
+	{
+		// the data is already in its final form - just hand it over
+		outputBlock.ContentHash = loadedBlock.ContentHash;
+		outputBlock.Vertices.swap(loadedBlock.Vertices);
+		outputBlock.Indices.swap(loadedBlock.Indices);
+		outputBlock.TransitionVertices.swap(loadedBlock.TransitionVertices);
+		outputBlock.TransitionIndices.swap(loadedBlock.TransitionIndices);
+		outputBlock.Compact = std::move(loadedBlock.Compact);
+		outputBlock.TransitionCompact.swap(loadedBlock.TransitionCompact);
+		outputBlock.Positions.swap(loadedBlock.Positions);
+		outputBlock.MaterialRanges.swap(loadedBlock.MaterialRanges);
+		outputBlock.Meshlets.swap(loadedBlock.Meshlets);
+		std::swap(outputBlock.PolygonsMinimalCorner, loadedBlock.PolygonsMinimalCorner);
+		std::swap(outputBlock.PolygonsMaximalCorner, loadedBlock.PolygonsMaximalCorner);
+	}
+
 	static Coord FindAdjCellForReuse(const char direction, const Coord& cellCoord) {
 		auto result(cellCoord);
 		//x-dir
@@ -1447,78 +3019,433 @@ private:
 		return result;
 	}
 
-	unsigned GenerateVertexFromPoint(Block& block, const Cell& cell, char v) {
-		auto V = cell.GetCornerCoords(v);
-		block.Normals.push_back(CalcNormal(V));
+	unsigned GenerateVertexFromPoint(WorkerContext& context, const GridBlocksCache& cache, Block& block, const Cell& cell, char v) {
+		const auto V = cell.GetCornerCoords(v);
 		
-		auto myMaterial = GetMaterialInfo(V);
+		const auto cornerMaterial = cache.GetMaterialGridValue(V);
+		auto myMaterial = cornerMaterial;
 		if(cell.Material.Id != myMaterial.Id) {
-			block.Materials.push_back(cell.Material);
-		} else {
-			block.Materials.push_back(myMaterial);
+			myMaterial = cell.Material;
 		}
-		
-		V *= 256.f;
-		FloatInt onboundary;
-		onboundary.asInt = cell.CornerOnBlockBoundary(v);
-		block.Vertices.push_back(glm::vec4(V, onboundary.asFloat));
 
-		return block.Vertices.size() - 1;
+		PendingVertex vertex;
+		vertex.P0 = V;
+		vertex.P1 = V;
+		vertex.T = 0x0100;
+		vertex.Boundaries = cell.CornerOnBlockBoundary(v);
+		vertex.Values[0] = cell.V[unsigned(v)];
+		vertex.Values[1] = cell.V[unsigned(v)];
+		vertex.Materials[0] = cornerMaterial;
+		vertex.Materials[1] = cornerMaterial;
+		vertex.Crossing = nullptr;
+		return QueueRegularVertex(context, block, vertex, myMaterial);
 	};
 
-	static unsigned MakeReuseId(const Coord& reuseCoord) {
-		return unsigned(reuseCoord.z * (BLOCK_EXTENT) * (BLOCK_EXTENT) + reuseCoord.y * (BLOCK_EXTENT) + reuseCoord.x);
+	// Reserves the index of a regular vertex - it is built by EmitPendingVertices
+	// after all the cells of the block. Only its material is known right away
+	// as the cells need it to decide whether to reuse it.
+	static unsigned QueueRegularVertex(WorkerContext& context, Block& block, const PendingVertex& vertex, const MaterialInfo& material)
+	{
+		assert(block.Materials.size() == block.Vertices.size() + context.PendingVertices.size());
+		block.Materials.push_back(material);
+		context.PendingVertices.push_back(vertex);
+		return unsigned(block.Materials.size() - 1);
+	}
+
+	// Builds the queued regular vertices of the block. The grid is sampled for the
+	// normals of all of them first and then the vertices are interpolated in a
+	// separate loop without the grid accesses.
+	void EmitPendingVertices(WorkerContext& context, Block& block)
+	{
+		PROFI_SCOPE_S3("Emit pending vertices")
+
+		const auto& cache = context.Cache;
+		const auto& pending = context.PendingVertices;
+		const auto count = pending.size();
+		auto& normals = context.PendingNormals;
+		normals.resize(count * 2);
+		if (block.Level == 0) {
+			const Coord blockBase = block.Coords * int(BLOCK_EXTENT);
+			if (count) {
+				Coord minCorner(BLOCK_EXTENT);
+				Coord maxCorner(0);
+				for (auto i = 0u; i < count; ++i) {
+					minCorner = glm::min(minCorner, glm::min(pending[i].P0, pending[i].P1) - blockBase);
+					maxCorner = glm::max(maxCorner, glm::max(pending[i].P0, pending[i].P1) - blockBase);
+				}
+				SampleGradientField(context, block, minCorner, maxCorner);
+			}
+			for (auto i = 0u; i < count; ++i) {
+				const auto& vertex = pending[i];
+				normals[2 * i] = CalcGradientFieldNormal(context, vertex.P0 - blockBase);
+				if (vertex.P0 == vertex.P1) {
+					normals[2 * i + 1] = normals[2 * i];
+					continue;
+				}
+
+				normals[2 * i + 1] = CalcGradientFieldNormal(context, vertex.P1 - blockBase);
+				if (!m_Level0BlockIndices.empty()) {
+					RecordEdgeCrossing(block, vertex, normals[2 * i], normals[2 * i + 1]);
+				}
+			}
+		} else {
+			for (auto i = 0u; i < count; ++i) {
+				const auto& vertex = pending[i];
+				if (vertex.P0 == vertex.P1) {
+					normals[2 * i] = CalcNormal(cache, vertex.P0);
+					normals[2 * i + 1] = normals[2 * i];
+					continue;
+				}
+
+				SampleEdgeNormals(cache, vertex.Crossing, vertex.P0, vertex.P1, normals[2 * i], normals[2 * i + 1]);
+			}
+		}
+
+		// the secondary position moves the vertex to make room for the transition cells of
+		// the faces it is on - the offset depends only on the faces
+		// TODO: Move in the tangent plane
+		const auto boundaryCell = MakeCellWithoutValues(block, Coord(0));
+		glm::vec3 transitionDeltas[1 << Cell::Face_Count];
+		for (auto faces = 0; faces < (1 << Cell::Face_Count); ++faces) {
+			transitionDeltas[faces] = AccumulateVertexTransitionDelta(faces, boundaryCell) * 256.f;
+		}
+
+		const auto firstIndex = block.Vertices.size();
+		block.Vertices.reserve(firstIndex + count);
+		for (auto i = 0u; i < count; ++i) {
+			const auto& vertex = pending[i];
+			const long t = vertex.T;
+			const long u = 0x0100 - t;
+			const glm::vec3 position = (float)t * glm::vec3(vertex.P0) + (float)u * glm::vec3(vertex.P1);
+			// a vertex on a corner takes the normal there as is
+			const glm::vec3 normal = (vertex.P0 == vertex.P1) ? normals[2 * i]
+				: normalizeFixZero(normals[2 * i] * (t/256.f) + normals[2 * i + 1] * (u/256.f));
+
+			FloatInt onboundary;
+			onboundary.asInt = vertex.Boundaries;
+			const glm::vec4 secondary(position + transitionDeltas[vertex.Boundaries], onboundary.asFloat);
+
+			EmitVertex(block, block.Vertices, position, secondary, normal, block.Materials[firstIndex + i]);
+		}
+
+		context.PendingVertices.clear();
+	}
+
+	// Samples a level 0 block with one more layer around it, so that the normals
+	// of its vertices don't look up the grid cache for every sample. Every sample
+	// is taken once, instead of once for every corner gradient that needs it.
+	// Only the samples around the corners from "minCorner" to "maxCorner" are taken.
+	void SampleGradientField(WorkerContext& context, const Block& block, const Coord& minCorner, const Coord& maxCorner) const
+	{
+		PROFI_SCOPE_S3("Sample gradient field")
+
+		assert(block.Level == 0);
+		const int samplesExt = BLOCK_EXTENT + 3;
+		const Coord samplesBase = block.Coords * int(BLOCK_EXTENT) - 1;
+		// the samples of a corner are from one before to one after it
+		const Coord first = minCorner;
+		const Coord last = maxCorner + 2;
+		// the samples are copied by the neighbor blocks they come from, so that the
+		// grid cache fetches each of the needed blocks once
+		const int rangeStarts[4] = { 0, 1, BLOCK_EXTENT + 1, samplesExt };
+		for (int rangeZ = 0; rangeZ < 3; ++rangeZ)
+		for (int rangeY = 0; rangeY < 3; ++rangeY)
+		for (int rangeX = 0; rangeX < 3; ++rangeX)
+		{
+			const int startX = std::max(rangeStarts[rangeX], first.x);
+			const int endX = std::min(rangeStarts[rangeX + 1], last.x + 1);
+			if (startX >= endX)
+				continue;
+
+			const int endZ = std::min(rangeStarts[rangeZ + 1], last.z + 1);
+			const int endY = std::min(rangeStarts[rangeY + 1], last.y + 1);
+			for (int z = std::max(rangeStarts[rangeZ], first.z); z < endZ; ++z)
+			for (int y = std::max(rangeStarts[rangeY], first.y); y < endY; ++y)
+			{
+				// the samples are clamped to the grid like in CalcNormal
+				Coord rowStart = samplesBase + Coord(startX, y, z);
+				rowStart.y = glm::clamp(rowStart.y, 0, m_MaxExtents.y);
+				rowStart.z = glm::clamp(rowStart.z, 0, m_MaxExtents.z);
+				context.Cache.GetGridRow(rowStart,
+					endX - startX,
+					&context.GradientSamples[(z * samplesExt + y) * samplesExt + startX]);
+			}
+		}
+	}
+
+	// The same normal as CalcNormal at a corner of a level 0 block, taken from the
+	// samples of SampleGradientField
+	static glm::vec3 CalcGradientFieldNormal(const WorkerContext& context, const Coord& localCorner)
+	{
+		const int strideY = BLOCK_EXTENT + 3;
+		const int strideZ = strideY * strideY;
+		const auto sample = context.GradientSamples + (localCorner.z + 1) * strideZ + (localCorner.y + 1) * strideY + localCorner.x + 1;
+		return normalizeFixZero(glm::vec3((sample[1] - sample[-1]) * 0.5f,
+			(sample[strideZ] - sample[-strideZ]) * 0.5f,
+			(sample[strideY] - sample[-strideY]) * 0.5f));
+	}
+
+	// The crossing of an edge in 1/256 of the edge - the weight of its v0 end.
+	// The values at the ends must have different signs or one of them be zero.
+	static long CalcEdgeInterpolation(int v0, int v1)
+	{
+		assert(v0 * v1 <= 0 && v0 != v1);
+		const unsigned long long numerator = unsigned(std::abs(v1)) << 8;
+		return long((numerator * EDGE_RECIPROCALS.Values[std::abs(v1 - v0)]) >> EDGE_RECIPROCAL_SHIFT);
+	}
+
+	static unsigned MakeLocalId(const Coord& localCoord) {
+		return unsigned((localCoord.z << (2 * BLOCK_EXTENT_POWER)) | (localCoord.y << BLOCK_EXTENT_POWER) | localCoord.x);
 	}
 
 	glm::vec3 AccumulateVertexTransitionDelta(int boundaryFaces, const Cell& cell) {
 		glm::vec3 result = glm::vec3(0);
 		for(int i = 0; i < 6; ++i) {
 			if(boundaryFaces & (1 << i)) {
-				result += (cell.GetGlobalDirectionOppositeForFace(Cell::FaceId(i)) * (TRANSITION_CELL_COEFF));
+				result += (glm::vec3(cell.GetGlobalDirectionOppositeForFace(Cell::FaceId(i))) * (TRANSITION_CELL_COEFF));
 			}
 		}
 
 		return result;
 	}
 
-	void FindBestVertexInLODChain(int level, glm::vec3& P0, glm::vec3& P1) const {
+	// Moves an edge of a coarse level to the level 0 edge with the crossing.
+	// p0Value and p1Value are the grid values at P0 and P1 and are updated with them.
+	// When a single level 0 edge under the coarse one crosses the surface, its
+	// crossing is looked up in the level 0 blocks and returned. Otherwise the edge
+	// is bisected down to level 0.
+	const EdgeCrossing* FindBestVertexInLODChain(const GridBlocksCache& cache, const Block& block, int level, Coord& P0, Coord& P1, char& p0Value, char& p1Value) const {
+		const int axis = GetEdgeAxis(P0, P1);
+		const bool reversed = P1[axis] < P0[axis];
+		const auto lowerCorner = reversed ? P1 : P0;
+		Coord crossingCorner;
+		const EdgeCrossing* crossing = nullptr;
+		int crossingsCount = 0;
+		if (CountLevel0Crossings(block, lowerCorner, axis, 1 << level, crossingsCount, crossing, crossingCorner)) {
+			if (crossingsCount == 1) {
+				auto crossingEnd = crossingCorner;
+				++crossingEnd[axis];
+				P0 = reversed ? crossingEnd : crossingCorner;
+				P1 = reversed ? crossingCorner : crossingEnd;
+				p0Value = crossing->Values[reversed];
+				p1Value = crossing->Values[!reversed];
+				return crossing;
+			}
+		} else {
+			// the level 0 blocks are not in this run - find the crossings in the grid
+			const auto step = (P1 - P0) >> level;
+			char crossingValues[2] = { 0, 0 };
+			char previousValue = p0Value;
+			for (int i = 1; i <= (1 << level); ++i) {
+				const char value = (i == (1 << level)) ? p1Value : cache.GetGridValue(P0 + step * i);
+				if (previousValue * value < 0) {
+					++crossingsCount;
+					crossingCorner = P0 + step * (i - 1);
+					crossingValues[0] = previousValue;
+					crossingValues[1] = value;
+				}
+				previousValue = value;
+			}
+			if (crossingsCount == 1) {
+				P0 = crossingCorner;
+				P1 = crossingCorner + step;
+				p0Value = crossingValues[0];
+				p1Value = crossingValues[1];
+				return nullptr;
+			}
+		}
+
+		// a thin feature or a zero sample - descend to the level 0 edge
 		for(int lev = level; lev > 0; --lev) {
-			const auto midpoint = P0 + (P1 - P0) / 2.f;
+			// the edge length is always a power of two, so the midpoint is exact
+			const auto midpoint = (P0 + P1) >> 1;
+
+			const auto midValue = cache.GetGridValue(midpoint);
+
+			if((p0Value * midValue) <= 0) {
+				P1 = midpoint;
+				p1Value = midValue;
+			} else {
+				P0 = midpoint;
+				p0Value = midValue;
+			}
+
+			#ifdef _DEBUG
+			assert(P0.x == P1.x || P0.y == P1.y || P0.z == P1.z);
+			#endif
+		}
+		return nullptr;
+	}
+
+	// Counts the level 0 crossings of the edges along "axis" from lowerCorner to
+	// lowerCorner + length. "crossing" and crossingCorner are the last one found.
+	// Returns false if a level 0 block the edges belong to is not in this run.
+	bool CountLevel0Crossings(const Block& block, const Coord& lowerCorner, int axis, int length, int& count, const EdgeCrossing*& crossing, Coord& crossingCorner) const
+	{
+		if (!block.Level || m_Level0BlockIndices.empty())
+			return false;
+
+		const int cornersExt = BLOCK_EXTENT + 1;
+		const auto& blocksCnt = m_BlockCounts[0];
+		const Coord firstBlock = block.Coords << int(block.Level);
+		const Coord lastBlock = glm::min(firstBlock + Coord((1 << block.Level) - 1), blocksCnt - 1);
+		const int end = lowerCorner[axis] + length;
+		auto segmentCorner = lowerCorner;
+		while (segmentCorner[axis] < end) {
+			// the edges on the far faces of a level 0 block belong to it as well
+			const Coord ownerBlock = glm::clamp(segmentCorner >> int(BLOCK_EXTENT_POWER), firstBlock, lastBlock);
+			const Coord localCorner = segmentCorner - ownerBlock * int(BLOCK_EXTENT);
+			if (glm::any(glm::lessThan(localCorner, Coord(0)))
+				|| glm::any(glm::greaterThan(localCorner, Coord(BLOCK_EXTENT)))
+				|| localCorner[axis] == int(BLOCK_EXTENT))
+				return false;
+
+			const auto blockIndex = m_Level0BlockIndices[ownerBlock.z * blocksCnt.y * blocksCnt.x + ownerBlock.y * blocksCnt.x + ownerBlock.x];
+			if (blockIndex == INVALID_INDEX)
+				return false;
+
+			// the edges of a line of the block are consecutive in the sorted crossings
+			const int segmentEnd = std::min(end, (ownerBlock[axis] + 1) * int(BLOCK_EXTENT));
+			auto localEnd = localCorner;
+			localEnd[axis] += segmentEnd - segmentCorner[axis];
+			const auto& crossings = m_LevelBlocks[0][blockIndex].Crossings;
+			EdgeCrossing key;
+			key.Edge = MakeEdgeId(localCorner, axis);
+			const auto first = std::lower_bound(crossings.cbegin(), crossings.cend(), key, &EdgeCrossingLess);
+			key.Edge = MakeEdgeId(localEnd, axis);
+			const auto last = std::lower_bound(first, crossings.cend(), key, &EdgeCrossingLess);
+			if (first != last) {
+				count += int(last - first);
+				crossing = &*(last - 1);
+				crossingCorner = segmentCorner;
+				crossingCorner[axis] = ownerBlock[axis] * int(BLOCK_EXTENT) + int(crossing->Edge % cornersExt);
+			}
+			segmentCorner[axis] = segmentEnd;
+		}
+		return true;
+	}
+	
+	// An edge of a level 0 block - localCorner is the lower corner of the edge in the block.
+	// The edges along a line of the block have consecutive ids.
+	static unsigned MakeEdgeId(const Coord& localCorner, int axis)
+	{
+		const int cornersExt = BLOCK_EXTENT + 1;
+		const int u = localCorner[(axis + 1) % 3];
+		const int v = localCorner[(axis + 2) % 3];
+		return unsigned(((axis * cornersExt + v) * cornersExt + u) * cornersExt + localCorner[axis]);
+	}
+
+	static int GetEdgeAxis(const Coord& P0, const Coord& P1)
+	{
+		return (P0.x != P1.x) ? 0 : ((P0.y != P1.y) ? 1 : 2);
+	}
+
+	void RecordEdgeCrossing(Block& block, const PendingVertex& vertex, const glm::vec3& N0, const glm::vec3& N1) const
+	{
+		assert(block.Level == 0);
+		const auto& P0 = vertex.P0;
+		const auto& P1 = vertex.P1;
+		const bool reversed = glm::any(glm::lessThan(P1, P0));
+		EdgeCrossing crossing;
+		crossing.Edge = MakeEdgeId((reversed ? P1 : P0) - block.Coords * int(BLOCK_EXTENT), GetEdgeAxis(P0, P1));
+		crossing.Materials[reversed] = vertex.Materials[0];
+		crossing.Materials[!reversed] = vertex.Materials[1];
+		crossing.Normals[reversed] = N0;
+		crossing.Normals[!reversed] = N1;
+		crossing.Values[reversed] = vertex.Values[0];
+		crossing.Values[!reversed] = vertex.Values[1];
+		block.Crossings.push_back(crossing);
+	}
+
+	// Finds the crossing of a level 0 edge recorded by a level 0 block that "block" depends on.
+	// Only the blocks of this run under "block" are guaranteed to be complete.
+	const EdgeCrossing* FindEdgeCrossing(const Block& block, const Coord& P0, const Coord& P1) const
+	{
+		if (!block.Level || m_Level0BlockIndices.empty())
+			return nullptr;
+
+		const auto delta = glm::abs(P1 - P0);
+		if (delta.x + delta.y + delta.z != 1)
+			return nullptr;
+
+		const auto lowerCorner = glm::min(P0, P1);
+		const int axis = GetEdgeAxis(P0, P1);
+
+		// the edges on the far faces of a level 0 block belong to it as well
+		const Coord firstBlock = block.Coords << int(block.Level);
+		const Coord lastBlock = glm::min(firstBlock + Coord((1 << block.Level) - 1), m_BlockCounts[0] - 1);
+		const Coord ownerBlock = glm::clamp(lowerCorner >> int(BLOCK_EXTENT_POWER), firstBlock, lastBlock);
+		const Coord localCorner = lowerCorner - ownerBlock * int(BLOCK_EXTENT);
+		if (glm::any(glm::lessThan(localCorner, Coord(0)))
+			|| glm::any(glm::greaterThan(localCorner, Coord(BLOCK_EXTENT)))
+			|| localCorner[axis] == int(BLOCK_EXTENT))
+			return nullptr;
+
+		const auto& blocksCnt = m_BlockCounts[0];
+		const auto blockIndex = m_Level0BlockIndices[ownerBlock.z * blocksCnt.y * blocksCnt.x + ownerBlock.y * blocksCnt.x + ownerBlock.x];
+		if (blockIndex == INVALID_INDEX)
+			return nullptr;
+
+		const auto& crossings = m_LevelBlocks[0][blockIndex].Crossings;
+		EdgeCrossing key;
+		key.Edge = MakeEdgeId(localCorner, axis);
+		auto crossing = std::lower_bound(crossings.cbegin(), crossings.cend(), key, &EdgeCrossingLess);
+		if (crossing == crossings.cend() || crossing->Edge != key.Edge)
+			return nullptr;
+
+		return &*crossing;
+	}
+
+	static bool EdgeCrossingLess(const EdgeCrossing& lhs, const EdgeCrossing& rhs)
+	{
+		return lhs.Edge < rhs.Edge;
+	}
 
-			#ifdef _DEBUG
-			float intpart;
-			assert(std::abs(modf(midpoint.x, &intpart)) <= FLT_MIN
-				&& std::abs(modf(midpoint.y, &intpart)) <= FLT_MIN
-				&& std::abs(modf(midpoint.z, &intpart)) <= FLT_MIN);
-			#endif
+	void SortEdgeCrossings(Block& block) const
+	{
+		auto& crossings = block.Crossings;
+		std::sort(crossings.begin(), crossings.end(), &EdgeCrossingLess);
+		// an edge is recorded again by the cells that can't reuse its vertex
+		crossings.erase(std::unique(crossings.begin(), crossings.end(),
+			[](const EdgeCrossing& lhs, const EdgeCrossing& rhs) { return lhs.Edge == rhs.Edge; }), crossings.end());
+		EdgeCrossingsVec(crossings).swap(crossings);
+	}
 
-			const auto midValue = GetGridValue(midpoint);
-			const auto p0Value = GetGridValue(P0);
-			const auto p1Value = GetGridValue(P1);
+	// The samples are taken from the level 0 crossing of the edge when there is one
+	void SampleEdgeNormals(const GridBlocksCache& cache, const EdgeCrossing* crossing, const Coord& P0, const Coord& P1, glm::vec3& N0, glm::vec3& N1) const
+	{
+		if (crossing) {
+			const bool reversed = glm::any(glm::lessThan(P1, P0));
+			N0 = crossing->Normals[reversed];
+			N1 = crossing->Normals[!reversed];
+			return;
+		}
 
-			if((p0Value * midValue) <= 0) {
-				P1 = midpoint;
-			} else {
-				P0 = midpoint;
-			}
+		N0 = CalcNormal(cache, P0);
+		N1 = CalcNormal(cache, P1);
+	}
 
-			#ifdef _DEBUG
-			assert(P0.x == P1.x || P0.y == P1.y || P0.z == P1.z);
-			#endif
+	static void SampleEdgeMaterials(const GridBlocksCache& cache, const EdgeCrossing* crossing, const Coord& P0, const Coord& P1, MaterialInfo& M0, MaterialInfo& M1)
+	{
+		if (crossing) {
+			const bool reversed = glm::any(glm::lessThan(P1, P0));
+			M0 = crossing->Materials[reversed];
+			M1 = crossing->Materials[!reversed];
+			return;
 		}
+
+		M0 = cache.GetMaterialGridValue(P0);
+		M1 = cache.GetMaterialGridValue(P1);
 	}
-	
-	bool AreBlockAndNeighborsEmpty(Block& block) const
+
+	bool AreBlockAndNeighborsEmpty(const Coord& blockCoords) const
 	{
-		assert(block.Level == 0);
 		// check all the neighbors
 		for (int z = -1; z < 2; ++z)
 		for (int y = -1; y < 2; ++y)
 		for (int x = -1; x < 2; ++x)
 		{
-			glm::vec3 coord = glm::vec3(StMath::clamp_value(block.Coords.x + x, 0.f, m_BlockCounts[0].x - 1),
-				StMath::clamp_value(block.Coords.y + y, 0.f, m_BlockCounts[0].y - 1),
-				StMath::clamp_value(block.Coords.z + z, 0.f, m_BlockCounts[0].z - 1));
+			const Coord coord = glm::clamp(blockCoords + Coord(x, y, z), Coord(0), m_BlockCounts[0] - 1);
 			if (!m_Grid.IsBlockEmpty(coord))
 				return false;
 		}
@@ -1526,33 +3453,31 @@ private:
 		return true;
 	}
 
-	void PolygonizeBlock(Block& block, PolygonMap& outputMap)
+	template <bool FinestLevel>
+	void PolygonizeBlock(WorkerContext& context, Block& block)
 	{			
 		PROFI_SCOPE_S2("Polygonize block")
 
 		PROFI_SCOPE_S3(LEVEL_STRS[block.Level])
+		const auto& cache = context.Cache;
 		unsigned verticesIndices[15];
-		
-		assert(BLOCK_EXTENT == BLOCK_EXTENT && BLOCK_EXTENT == BLOCK_EXTENT);
-		const auto blockBase = block.Coords * float(BLOCK_EXTENT);
 
 		unsigned char reuseValidityMask = 0;
-		for(unsigned cellZ = 0; cellZ < BLOCK_EXTENT; ++cellZ)
+		for(int cellZ = 0; cellZ < int(BLOCK_EXTENT); ++cellZ)
 		{
 			// clear the y-bit
 			reuseValidityMask &= 0xD;
-			for(unsigned cellY = 0; cellY < BLOCK_EXTENT; ++cellY)	
+			for(int cellY = 0; cellY < int(BLOCK_EXTENT); ++cellY)	
 			{
 				// clear the x-bit
 				reuseValidityMask &= 0xE;
-				for(unsigned cellX = 0; cellX < BLOCK_EXTENT; ++cellX)
+				for(int cellX = 0; cellX < int(BLOCK_EXTENT); ++cellX)
 				{
 					Coord cellCoords(cellX, cellY, cellZ);
-					Cell cell = MakeCell(block, cellCoords);
+					Cell cell = MakeCell<FinestLevel>(cache, block, cellCoords);
 					
-					block.FilledCells.push_back(Block::FilledCell());
-
-					auto& thisCellReuseData = block.FilledCells.back();
+					auto& thisCellReuseData = context.GetFilledCell(cellCoords);
+					thisCellReuseData.Reset();
 
 					//classify the cell
 					const unsigned long caseCode = Cell::CalcCaseCode(cell.V);
@@ -1565,7 +3490,7 @@ private:
 					}
 					
 					#ifdef USE_MATERIAL_CACHE
-					CalculateMaterialForCellCache(cell);
+					CalculateMaterialForCellCache(cache, cell);
 					#endif
 					
 					++block.Stats.NonTrivialCells;
@@ -1580,7 +3505,7 @@ private:
 					{
 						const char edgeIndex = regVertexData[vertexIndex] & 0xFF;
 						char direction = (regVertexData[vertexIndex] >> 12);
-						char vIndexInCell = (regVertexData[vertexIndex] >> 8) & 0x0F;
+						unsigned char vIndexInCell = (regVertexData[vertexIndex] >> 8) & 0x0F;
 						bool checkReuse = true;
 						bool shouldCreateNewVertex = true;
 
@@ -1588,7 +3513,7 @@ private:
 
 						const unsigned char v0 = (edgeIndex >> 4) & 0x0F;
 						const unsigned char v1 = edgeIndex & 0x0F;
-						long t = (cell.V[v1] << 8) / (cell.V[v1] - cell.V[v0]);
+						long t = CalcEdgeInterpolation(cell.V[v0], cell.V[v1]);
 
 						// The vertex lies on some endpoint of the edge
 						if ((t & 0x00FF) == 0)
@@ -1612,7 +3537,7 @@ private:
 						{
 							Coord reuseCoord = FindAdjCellForReuse(direction, cellCoords);
 
-							const auto& filledCell = block.FilledCells[MakeReuseId(reuseCoord)];
+							const auto& filledCell = context.GetFilledCell(reuseCoord);
 
 							auto reuseIndex = filledCell.ReuseVertexIndices[vIndexInCell];
 
@@ -1634,7 +3559,7 @@ private:
 								{
 									if(verticesIndices[vertexIndex] == INVALID_INDEX)
 									{
-										auto index = GenerateVertexFromPoint(block, cell, v0);
+										auto index = GenerateVertexFromPoint(context, cache, block, cell, v0);
 										verticesIndices[vertexIndex] = index;
 									}
 								}
@@ -1649,7 +3574,7 @@ private:
 							// Vertex lies on one of the endpoints - create the new vertex there
 							if((t & 0x00FF) == 0)
 							{
-								auto index = GenerateVertexFromPoint(block, cell, (t == 0) ? v1 : v0);
+								auto index = GenerateVertexFromPoint(context, cache, block, cell, (t == 0) ? v1 : v0);
 								if(t == 0 && v1 == 7)
 									thisCellReuseData.ReuseVertexIndices[vIndexInCell] = index;
 								// Save this index for the triangulation
@@ -1658,52 +3583,53 @@ private:
 							// Vertex lies in the interior of the edge.
 							else
 							{
-								glm::vec3 P0, N0;
-								glm::vec3 P1, N1;
-								MaterialInfo M0, M1;
-								// if this is a lower LOD level, prevent surface shifting by descending
-								// the vertices at the corners and looking for the best two
-								if(block.Level && SURFACE_SHIFTING_CORRECTION) {
+								Coord P0, P1;
+								char values[2] = { cell.V[v0], cell.V[v1] };
+								const EdgeCrossing* crossing = nullptr;
+								// if this is a lower LOD level, prevent surface shifting by moving
+								// the vertex to the level 0 edge with the crossing
+								if(!FinestLevel && SURFACE_SHIFTING_CORRECTION) {
 									P0 = cell.GetCornerCoords(v0);
 									P1 = cell.GetCornerCoords(v1);
-									FindBestVertexInLODChain(block.Level, P0, P1);
+									char p0Value = cell.V[v0];
+									char p1Value = cell.V[v1];
+									crossing = FindBestVertexInLODChain(cache, block, block.Level, P0, P1, p0Value, p1Value);
 
-									const auto p0Value = GetGridValue(P0);
-									const auto p1Value = GetGridValue(P1);
 									if(p0Value != p1Value) {
-										t = (p1Value << 8) / (p1Value - p0Value);
+										t = CalcEdgeInterpolation(p0Value, p1Value);
 									}
 									else {
 										t = 0;
 									}
+									values[0] = p0Value;
+									values[1] = p1Value;
 
 								} else {
 									P0 = cell.GetCornerCoords(v0);
 									P1 = cell.GetCornerCoords(v1);
 								}
 
-								N0 = CalcNormal(P0);
-								N1 = CalcNormal(P1);
-								M0 = GetMaterialInfo(P0);
-								M1 = GetMaterialInfo(P1);
+								PendingVertex vertex;
+								vertex.P0 = P0;
+								vertex.P1 = P1;
+								vertex.T = t;
+								vertex.Boundaries = cell.EdgeOnBlockBoundary(v0, v1);
+								vertex.Values[0] = values[0];
+								vertex.Values[1] = values[1];
+								vertex.Crossing = (FinestLevel || crossing) ? crossing : FindEdgeCrossing(block, P0, P1);
+								SampleEdgeMaterials(cache, vertex.Crossing, P0, P1, vertex.Materials[0], vertex.Materials[1]);
 
 								const long u = 0x0100 - t;
-								glm::vec4 Q = glm::vec4((float)t * P0 + (float)u * P1, 0.f);
-
-								// push the vertex in the global array
-								FloatInt onboundary;
-								onboundary.asInt = cell.EdgeOnBlockBoundary(v0, v1);
-								Q.w = onboundary.asFloat;
-								block.Vertices.push_back(Q);
+								auto M0 = vertex.Materials[0];
+								const auto& M1 = vertex.Materials[1];
 								if((M0.Id == M1.Id) &&  (M0.Id == cell.Material.Id)) {
 									M0.Blend = Voxels::BlendFactor(((float)t * M0.Blend + (float)u * M1.Blend) / 256.f);
-									block.Materials.push_back(M0);
 								} else {
-									block.Materials.push_back(cell.Material);
+									M0 = cell.Material;
 								}
-								block.Normals.push_back(normalizeFixZero( N0 * (t/256.f) + N1 * (u/256.f)) );
 
-								auto index = block.Vertices.size() - 1;
+								// the position and the normal are calculated after all the cells
+								auto index = QueueRegularVertex(context, block, vertex, M0);
 
 								// save the index in this cell's reuse data
 								if(direction == 0x8)
@@ -1717,26 +3643,10 @@ private:
 						}
 					}
 					
-					block.SecondaryVertices.resize(block.Vertices.size());
 					// push all triangles
-					for (auto v = 0L, triagCount = regCellData.GetTriangleCount() * 3; v < triagCount; v += 3)
+					for (auto v = 0L, triagCount = regCellData.GetTriangleCount() * 3; v < triagCount; ++v)
 					{
-						for(auto vtr = 0; vtr < 3; ++vtr) {
-							auto vIndex = verticesIndices[regCellData.vertexIndex[v + vtr]];
-							block.Indices.push_back(vIndex);
-
-							auto vertex = block.Vertices[vIndex];
-							FloatInt boundaries;
-							boundaries.asFloat = vertex.w;
-							if (boundaries.asInt > 0) {
-								// move the vertex to make room for the transition cell
-								auto delta = AccumulateVertexTransitionDelta(boundaries.asInt, cell) * 256.f;
-								// TODO: Move in the tangent plane
-								block.SecondaryVertices[vIndex] = glm::vec4(glm::vec3(vertex) + delta, boundaries.asFloat);
-							} else {
-								block.SecondaryVertices[vIndex] = vertex;
-							}
-						}
+						block.Indices.push_back(verticesIndices[regCellData.vertexIndex[v]]);
 					}
 
 					reuseValidityMask |= 0x1;
@@ -1747,18 +3657,97 @@ private:
 			if(reuseValidityMask & 2)
 				reuseValidityMask |= 0x4;
 		} // z
+
+		EmitPendingVertices(context, block);
 	}
 
-	typedef GenericFilledCell<10> TransitionFilledCell;
+	// Polygonizes a level 0 block for VF_Collision - only the positions of the
+	// vertices are calculated. All the cells that have a vertex on the same edge
+	// or corner share it, so the block has no duplicate positions.
+	void PolygonizeCollisionBlock(WorkerContext& context, Block& block)
+	{
+		PROFI_SCOPE_S2("Polygonize collision block")
+
+		assert(block.Level == 0);
+		const auto& cache = context.Cache;
+		std::fill(std::begin(context.CollisionVertices), std::end(context.CollisionVertices), unsigned(INVALID_INDEX));
+
+		const Coord blockBase = block.Coords * int(BLOCK_EXTENT);
+		unsigned verticesIndices[12];
+		for(int cellZ = 0; cellZ < int(BLOCK_EXTENT); ++cellZ)
+		for(int cellY = 0; cellY < int(BLOCK_EXTENT); ++cellY)
+		for(int cellX = 0; cellX < int(BLOCK_EXTENT); ++cellX)
+		{
+			const Coord cellCoords(cellX, cellY, cellZ);
+			const Cell cell = MakeCell<true>(cache, block, cellCoords);
+
+			const unsigned long caseCode = Cell::CalcCaseCode(cell.V);
+			if((caseCode ^ ((cell.V[7] >> 7) & 0xFF)) == 0)
+			{
+				++block.Stats.TrivialCells;
+				continue;
+			}
+			++block.Stats.NonTrivialCells;
+
+			const unsigned caseIndex = regularCellClass[caseCode];
+			++block.Stats.PerCaseCellsCount[caseIndex];
+
+			const RegularCellData regCellData = regularCellData[caseIndex];
+			const unsigned short* regVertexData = regularVertexData[caseCode];
+			for (long vertexIndex = 0, vertexCount = regCellData.GetVertexCount(); vertexIndex < vertexCount; ++vertexIndex)
+			{
+				const char edgeIndex = regVertexData[vertexIndex] & 0xFF;
+				const unsigned char v0 = (edgeIndex >> 4) & 0x0F;
+				const unsigned char v1 = edgeIndex & 0x0F;
+				const long t = CalcEdgeInterpolation(cell.V[v0], cell.V[v1]);
+				const long u = 0x0100 - t;
+
+				const auto P0 = cellCoords + Cell::GetCornerOffset(v0);
+				const auto P1 = cellCoords + Cell::GetCornerOffset(v1);
+				// a vertex on an end of the edge belongs to the corner
+				unsigned key;
+				if (t == 0) {
+					key = MakeCollisionVertexKey(P1, 3);
+				} else if (u == 0) {
+					key = MakeCollisionVertexKey(P0, 3);
+				} else {
+					key = MakeCollisionVertexKey(glm::min(P0, P1), GetEdgeAxis(P0, P1));
+				}
+
+				auto& index = context.CollisionVertices[key];
+				if (index == INVALID_INDEX) {
+					index = unsigned(block.Positions.size());
+					const auto position = ((float)t * glm::vec3(blockBase + P0) + (float)u * glm::vec3(blockBase + P1)) * (1 / 256.f);
+					// swap z & y so that the positions match the ones of the other formats
+					block.Positions.push_back(float3(position.x, position.z, position.y));
+				}
+				verticesIndices[vertexIndex] = index;
+			}
+
+			for (auto v = 0L, triagCount = regCellData.GetTriangleCount() * 3; v < triagCount; ++v)
+			{
+				block.Indices.push_back(verticesIndices[regCellData.vertexIndex[v]]);
+			}
+		}
+	}
+
+	// An edge (slot 0 - 2 is its axis) or a corner (slot 3) of a level 0 block.
+	// localCorner is the corner or the lower corner of the edge in the block.
+	static unsigned MakeCollisionVertexKey(const Coord& localCorner, int slot)
+	{
+		const int cornersExt = BLOCK_EXTENT + 1;
+		return unsigned(((localCorner.z * cornersExt + localCorner.y) * cornersExt + localCorner.x) * 4 + slot);
+	}
 
-	void GenerateTransitionCells(Block& block)
+	void GenerateTransitionCells(WorkerContext& context, Block& block)
 	{
+		const auto& cache = context.Cache;
 		PROFI_SCOPE_S2("Generate transition cells")
 
 		int row = 0, highRow = 0;
 		int column = 0, highColumn = 0;
 		const int minDim = 0;
-		const int maxDim = 15;
+		const int maxDim = int(BLOCK_EXTENT) - 1;
 		// when going in 2D and increasing row and column this mapping translates
 		// them to the 3D voxel coordinates
 		const int* transitionCases[][3] = {
@@ -1781,14 +3770,15 @@ private:
 			{&minDim, &highColumn, &highRow },
 		};
 
-		float blockDeltas[][3] = {
-			{ 0, 0, -0.5f }, // when going 'back' from a low res cell we need to
-			{ 0, -0.5f, 0 }, // move half a low-level cell 
-			{ -0.5f, 0, 0 },
+		// deltas are expressed in high-res cell units - half a low-res cell
+		const Coord blockDeltas[] = {
+			Coord( 0, 0, -1 ), // when going 'back' from a low res cell we need to
+			Coord( 0, -1, 0 ), // move half a low-level cell 
+			Coord( -1, 0, 0 ),
 			
-			{ 0, 0, 1 }, // here we need to skip the whole low res cell
-			{ 0, 1, 0 }, 
-			{ 1, 0, 0 }	 
+			Coord( 0, 0, 2 ), // here we need to skip the whole low res cell
+			Coord( 0, 2, 0 ), 
+			Coord( 2, 0, 0 )	 
 		};
 
 		// the faces that have to be fetched from the LOW-res cells for eevry case
@@ -1802,117 +3792,112 @@ private:
 			Cell::XPos
 		};
 
-		// the faces that have to be fetched from the HIGH-res cells for every case
-		Cell::FaceId highFaceIds[] = {
-			Cell::ZPos,
-			Cell::YPos,
-			Cell::XPos,
-
-			Cell::ZNeg,
-			Cell::YNeg,
-			Cell::XNeg
-		};
-
 		// we need to reverse the windiing for some cases because they won't be ok in world space
 		const int reverseWinding[] = { 0, 1, 0, 1, 0, 1 };
 
 		static const int caseCodeCoeffs[9] = { 0x01, 0x02, 0x04, 0x80, 0x100, 0x08, 0x40, 0x20, 0x10 };
 		static const int charByteSz = sizeof(char) * 8;
 
-		const auto highResLevel = block.LevelMultiplier >> 1;
-		Coord blocksCnt;
-		GetBlocksCount(block.LevelMultiplier, blocksCnt);
+		const int highResLevel = int(block.Level) - 1;
+		const auto& blocksCnt = m_BlockCounts[block.Level];
+		const Coord blockBase = block.Coords << int(BLOCK_EXTENT_POWER + block.Level);
+		const int planeExtent = 2 * BLOCK_EXTENT + 1;
 		
 		for(auto transitionId = 0u; transitionId < 6; ++transitionId)
 		{
 			// check if there is a neighbor block or we are at a grid boundary
-			Coord neighborBlockCoords(block.Coords.x + blockDeltas[transitionId][0]
-									, block.Coords.y + blockDeltas[transitionId][1]
-									, block.Coords.z + blockDeltas[transitionId][2]);
-			if((neighborBlockCoords.x < 0 || neighborBlockCoords.x >= blocksCnt.x)
-			|| (neighborBlockCoords.y < 0 || neighborBlockCoords.y >= blocksCnt.y)
-			|| (neighborBlockCoords.z < 0 || neighborBlockCoords.z >= blocksCnt.z))
+			const Coord neighborBlockCoords = block.Coords + glm::sign(blockDeltas[transitionId]);
+			if(glm::any(glm::lessThan(neighborBlockCoords, Coord(0)))
+			|| glm::any(glm::greaterThanEqual(neighborBlockCoords, blocksCnt)))
 				continue;
 
-			// TODO: Those could be global for a run to save one vector allocation per block
-			typedef std::vector<TransitionFilledCell> FilledRow;
-			FilledRow currentFilledRow;
-			currentFilledRow.resize(BLOCK_EXTENT);
-			FilledRow previousFilledRow;
-			previousFilledRow.resize(BLOCK_EXTENT);
+			TransitionFilledCell* currentFilledRow = context.TransitionFilledRows[0];
+			TransitionFilledCell* previousFilledRow = context.TransitionFilledRows[1];
+			std::for_each(currentFilledRow, currentFilledRow + BLOCK_EXTENT, [](TransitionFilledCell& cell) { cell.Reset(); });
+			std::for_each(previousFilledRow, previousFilledRow + BLOCK_EXTENT, [](TransitionFilledCell& cell) { cell.Reset(); });
 
 			const auto& face = transitionCases[transitionId];
 			const auto& highFace = highResCoords[transitionId];
 
-			highRow = 0;
-			highColumn = 0;
+			// sample the whole face once at the resolution of the neighbor - a transition cell
+			// takes its 9 high-res values from there and its low-res corners are the even ones
+			const Coord planeOrigin = blockBase + (glm::max(glm::sign(blockDeltas[transitionId]), Coord(0)) << int(BLOCK_EXTENT_POWER + block.Level));
+			highColumn = 1; highRow = 0;
+			const Coord columnStep = Coord(*highFace[0], *highFace[1], *highFace[2]) << highResLevel;
+			highColumn = 0; highRow = 1;
+			const Coord rowStep = Coord(*highFace[0], *highFace[1], *highFace[2]) << highResLevel;
+
+			auto& plane = context.TransitionPlane;
+			bool hasInside = false;
+			bool hasOutside = false;
+			for(highRow = 0; highRow < planeExtent; ++highRow)
+			{
+				for(highColumn = 0; highColumn < planeExtent; ++highColumn)
+				{
+					const char value = cache.GetGridValue(planeOrigin + highColumn * columnStep + highRow * rowStep);
+					plane[highRow][highColumn] = value;
+					if(value < 0) {
+						hasInside = true;
+					} else {
+						hasOutside = true;
+					}
+				}
+			}
+			// all the transition cells on a face without a sign change are empty
+			const bool faceHasSurface = hasInside && hasOutside;
+
+			// the corners of the low-res cells that correspond to the transition cell corners 9 to C
+			const auto lowResCellCornerIds = Cell::GetCornerIdsForFace(faceIds[transitionId]);
+
 			unsigned char reuseValidityMask = 0;
-			for(row = 0; row < BLOCK_EXTENT; ++row) 
+			for(row = 0; row <= maxDim; ++row) 
 			{
 				reuseValidityMask &= 0x2; // clear the column reuse for the first cell in a row
-				for(column = 0; column < BLOCK_EXTENT; ++column)
+				for(column = 0; column <= maxDim; ++column)
 				{
 					const Coord cellCoords(*face[0], *face[1], *face[2]);
 
-					Cell lowResCell = MakeCell(block, cellCoords);
+					// the values of the low-res cell are taken from the plane
+					Cell lowResCell = MakeCellWithoutValues(block, cellCoords);
 					#ifdef USE_MATERIAL_CACHE
-					CalculateMaterialForCellCache(lowResCell);
+					// the coarser levels use the materials of all the cells on the faces
+					CalculateMaterialForCellCache(cache, lowResCell);
 					#endif
-					
-					Coord highResBase((lowResCell.Base.x + blockDeltas[transitionId][0] * block.LevelMultiplier)
-									, (lowResCell.Base.y + blockDeltas[transitionId][1] * block.LevelMultiplier)
-									, (lowResCell.Base.z + blockDeltas[transitionId][2] * block.LevelMultiplier));
-
-					assert(highRow == 0 && highColumn == 0);
-					Cell highResCell0 = MakeCell(highResBase, highResLevel);
-					++highColumn;
-					Cell highResCell1 = MakeCell(Coord(highResBase.x + (*highFace[0] * highResLevel), highResBase.y + (*highFace[1] * highResLevel), highResBase.z + (*highFace[2] * highResLevel)), highResLevel);
-					--highColumn; ++highRow;
-					Cell highResCell2 = MakeCell(Coord(highResBase.x + (*highFace[0] * highResLevel), highResBase.y + (*highFace[1] * highResLevel), highResBase.z + (*highFace[2] * highResLevel)), highResLevel);
-					--highRow;
+
+					if(!faceHasSurface)
+						continue;
 
 					char values[13];
-					glm::vec3 cornerCoords[13];
+					Coord cornerCoords[13];
 
 					// NB: The coordinates we use and output here are global in the space of the grid
+					for(auto r = 0; r < 3; ++r) {
+						for(auto c = 0; c < 3; ++c) {
+							highColumn = 2 * column + c;
+							highRow = 2 * row + r;
+							values[r * 3 + c] = plane[highRow][highColumn];
+							cornerCoords[r * 3 + c] = planeOrigin + highColumn * columnStep + highRow * rowStep;
+						}
+					}
 
-					char cellValues[4];
-					glm::vec3 corners[4];
-					auto lowResCellCornerIds = Cell::GetCornerIdsForFace(faceIds[transitionId]);
-					lowResCell.GetValuesForFace(faceIds[transitionId], cellValues);
+					// the low-res face shares its corners with the high-res one
+					values[9]   = values[0]; cornerCoords[9]   = cornerCoords[0];
+					values[0xA] = values[2]; cornerCoords[0xA] = cornerCoords[2]; // A
+					values[0xB] = values[6]; cornerCoords[0xB] = cornerCoords[6]; // B
+					values[0xC] = values[8]; cornerCoords[0xC] = cornerCoords[8]; // C
+
+					#ifdef _DEBUG
+					Coord corners[4];
 					lowResCell.GetCornerCoordsForFace(faceIds[transitionId], corners);
-					values[0xA] = cellValues[1]; cornerCoords[0xA] = corners[1]; // A
-					values[0xB] = cellValues[2]; cornerCoords[0xB] = corners[2]; // B
-					values[0xC] = cellValues[3]; cornerCoords[0xC] = corners[3]; // C
-					values[9]   = cellValues[0]; cornerCoords[9]   = corners[0]; 
-
-					highResCell0.GetValuesForFace(highFaceIds[transitionId], cellValues);
-					highResCell0.GetCornerCoordsForFace(highFaceIds[transitionId], corners);
-					values[0] = cellValues[0]; cornerCoords[0] = corners[0];
-					values[1] = cellValues[1]; cornerCoords[1] = corners[1];
-					values[3] = cellValues[2]; cornerCoords[3] = corners[2];
-					values[4] = cellValues[3]; cornerCoords[4] = corners[3];
-
-					highResCell1.GetValuesForFace(highFaceIds[transitionId], cellValues);
-					highResCell1.GetCornerCoordsForFace(highFaceIds[transitionId], corners);
-					values[2] = cellValues[1]; cornerCoords[2] = corners[1];
-					values[5] = cellValues[3]; cornerCoords[5] = corners[3];
-
-					highResCell2.GetValuesForFace(highFaceIds[transitionId], cellValues);
-					highResCell2.GetCornerCoordsForFace(highFaceIds[transitionId], corners);
-					values[6] = cellValues[2]; cornerCoords[6] = corners[2];
-					values[7] = cellValues[3]; cornerCoords[7] = corners[3];
-
-					values[8] = values[0xC]; cornerCoords[8] = cornerCoords[0xC]; // 8 == C
-
-					assert(values[0] == values[9] 
-						&& values[2] == values[0xA] 
-						&& values[6] == values[0xB]
-						&& values[8] == values[0xC]);
+					assert(corners[0] == cornerCoords[9]
+						&& corners[1] == cornerCoords[0xA]
+						&& corners[2] == cornerCoords[0xB]
+						&& corners[3] == cornerCoords[0xC]);
+					#endif
 
 					// move the corner coords of the low-res face of the transition cell "in" the 
 					// low res cell by the coefficient
-					auto lowresFaceMoveDir = lowResCell.GetGlobalDirectionOppositeForFace(faceIds[transitionId]);
+					const auto lowresFaceMoveDir = glm::vec3(lowResCell.GetGlobalDirectionOppositeForFace(faceIds[transitionId]));
 
 					int caseCode = 0;
 					for(auto ci = 0; ci < 9; ++ci) {
@@ -1929,17 +3914,18 @@ private:
 					
 					const unsigned short* vertexData = transitionVertexData[caseCode];
 
-					IndicesVec cellIndices;
-					cellIndices.reserve(cellData.GetVertexCount());
+					unsigned cellIndices[12];
+					unsigned cellIndicesCount = 0;
+					assert(cellData.GetVertexCount() <= long(_countof(cellIndices)));
 					for (long vertexIndex = 0, vertexCount = cellData.GetVertexCount(); vertexIndex < vertexCount; ++vertexIndex) {
 						const char edgeIndex = vertexData[vertexIndex] & 0xFF;
 						const unsigned char v0 = (edgeIndex >> 4) & 0x0F;
 						const unsigned char v1 = edgeIndex & 0x0F;
 
 						char reuseDirection = (vertexData[vertexIndex] >> 12);
-						char reuseIndex = (vertexData[vertexIndex] >> 8) & 0x0F;
+						unsigned char reuseIndex = (vertexData[vertexIndex] >> 8) & 0x0F;
 
-						long t = (values[v1] << 8) / (values[v1] - values[v0]);
+						long t = CalcEdgeInterpolation(values[v0], values[v1]);
 
 						bool didReuse = false;
 						bool addForReuse = true;
@@ -1972,15 +3958,17 @@ private:
 								auto reuseMaterial = block.TransitionMaterials[transitionId][indexFound];
 								if(reuseMaterial.Id == lowResCell.Material.Id) {
 									didReuse = true;
-									cellIndices.push_back(indexFound);
+									cellIndices[cellIndicesCount++] = indexFound;
 								}
 							}
 						}
 						// Create a new vertex
 						if(!didReuse)
 						{
-							glm::vec3 P0 = cornerCoords[v0], N0;
-							glm::vec3 P1 = cornerCoords[v1], N1;
+							Coord P0i = cornerCoords[v0];
+							Coord P1i = cornerCoords[v1];
+							glm::vec3 N0, N1;
+							MaterialInfo M0, M1;
 							long u = 0;
 							
 							int adjacencyInfo = 0;
@@ -1988,11 +3976,13 @@ private:
 							// Vertex lies on some endpoint
 							if((t & 0x00FF) == 0)
 							{
+								M0 = cache.GetMaterialGridValue(P0i);
+								M1 = cache.GetMaterialGridValue(P1i);
 								if(t == 0)
 								{
 									u = 256;
 									N0 = glm::vec3(0.f);
-									N1 = CalcNormal(P1);
+									N1 = CalcNormal(cache, P1i);
 
 									if(v1 >= 0x9) {
 										adjacencyInfo = lowResCell.CornerOnBlockBoundary(lowResCellCornerIds[v1 - 9]);
@@ -2003,7 +3993,7 @@ private:
 								{
 									u = 0;
 									t = 256;
-									N0 = CalcNormal(P0);
+									N0 = CalcNormal(cache, P0i);
 									N1 = glm::vec3(0.f);
 									
 									if(v0 >= 0x9) {
@@ -2016,13 +4006,14 @@ private:
 							else
 							{
 								int lodOfEdge = (v0 >= 0x9) ? block.Level : block.Level - 1;
+								const EdgeCrossing* crossing = nullptr;
 								if(SURFACE_SHIFTING_CORRECTION && lodOfEdge > 0)
 								{
-									FindBestVertexInLODChain(lodOfEdge, P0, P1);
-									const auto p0Value = GetGridValue(P0);
-									const auto p1Value = GetGridValue(P1);
+									char p0Value = values[v0];
+									char p1Value = values[v1];
+									crossing = FindBestVertexInLODChain(cache, block, lodOfEdge, P0i, P1i, p0Value, p1Value);
 									if(p0Value != p1Value) {
-										t = (p1Value << 8) / (p1Value - p0Value);
+										t = CalcEdgeInterpolation(p0Value, p1Value);
 									}
 									else {
 										t = 0;
@@ -2030,16 +4021,20 @@ private:
 								}
 
 								u = 0x0100 - t;
-								N0 = CalcNormal(P0);
-								N1 = CalcNormal(P1);
+								if (!crossing) {
+									crossing = FindEdgeCrossing(block, P0i, P1i);
+								}
+								SampleEdgeNormals(cache, crossing, P0i, P1i, N0, N1);
+								SampleEdgeMaterials(cache, crossing, P0i, P1i, M0, M1);
 
 								if(v0 >= 0x9 && v1 >= 0x9) {
 									adjacencyInfo = lowResCell.EdgeOnBlockBoundary(lowResCellCornerIds[v0 - 9], lowResCellCornerIds[v1 - 9]);
 									assert(adjacencyInfo);
 								}
 							}
-							MaterialInfo M0 = GetMaterialInfo(P0);
-							MaterialInfo M1 = GetMaterialInfo(P1);
+							// from here on the positions can move off the grid
+							glm::vec3 P0 = glm::vec3(P0i);
+							glm::vec3 P1 = glm::vec3(P1i);
 
 							// NB: Here the primary/secondary position calculations are very complicated (I think better can be done)
 							// The effect they acieve is illustrated in Eric's paper on figure 4.13. The combination of adj. calculations 
@@ -2072,7 +4067,7 @@ private:
 									}
 								}
 							}
-							glm::vec4 Q = glm::vec4((float)t * P0 + (float)u * P1, 0.f);
+							const glm::vec3 Q = (float)t * P0 + (float)u * P1;
 							glm::vec4 QSec = glm::vec4((float)t * P0Sec + (float)u * P1Sec, 0.f);
 							FloatInt adjacency;
 							adjacency.asInt = adjacencyInfo;
@@ -2080,19 +4075,15 @@ private:
 
 							glm::vec3 normal = normalizeFixZero( N0 * (t/256.f) + N1 * (u/256.f) );
 
-							block.TransitionMeshVertices[transitionId].push_back(Q);
 							if((M0.Id == M1.Id) &&  (M0.Id == lowResCell.Material.Id)) {
 								M0.Blend = Voxels::BlendFactor(((float)t * M0.Blend + (float)u * M1.Blend) / 256.f);
-								block.TransitionMaterials[transitionId].push_back(M0);
 							} else {
-								block.TransitionMaterials[transitionId].push_back(lowResCell.Material);
+								M0 = lowResCell.Material;
 							}
+							block.TransitionMaterials[transitionId].push_back(M0);
 
-							block.TransitionMeshSecondaryVertices[transitionId].push_back(QSec);
-							block.TransitionMeshNormals[transitionId].push_back(normal);
-
-							auto index = block.TransitionMeshVertices[transitionId].size() - 1;
-							cellIndices.push_back(index);
+							auto index = EmitVertex(block, block.TransitionVertices[transitionId], Q, QSec, normal, M0);
+							cellIndices[cellIndicesCount++] = index;
 
 							if(addForReuse && reuseDirection == 8) {
 								currentFilledRow[column].ReuseVertexIndices[reuseIndex] = index;
@@ -2104,53 +4095,597 @@ private:
 					for (auto v = 0L, triagCount = cellData.GetTriangleCount() * 3; v < triagCount; v += 3)
 					{
 						auto vId = cellIndices[cellData.vertexIndex[v]];
-						assert(vId < block.TransitionMeshVertices[transitionId].size());
-						block.TransitionMeshIndices[transitionId].push_back(vId);
+						assert(vId < block.TransitionVertices[transitionId].size());
+						block.TransitionIndices[transitionId].push_back(vId);
 						vId = cellIndices[cellData.vertexIndex[v + 1]];
-						assert(vId < block.TransitionMeshVertices[transitionId].size());
-						block.TransitionMeshIndices[transitionId].push_back(vId);
+						assert(vId < block.TransitionVertices[transitionId].size());
+						block.TransitionIndices[transitionId].push_back(vId);
 						vId	= cellIndices[cellData.vertexIndex[v + 2]];
-						assert(vId < block.TransitionMeshVertices[transitionId].size());
-						block.TransitionMeshIndices[transitionId].push_back(vId);
+						assert(vId < block.TransitionVertices[transitionId].size());
+						block.TransitionIndices[transitionId].push_back(vId);
 
 						if(shouldInvertWinding ^ reverseWinding[transitionId]) {
-							const auto sz = block.TransitionMeshIndices[transitionId].size();
-							std::swap(block.TransitionMeshIndices[transitionId][sz - 1]
-									, block.TransitionMeshIndices[transitionId][sz - 2]);
+							const auto sz = block.TransitionIndices[transitionId].size();
+							std::swap(block.TransitionIndices[transitionId][sz - 1]
+									, block.TransitionIndices[transitionId][sz - 2]);
 						}
 					}
 
 					reuseValidityMask |= 0x1;
 				}
 				std::swap(previousFilledRow, currentFilledRow);
-				std::for_each(currentFilledRow.begin(), currentFilledRow.end(), [](TransitionFilledCell& cell) { cell.Reset(); });
+				std::for_each(currentFilledRow, currentFilledRow + BLOCK_EXTENT, [](TransitionFilledCell& cell) { cell.Reset(); });
 				
 				reuseValidityMask |= 0x2;
 			}
 		}
 	}
+
+	// Surface Nets places a single vertex in every cell with a surface - the
+	// average of the crossings on the cell edges - and connects the vertices of
+	// the 4 cells around every edge with a crossing in a quad. A block owns the
+	// edges from its minimal faces up to its maximal ones, so the quads over the
+	// maximal faces take their vertices from the layer of cells outside of them.
+	// The blocks of two levels don't meet, so the mesh of every block continues
+	// in a skirt on each face - a strip that hangs from the border of the mesh
+	// into the volume and covers the crack when the neighbor is of another level.
+
+	static unsigned GetSurfaceNetsSampleId(const Coord& coords)
+	{
+		const int extent = int(BLOCK_EXTENT) + 2;
+		return unsigned((coords.z * extent + coords.y) * extent + coords.x);
+	}
+
+	static unsigned GetSurfaceNetsCellId(const Coord& coords)
+	{
+		const int extent = int(BLOCK_EXTENT) + 1;
+		return unsigned((coords.z * extent + coords.y) * extent + coords.x);
+	}
+
+	static void GetSurfaceNetsCellValues(const WorkerContext& context, const Coord& cellCoords, char V[8])
+	{
+		for (auto i = 0; i < 8; ++i) {
+			V[i] = context.SurfaceNetsSamples[GetSurfaceNetsSampleId(cellCoords + Cell::GetCornerOffset(i))];
+		}
+	}
+
+	static bool IsTrivialCell(const char V[8])
+	{
+		const unsigned long caseCode = Cell::CalcCaseCode(V);
+		return caseCode == 0 || caseCode == 0xFF;
+	}
+
+	// The cells past the end of the grid have no vertices
+	bool IsCellInGrid(const Coord& base) const
+	{
+		return glm::all(glm::lessThanEqual(base, m_MaxExtents));
+	}
+
+	// Calculates the vertex of a cell with a surface in the internal space and
+	// its normal from the gradient over the cell corners
+	static void CalculateSurfaceNetsVertex(const char V[8], const Coord& base, unsigned level, glm::vec3& position, glm::vec3& normal)
+	{
+		static const unsigned char edgeCorners[12][2] = {
+			{ 0, 1 }, { 2, 3 }, { 4, 5 }, { 6, 7 },
+			{ 0, 2 }, { 1, 3 }, { 4, 6 }, { 5, 7 },
+			{ 0, 4 }, { 1, 5 }, { 2, 6 }, { 3, 7 }
+		};
+
+		glm::vec3 crossingsSum(0.0f);
+		unsigned crossingsCount = 0;
+		for (auto edge = 0; edge < 12; ++edge) {
+			const auto v0 = V[edgeCorners[edge][0]];
+			const auto v1 = V[edgeCorners[edge][1]];
+			if ((v0 < 0) == (v1 < 0))
+				continue;
+
+			const auto t = float(v0) / float(v0 - v1);
+			crossingsSum += glm::mix(glm::vec3(Cell::GetCornerOffset(edgeCorners[edge][0])), glm::vec3(Cell::GetCornerOffset(edgeCorners[edge][1])), t);
+			++crossingsCount;
+		}
+		assert(crossingsCount && "Vertex of a cell without a surface!");
+
+		position = (glm::vec3(base) + crossingsSum * (float(1 << level) / float(crossingsCount))) * 256.f;
+
+		// swap z & y as CalcNormal does
+		normal = normalizeFixZero(glm::vec3(
+			float((V[1] - V[0]) + (V[3] - V[2]) + (V[5] - V[4]) + (V[7] - V[6])),
+			float((V[4] - V[0]) + (V[5] - V[1]) + (V[6] - V[2]) + (V[7] - V[3])),
+			float((V[2] - V[0]) + (V[3] - V[1]) + (V[6] - V[4]) + (V[7] - V[5]))));
+	}
+
+	// The vertex of a cell of the block or of the layer outside of its maximal faces
+	void MakeSurfaceNetsCellVertex(const WorkerContext& context,
+		const Block& block,
+		const Coord& cellCoords,
+		glm::vec3& position,
+		glm::vec3& normal,
+		MaterialInfo& material)
+	{
+		char V[8];
+		GetSurfaceNetsCellValues(context, cellCoords, V);
+		const auto cell = MakeCellWithoutValues(block, cellCoords);
+		CalculateSurfaceNetsVertex(V, cell.Base, block.Level, position, normal);
+
+		// the cells outside belong to the neighbors, whose caches might still be
+		// written, so their materials come from the grid
+		if (glm::all(glm::lessThan(cellCoords, Coord(BLOCK_EXTENT)))) {
+			material = context.SurfaceNetsMaterials[cell.LocalId];
+		} else {
+			material = CalculateMaterialForCell(context.Cache, cell);
+		}
+	}
+
+	unsigned GetSurfaceNetsVertex(WorkerContext& context, Block& block, const Coord& cellCoords)
+	{
+		auto& index = context.SurfaceNetsVertices[GetSurfaceNetsCellId(cellCoords)];
+		if (index == INVALID_INDEX) {
+			glm::vec3 position;
+			glm::vec3 normal;
+			MaterialInfo material;
+			MakeSurfaceNetsCellVertex(context, block, cellCoords, position, normal, material);
+			block.Materials.push_back(material);
+			// the skirts are separate meshes, so the vertices are never moved
+			index = EmitVertex(block, block.Vertices, position, glm::vec4(position, 0.f), normal, material);
+		}
+		return index;
+	}
+
+	// Appends the quad of the 4 vertices around an edge. They go counter-clockwise
+	// around the edge direction.
+	static void EmitSurfaceNetsQuad(IndicesVec& indices, const unsigned vertices[4], bool lowerInside)
+	{
+		static const int quadTriangles[2][6] = {
+			{ 0, 2, 1, 0, 3, 2 },
+			{ 0, 1, 2, 0, 2, 3 }
+		};
+
+		const auto& triangles = quadTriangles[lowerInside ? 1 : 0];
+		for (auto i = 0; i < 6; ++i) {
+			indices.push_back(vertices[triangles[i]]);
+		}
+	}
+
+	void PolygonizeBlockSurfaceNets(WorkerContext& context, Block& block)
+	{
+		PROFI_SCOPE_S2("Polygonize block - Surface Nets")
+
+		PROFI_SCOPE_S3(LEVEL_STRS[block.Level])
+		const auto& cache = context.Cache;
+		const Coord blockBase = block.Coords << int(BLOCK_EXTENT_POWER + block.Level);
+		const int extent = int(BLOCK_EXTENT);
+
+		auto sample = context.SurfaceNetsSamples;
+		for (int z = 0; z < extent + 2; ++z)
+		for (int y = 0; y < extent + 2; ++y)
+		for (int x = 0; x < extent + 2; ++x)
+		{
+			*sample++ = cache.GetGridValue(blockBase + (Coord(x, y, z) << int(block.Level)));
+		}
+		std::fill(context.SurfaceNetsVertices, context.SurfaceNetsVertices + _countof(context.SurfaceNetsVertices), unsigned(INVALID_INDEX));
+
+		// the materials of the cells with a surface go to the cache for the coarser levels
+		for (int cellZ = 0; cellZ < extent; ++cellZ)
+		for (int cellY = 0; cellY < extent; ++cellY)
+		for (int cellX = 0; cellX < extent; ++cellX)
+		{
+			const Coord cellCoords(cellX, cellY, cellZ);
+			char V[8];
+			GetSurfaceNetsCellValues(context, cellCoords, V);
+			if (IsTrivialCell(V)) {
+				++block.Stats.TrivialCells;
+				continue;
+			}
+			++block.Stats.NonTrivialCells;
+
+			auto cell = MakeCellWithoutValues(block, cellCoords);
+			cell.Material = MaterialInfo(VoxelGrid::EMPTY_MATERIAL, 0);
+			#ifdef USE_MATERIAL_CACHE
+			CalculateMaterialForCellCache(cache, cell);
+			#endif
+			if (cell.Material.Id == VoxelGrid::EMPTY_MATERIAL) {
+				cell.Material = CalculateMaterialForCell(cache, cell);
+			}
+			context.SurfaceNetsMaterials[cell.LocalId] = cell.Material;
+		}
+
+		// the edges along an axis start on the minimal face up to the last cell and lie between
+		// the first and the last sample on the other axes - the cells around them are in the block
+		// or in the layer outside
+		for (int z = 0; z <= extent; ++z)
+		for (int y = 0; y <= extent; ++y)
+		for (int x = 0; x <= extent; ++x)
+		{
+			const Coord point(x, y, z);
+			const auto value = context.SurfaceNetsSamples[GetSurfaceNetsSampleId(point)];
+			for (auto axis = 0; axis < 3; ++axis) {
+				const auto axis1 = (axis + 1) % 3;
+				const auto axis2 = (axis + 2) % 3;
+				if (point[axis] == extent || !point[axis1] || !point[axis2])
+					continue;
+
+				Coord next(point);
+				++next[axis];
+				if ((value < 0) == (context.SurfaceNetsSamples[GetSurfaceNetsSampleId(next)] < 0))
+					continue;
+
+				// the cell with the largest coordinates is the point's
+				if (!IsCellInGrid(blockBase + (point << int(block.Level))))
+					continue;
+
+				Coord cells[4] = { point, point, point, point };
+				--cells[0][axis1]; --cells[0][axis2];
+				--cells[1][axis2];
+				--cells[3][axis1];
+				unsigned vertices[4];
+				for (auto i = 0; i < 4; ++i) {
+					vertices[i] = GetSurfaceNetsVertex(context, block, cells[i]);
+				}
+				EmitSurfaceNetsQuad(block.Indices, vertices, value < 0);
+			}
+		}
+	}
+
+	// The skirts hang a cell of the coarser level below the mesh
+	static float GetSkirtDepth(const Block& block)
+	{
+		return float(2 * block.LevelMultiplier);
+	}
+
+	// The skirts go to the transition meshes, which are indexed like the
+	// transition cells - Z-, Y-, X-, Z+, Y+, X+ in the internal space
+	static unsigned GetSkirtFace(int axis, bool positive)
+	{
+		return unsigned(2 - axis) + (positive ? 3u : 0u);
+	}
+
+	// The vertex on the border of the mesh and the one below it. The vertices of two
+	// levels are up to a coarse cell apart across the face, so the lower vertex also
+	// reaches past the face and the skirt slopes under the mesh of the neighbor.
+	static void EmitSkirtVertices(const PolygonVertex& vertex, float depth, int axis, float facePlane, bool positive, VerticesVec& output)
+	{
+		output.push_back(vertex);
+
+		auto position = tovec3(vertex.Position) - tovec3(vertex.Normal) * depth;
+		position[axis] = positive ? std::max(position[axis], facePlane + depth) : std::min(position[axis], facePlane - depth);
+		PolygonVertex lower(vertex);
+		lower.Position = tofloat3(position);
+		lower.SecondaryPosition = float4(position.x, position.y, position.z, vertex.SecondaryPosition.w);
+		output.push_back(lower);
+	}
+
+	// Hangs a skirt from the edges of the mesh that are on the border of the block
+	// and used by a single triangle. Faces at the grid boundary have no neighbor
+	// and get no skirt.
+	void GenerateSurfaceNetsSkirts(WorkerContext& context, Block& block)
+	{
+		PROFI_SCOPE_S2("Generate Surface Nets skirts")
+
+		const int extent = int(BLOCK_EXTENT);
+		const auto& blocksCnt = m_BlockCounts[block.Level];
+		unsigned neighborFaces = 0;
+		for (auto axis = 0; axis < 3; ++axis) {
+			if (block.Coords[axis] > 0) {
+				neighborFaces |= 1 << GetSkirtFace(axis, false);
+			}
+			if (block.Coords[axis] + 1 < blocksCnt[axis]) {
+				neighborFaces |= 1 << GetSkirtFace(axis, true);
+			}
+		}
+
+		// the vertices of the first cells are on the minimal faces and the ones
+		// of the layer outside on the maximal faces
+		auto& vertexFaces = context.SkirtVertexFaces;
+		vertexFaces.assign(block.Vertices.size(), 0);
+		for (int z = 0; z <= extent; ++z)
+		for (int y = 0; y <= extent; ++y)
+		for (int x = 0; x <= extent; ++x)
+		{
+			const Coord cellCoords(x, y, z);
+			const auto index = context.SurfaceNetsVertices[GetSurfaceNetsCellId(cellCoords)];
+			if (index == INVALID_INDEX)
+				continue;
+
+			for (auto axis = 0; axis < 3; ++axis) {
+				if (cellCoords[axis] == 0) {
+					vertexFaces[index] |= 1 << GetSkirtFace(axis, false);
+				} else if (cellCoords[axis] == extent) {
+					vertexFaces[index] |= 1 << GetSkirtFace(axis, true);
+				}
+			}
+		}
+
+		auto& edges = context.SkirtEdges;
+		edges.clear();
+		const auto indicesCount = unsigned(block.Indices.size());
+		for (auto i = 0u; i < indicesCount; i += 3) {
+			for (auto corner = 0u; corner < 3; ++corner) {
+				const auto v0 = block.Indices[i + corner];
+				const auto v1 = block.Indices[i + (corner + 1) % 3];
+				const unsigned faces = vertexFaces[v0] & vertexFaces[v1] & neighborFaces;
+				if (faces) {
+					const SkirtEdge edge = { { v0, v1 }, faces };
+					edges.push_back(edge);
+				}
+			}
+		}
+		if (edges.empty())
+			return;
+
+		// the edges inside the faces are used by two triangles - one in each direction
+		const auto edgeLess = [](const SkirtEdge& lhs, const SkirtEdge& rhs) {
+			const auto lhsKey = std::make_pair(std::min(lhs.Vertices[0], lhs.Vertices[1]), std::max(lhs.Vertices[0], lhs.Vertices[1]));
+			const auto rhsKey = std::make_pair(std::min(rhs.Vertices[0], rhs.Vertices[1]), std::max(rhs.Vertices[0], rhs.Vertices[1]));
+			return lhsKey < rhsKey;
+		};
+		std::sort(edges.begin(), edges.end(), edgeLess);
+		auto borderEnd = edges.begin();
+		for (auto edge = edges.begin(); edge != edges.end();) {
+			auto next = edge + 1;
+			while (next != edges.end() && !edgeLess(*edge, *next)) {
+				++next;
+			}
+			if (next - edge == 1) {
+				*borderEnd++ = *edge;
+			}
+			edge = next;
+		}
+		edges.erase(borderEnd, edges.end());
+
+		const auto depth = GetSkirtDepth(block);
+		float3 minCorner;
+		float3 maxCorner;
+		GetBlockCorners(block, minCorner, maxCorner);
+		auto& skirtVertices = context.SkirtVertices;
+		for (auto face = 0u; face < Cell::Face_Count; ++face) {
+			if (!(neighborFaces & (1 << face)))
+				continue;
+
+			// the output swaps y & z
+			static const int outputAxes[] = { 1, 2, 0 };
+			const auto axis = outputAxes[face % 3];
+			const bool positive = face >= 3;
+			const auto facePlane = tovec3(positive ? maxCorner : minCorner)[axis];
+			auto& vertices = block.TransitionVertices[face];
+			auto& indices = block.TransitionIndices[face];
+			skirtVertices.assign(block.Vertices.size(), unsigned(INVALID_INDEX));
+			for (const auto& edge : edges) {
+				if (!(edge.Faces & (1 << face)))
+					continue;
+
+				unsigned upper[2];
+				for (auto i = 0; i < 2; ++i) {
+					auto& index = skirtVertices[edge.Vertices[i]];
+					if (index == INVALID_INDEX) {
+						index = unsigned(vertices.size());
+						EmitSkirtVertices(block.Vertices[edge.Vertices[i]], depth, axis, facePlane, positive, vertices);
+					}
+					upper[i] = index;
+				}
+
+				// the skirt continues the triangle over the edge, so it goes the other way
+				const unsigned skirtTriangles[6] = { upper[1], upper[0], upper[0] + 1, upper[1], upper[0] + 1, upper[1] + 1 };
+				indices.insert(indices.end(), skirtTriangles, skirtTriangles + 6);
+			}
+		}
+	}
 	
 	const Voxels::VoxelGrid& m_Grid;
 
-	glm::vec3 m_MaxExtents;
-	std::vector<glm::vec3> m_BlockCounts;
+	Coord m_MaxExtents;
+	std::vector<Coord> m_BlockCounts;
 
 	const MaterialMap* m_Materials;
+	// the packed texture indices of every material id - resolved from m_Materials
+	// when the run begins
+	struct MaterialTextures
+	{
+		unsigned TI[2]; // without the blend
+		bool Mapped;
+	};
+	MaterialTextures m_MaterialTextures[MATERIALS_COUNT];
 
-	typedef std::vector<Block> BlocksVec;
-	// TODO: load and keep in memory only the needed blocks
-	BlocksVec m_LoadedBlocks;
+	const PolygonizationOptions& m_Options;
 
-	static __declspec(thread) GridBlocksCache* ts_BlocksCache;
-	typedef concurrency::concurrent_unordered_map<int, GridBlocksCache*> GridBlockMap;
-	GridBlockMap m_PerThreadCaches;
+	// TODO: load and keep in memory only the needed blocks
+	std::vector<BlocksVec>& m_LevelBlocks;
+	std::vector<unsigned> m_LevelTaskOffsets;
+	// the index in m_LevelBlocks[0] of every level 0 block in this run - empty when no crossings are recorded
+	std::vector<unsigned> m_Level0BlockIndices;
+	std::unique_ptr<TaskScheduler> m_Scheduler;
+	// the work done by the current call of Continue
+	std::atomic<unsigned> m_SliceTasks;
+	std::atomic<unsigned> m_SliceCells;
+	unsigned m_LevelsCount;
+
+	TaskExecutor& m_DefaultExecutor;
+	WorkerContextsVec& m_WorkerContexts;
 
 	ResultType* m_Result;
 
 	ModificationType* m_Modification;
+	const PolygonizationRegion* m_Region;
+	PolygonizationListener* m_Listener;
+	const std::atomic<bool>* m_Cancelled;
+	bool m_WasCancelled;
+	// the modified region merged with the one of a previously cancelled modification
+	float3 m_ModifiedMinCorner;
+	float3 m_ModifiedMaxCorner;
+};
+
+struct PolygonizerScratch : public TransVoxelRun::Scratch
+{};
+
+// Keeps a polygonization between its steps. It has its own scratch memory,
+// so that the Polygonizer can run other polygonizations in the meantime.
+class IncrementalPolygonization : public PolygonizationProgress
+{
+public:
+	IncrementalPolygonization(const Voxels::VoxelGrid& grid
+							, const MaterialMap* materials
+							, MapModification* modification
+							, const PolygonizationOptions& options
+							, TaskExecutor& defaultExecutor)
+		: m_Options(options)
+		, m_Cancelled(false)
+		, m_Run(grid, materials, modification, nullptr, m_Options, defaultExecutor, m_Scratch, nullptr, &m_Cancelled)
+		, m_Modification(modification)
+		, m_Result(nullptr)
+		, m_Completed(false)
+	{
+		m_Run.Begin();
+	}
+
+	virtual bool Continue(const PolygonizationBudget& budget) override
+	{
+		if (!m_Completed && m_Run.Continue(&budget)) {
+			m_Result = m_Run.Finish();
+			m_Completed = true;
+		}
+		return m_Completed;
+	}
+
+	virtual bool IsCompleted() const override
+	{
+		return m_Completed;
+	}
+
+	virtual PolygonSurface* GetSurface() const override
+	{
+		if (m_Completed)
+			return m_Result;
+		return m_Modification ? m_Modification->Map : nullptr;
+	}
+
+	virtual void Destroy() override
+	{
+		if (!m_Completed) {
+			m_Cancelled = true;
+			m_Run.Continue(nullptr);
+			m_Run.Finish();
+		}
+		delete this;
+	}
+
+private:
+	PolygonizationOptions m_Options;
+	TransVoxelRun::Scratch m_Scratch;
+	std::atomic<bool> m_Cancelled;
+	TransVoxelRun m_Run;
+	MapModification* m_Modification;
+	PolygonMap* m_Result;
+	bool m_Completed;
 };
 
-PolygonMap* TransVoxelImpl::Execute(const Voxels::VoxelGrid& grid, const MaterialMap* materials, Modification* modification)
+TransVoxelImpl::TransVoxelImpl()
+	: m_Scratch(new PolygonizerScratch)
+	, m_AsyncSequence(0)
+	, m_AsyncQuit(false)
+{}
+
+TransVoxelImpl::~TransVoxelImpl()
+{
+	if (m_AsyncThread.joinable()) {
+		{
+			// the pending requests still end, but cancelled
+			std::lock_guard<std::mutex> lock(m_AsyncLock);
+			std::for_each(m_AsyncQueue.begin(), m_AsyncQueue.end(), [](AsyncRequest* request) { request->Cancel(); });
+			m_AsyncQuit = true;
+		}
+		m_AsyncRequested.notify_all();
+		m_AsyncThread.join();
+	}
+}
+
+PolygonMap* TransVoxelImpl::Execute(const Voxels::VoxelGrid& grid, const MaterialMap* materials, Modification* modification, const PolygonizationRegion* region)
+{
+	return Run(grid, materials, modification, region, m_Options, nullptr, nullptr);
+}
+
+AsyncPolygonization* TransVoxelImpl::ExecuteAsync(const Voxels::VoxelGrid& grid
+												, const MaterialMap* materials
+												, Modification* modification
+												, PolygonizationListener* listener
+												, int priority)
+{
+	std::lock_guard<std::mutex> lock(m_AsyncLock);
+	auto request = new AsyncRequest(grid, materials, modification, listener, m_Options, priority, m_AsyncSequence++);
+	m_AsyncQueue.push_back(request);
+	if (!m_AsyncThread.joinable()) {
+		m_AsyncThread = std::thread(&TransVoxelImpl::AsyncLoop, this);
+	}
+	m_AsyncRequested.notify_one();
+
+	return request;
+}
+
+void TransVoxelImpl::AsyncLoop()
+{
+	for (;;) {
+		AsyncRequest* request = nullptr;
+		{
+			std::unique_lock<std::mutex> lock(m_AsyncLock);
+			m_AsyncRequested.wait(lock, [this] { return m_AsyncQuit || !m_AsyncQueue.empty(); });
+			if (m_AsyncQueue.empty())
+				return;
+
+			// the highest priority first and the oldest one among equals
+			auto next = std::min_element(m_AsyncQueue.begin(), m_AsyncQueue.end(), [](const AsyncRequest* lhs, const AsyncRequest* rhs) {
+				return lhs->Priority > rhs->Priority || (lhs->Priority == rhs->Priority && lhs->Sequence < rhs->Sequence);
+			});
+			request = *next;
+			m_AsyncQueue.erase(next);
+		}
+
+		bool wasCancelled = false;
+		auto result = Run(request->Grid, request->Materials, request->Modif, nullptr, request->Options, request->Listener, &request->Cancelled, &wasCancelled);
+		if (request->Listener) {
+			request->Listener->OnCompleted(result, wasCancelled);
+		}
+		request->Complete(result);
+	}
+}
+
+PolygonMap* TransVoxelImpl::Run(const Voxels::VoxelGrid& grid
+								, const MaterialMap* materials
+								, Modification* modification
+								, const PolygonizationRegion* region
+								, const PolygonizationOptions& options
+								, PolygonizationListener* listener
+								, const std::atomic<bool>* cancelled
+								, bool* wasCancelled)
+{
+	if (!CheckGridLimits(grid))
+		return nullptr;
+
+	std::lock_guard<std::mutex> lock(m_RunLock);
+	TransVoxelRun run(grid, materials, static_cast<MapModification*>(modification), region, options, m_WorkerPool, *m_Scratch, listener, cancelled);
+	
+	auto result = run.Execute();
+	if (wasCancelled) {
+		*wasCancelled = run.WasCancelled();
+	}
+
+	m_Scratch->Trim(options.MaxRetainedScratchBytes);
+
+	return result;
+}
+
+PolygonizationProgress* TransVoxelImpl::ExecuteIncremental(const Voxels::VoxelGrid& grid
+														, const MaterialMap* materials
+														, Modification* modification
+														, const PolygonizationBudget& budget)
+{
+	if (!CheckGridLimits(grid))
+		return nullptr;
+
+	auto progress = new IncrementalPolygonization(grid, materials, static_cast<MapModification*>(modification), m_Options, m_WorkerPool);
+	progress->Continue(budget);
+
+	return progress;
+}
+
+bool TransVoxelImpl::CheckGridLimits(const Voxels::VoxelGrid& grid)
 {
 #ifdef GRID_LIMIT
 	if (grid.GetWidth() > GRID_LIMIT
@@ -2159,20 +4694,17 @@ PolygonMap* TransVoxelImpl::Execute(const Voxels::VoxelGrid& grid, const Materia
 		char buffer[VOXELS_LOG_SIZE];
 		snprintf(buffer, VOXELS_LOG_SIZE, "Unable to polygonize grid. Grid extents are limited to %u in this version of the library.", GRID_LIMIT);
 		VOXLOG(LS_Error, buffer);
-		return nullptr;
+		return false;
 	}
+#else
+	(void)grid;
 #endif
-
-	TransVoxelRun run(grid, materials, static_cast<MapModification*>(modification));
-	
-	return run.Execute();
+	return true;
 }
 
 unsigned GetBlockExtent() {
 	return BLOCK_EXTENT;
 }
 
-__declspec(thread) TransVoxelRun::GridBlocksCache* TransVoxelRun::ts_BlocksCache = nullptr;
-
 }
 
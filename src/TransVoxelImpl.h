@@ -4,7 +4,13 @@
 #pragma once
 #include "VoxelGrid.h"
 
-#include "..\include\Polygonizer.h"
+#include "../include/Polygonizer.h"
+#include "WorkerPool.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 
 namespace Voxels
 {
@@ -29,10 +35,35 @@ typedef std::vector<PolygonVertex> VerticesVec;
 typedef std::vector<VerticesVec> TransitionVerticesVec;
 typedef std::vector<unsigned> IndicesVec;
 typedef std::vector<IndicesVec> TransitionIndicesVec;
+typedef std::vector<float3> PositionsVec;
+typedef std::vector<MaterialIndexRange> MaterialRangesVec;
+typedef std::vector<Meshlet> MeshletsVec;
+
+// Polygons of a block or of a transition face in the VF_Compact format
+struct CompactMesh
+{
+	CompactMesh();
+	CompactMesh(CompactMesh&& mesh);
+
+	CompactMesh& operator=(CompactMesh&& mesh);
+
+	size_t GetSizeBytes() const;
+
+	typedef std::vector<CompactPolygonVertex> VerticesVec;
+	typedef std::vector<unsigned short> IndicesVec;
+	typedef std::vector<CompactSecondaryPosition> SecondaryVec;
+
+	VerticesVec Vertices;
+	IndicesVec Indices;
+	SecondaryVec SecondaryPositions;
+};
+
+typedef std::vector<CompactMesh> TransitionCompactMeshesVec;
 
 struct PolygonBlock : public BlockPolygons
 {
 	PolygonBlock(unsigned id
+				, unsigned coordId
 				, const float3& min
 				, const float3& max);
 	PolygonBlock(PolygonBlock&& block);
@@ -40,14 +71,26 @@ struct PolygonBlock : public BlockPolygons
 	PolygonBlock& operator=(PolygonBlock&& block);
 	
 	unsigned Id;
+	unsigned CoordId; // the index of the block position in the level
+	unsigned long long ContentHash; // zero until a modification compares the block
 
 	VerticesVec Vertices;
 	IndicesVec Indices;
 	TransitionVerticesVec TransitionVertices;
 	TransitionIndicesVec TransitionIndices;
 
+	CompactMesh Compact;
+	TransitionCompactMeshesVec TransitionCompact;
+
+	PositionsVec Positions;
+
+	MaterialRangesVec MaterialRanges;
+	MeshletsVec Meshlets;
+
 	float3 MinimalCorner;
 	float3 MaximalCorner;
+	float3 PolygonsMinimalCorner;
+	float3 PolygonsMaximalCorner;
 
 	virtual unsigned GetId() const override;
 	virtual const PolygonVertex* GetVertices(unsigned* count) const override;
@@ -57,11 +100,25 @@ struct PolygonBlock : public BlockPolygons
 
 	virtual float3 GetMinimalCorner() const override;
 	virtual float3 GetMaximalCorner() const override;
+	virtual float3 GetPolygonsMinimalCorner() const override;
+	virtual float3 GetPolygonsMaximalCorner() const override;
+
+	virtual const CompactPolygonVertex* GetCompactVertices(unsigned* count) const override;
+	virtual const unsigned short* GetCompactIndices(unsigned* count) const override;
+	virtual const CompactSecondaryPosition* GetCompactSecondaryPositions(unsigned* count) const override;
+	virtual const CompactPolygonVertex* GetCompactTransitionVertices(TransitionFaceId face, unsigned* count) const override;
+	virtual const unsigned short* GetCompactTransitionIndices(TransitionFaceId face, unsigned* count) const override;
+	virtual const CompactSecondaryPosition* GetCompactTransitionSecondaryPositions(TransitionFaceId face, unsigned* count) const override;
+
+	virtual const float3* GetPositions(unsigned* count) const override;
+
+	virtual const MaterialIndexRange* GetMaterialRanges(unsigned* count) const override;
+	virtual const Meshlet* GetMeshlets(unsigned* count) const override;
 };
 
 typedef std::vector<PolygonBlock> PolygonBlocksVec;
 
-struct PolygonMap : public PolygonSurface
+struct PolygonMap final : public PolygonSurface
 {
 	PolygonMap();
 	PolygonMap(PolygonMap&& lhs);
@@ -71,25 +128,62 @@ struct PolygonMap : public PolygonSurface
 		LodLevel();
 		LodLevel(LodLevel&& l);
 		PolygonBlocksVec Blocks;
+		unsigned FirstBlockId; // the ID of the block at the first position of the level
+
+		enum BlockMode {
+			BM_Skipped = 0,
+			BM_CacheOnly, // polygonized only for the material caches of the coarser blocks
+			BM_Polygonized
+		};
+		// how each block was polygonized when the surface was created
+		std::vector<unsigned char> BlockModes;
+
+		static const unsigned NO_BLOCK = 0xFFFFFFFF;
+		// the index in Blocks of the block at each position or NO_BLOCK if it has no polygons
+		std::vector<unsigned> BlockIndices;
+
+		void RemoveBlock(unsigned coordId);
 	};
 
 	typedef std::vector<LodLevel> LodLevels;
 	LodLevels Levels;
 
 	float3 Extents; // width, height, depth
+	VertexFormat Format;
+	MeshingMethod Method;
 
 	struct MaterialCache
 	{
 		MaterialCache();
 		MaterialCache(MaterialCache&& m);
 
-		typedef std::vector<bool> ConsistencyVec;
+		// the local ids of the level 0 cells that have a surface, sorted for each block
+		typedef std::vector<unsigned short> ConsistencyVec;
 		std::vector<ConsistencyVec> Level0ConsistencyCache;
 
-		typedef std::vector<MaterialInfo> CellMaterialVec;
+		// whether each level 0 block was skipped as empty along with its neighbors
+		std::vector<unsigned char> Level0EmptyBlocks;
+
+		// the materials of the coarse cells that have a surface, sorted by local id for each block.
+		// Blocks without a surface take no memory.
+		struct CellMaterial
+		{
+			unsigned short LocalId;
+			MaterialInfo Material;
+		};
+		typedef std::vector<CellMaterial> CellMaterialVec;
 		typedef std::vector<CellMaterialVec> BlockMaterialVec;
 		typedef std::vector<BlockMaterialVec> LevelMaterialVec;
 		LevelMaterialVec LevelMaterialCache;
+
+		bool HasLevel0Surface(unsigned blockCoordId, unsigned localId) const;
+		MaterialInfo GetCellMaterial(unsigned level, unsigned blockCoordId, unsigned localId) const;
+		void SetCellMaterial(unsigned level, unsigned blockCoordId, unsigned localId, const MaterialInfo& material);
+
+		// Drops the cells of a block before it is polygonized again
+		void ClearBlock(unsigned level, unsigned blockCoordId);
+		// Sorts the cells of a polygonized block and releases the spare memory
+		void CompactBlock(unsigned level, unsigned blockCoordId);
 	};
 
 	MaterialCache Cache;
@@ -106,7 +200,11 @@ struct PolygonMap : public PolygonSurface
 			TrivialCells += rhs.TrivialCells;
 			NonTrivialCells += rhs.NonTrivialCells;
 			DegenerateTrianglesRemoved += rhs.DegenerateTrianglesRemoved;
-			for (auto i = 0; i < CASES_COUNT; ++i) {
+			CacheOptimizedTriangles += rhs.CacheOptimizedTriangles;
+			VertexCacheMissesBefore += rhs.VertexCacheMissesBefore;
+			VertexCacheMissesAfter += rhs.VertexCacheMissesAfter;
+			SimplificationTrianglesRemoved += rhs.SimplificationTrianglesRemoved;
+			for (auto i = 0u; i < CASES_COUNT; ++i) {
 				PerCaseCellsCount[i] += rhs.PerCaseCellsCount[i];
 			}
 
@@ -115,19 +213,26 @@ struct PolygonMap : public PolygonSurface
 	};
 
 	Statistics Stats;
-	unsigned GetNextBlockId();
+	unsigned GetBlockId(unsigned level, unsigned coordId) const;
+
+	// the region of a cancelled modification - in grid coordinates
+	bool HasPendingModification;
+	float3 PendingMinCorner;
+	float3 PendingMaxCorner;
+
+	void AddPendingModification(const float3& minCorner, const float3& maxCorner);
 
 	virtual float3 GetExtents() const override;
 	virtual unsigned GetLevelsCount() const override;
 	virtual unsigned GetBlocksForLevelCount(unsigned level) const override;
 	virtual const BlockPolygons* GetBlockForLevel(unsigned level, unsigned id) const override;
+	virtual const BlockPolygons* GetBlockById(unsigned id) const override;
 	virtual const PolygonizationStatistics* GetStatistics() const override;
 	virtual void Destroy() override;
 	virtual unsigned GetCacheSizeBytes() const override;
 	virtual unsigned GetPolygonDataSizeBytes() const override;
+	virtual VertexFormat GetVertexFormat() const override;
 private:
-	unsigned m_NextId;
-
 	PolygonMap(const PolygonMap&);
 	PolygonMap& operator=(const PolygonMap&);
 };
@@ -135,22 +240,105 @@ private:
 struct MapModification : public Modification
 {
 	virtual const unsigned* GetModifiedBlocks(unsigned* count) const override;
+	virtual const unsigned* GetBlocks(BlockChange change, unsigned* count) const override;
 	virtual void Destroy() override;
 
 	typedef std::vector<unsigned> BlockIds;
 	BlockIds ModifiedBlocks;
+	BlockIds Changes[BC_Count];
 };
 
+class AsyncRequest : public AsyncPolygonization
+{
+public:
+	AsyncRequest(const Voxels::VoxelGrid& grid
+				, const MaterialMap* materials
+				, Modification* modification
+				, PolygonizationListener* listener
+				, const PolygonizationOptions& options
+				, int priority
+				, unsigned sequence);
+
+	virtual void Cancel() override;
+	virtual bool IsCompleted() const override;
+	virtual PolygonSurface* Wait() override;
+	virtual void Destroy() override;
+
+	void Complete(PolygonSurface* result);
+
+	const Voxels::VoxelGrid& Grid;
+	const MaterialMap* Materials;
+	Modification* Modif;
+	PolygonizationListener* Listener;
+	PolygonizationOptions Options;
+	int Priority;
+	unsigned Sequence;
+	std::atomic<bool> Cancelled;
+
+private:
+	mutable std::mutex m_Lock;
+	std::condition_variable m_CompletedCondition;
+	bool m_Completed;
+	PolygonSurface* m_Result;
+};
+
+struct PolygonizerScratch;
+
 class TransVoxelImpl
 {
 public:
 	TransVoxelImpl();
+	~TransVoxelImpl();
 	
 	PolygonMap* Execute(const Voxels::VoxelGrid& grid
 									  , const MaterialMap* materials
-									  , Modification* modification = nullptr);
+									  , Modification* modification = nullptr
+									  , const PolygonizationRegion* region = nullptr);
+
+	AsyncPolygonization* ExecuteAsync(const Voxels::VoxelGrid& grid
+									  , const MaterialMap* materials
+									  , Modification* modification
+									  , PolygonizationListener* listener
+									  , int priority);
+
+	PolygonizationProgress* ExecuteIncremental(const Voxels::VoxelGrid& grid
+									  , const MaterialMap* materials
+									  , Modification* modification
+									  , const PolygonizationBudget& budget);
+
+	void SetOptions(const PolygonizationOptions& options);
+	const PolygonizationOptions& GetOptions() const;
 
 	static unsigned GetBlockExtent();
+
+private:
+	PolygonMap* Run(const Voxels::VoxelGrid& grid
+					, const MaterialMap* materials
+					, Modification* modification
+					, const PolygonizationRegion* region
+					, const PolygonizationOptions& options
+					, PolygonizationListener* listener
+					, const std::atomic<bool>* cancelled
+					, bool* wasCancelled = nullptr);
+
+	void AsyncLoop();
+
+	static bool CheckGridLimits(const Voxels::VoxelGrid& grid);
+
+	PolygonizationOptions m_Options;
+	WorkerPool m_WorkerPool;
+	std::unique_ptr<PolygonizerScratch> m_Scratch;
+
+	// only one polygonization at a time uses the scratch memory
+	std::mutex m_RunLock;
+
+	// the pending asynchronous polygonizations
+	std::mutex m_AsyncLock;
+	std::condition_variable m_AsyncRequested;
+	std::vector<AsyncRequest*> m_AsyncQueue;
+	unsigned m_AsyncSequence;
+	bool m_AsyncQuit;
+	std::thread m_AsyncThread;
 };
 
 }
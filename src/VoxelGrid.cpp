@@ -5,7 +5,7 @@
 
 #include "VoxelGrid.h"
 #include "../include/VoxelSurface.h"
-#include <../dx11-framework/Utilities/MathInlines.h>
+#include "MathInlines.h"
 
 #define SETFLAG(Flag, Bit) ((Flag) |= (Bit))
 #define UNSETFLAG(Flag, Bit) ((Flag) &= ~(Bit))
@@ -13,7 +13,7 @@
 namespace Voxels
 {
 
-struct PackedGridImpl : public Grid::PackedGrid
+struct PackedGridImpl final : public Grid::PackedGrid
 {
 	virtual void Destroy() override
 	{
@@ -89,7 +89,6 @@ VoxelGrid::VoxelGrid(unsigned w, unsigned d, unsigned h,
 	// Create per-block data
 	auto blocksX = m_Width / BLOCK_EXTENTS;
 	auto blocksY = m_Depth / BLOCK_EXTENTS;
-	auto blocksZ = m_Height / BLOCK_EXTENTS;
 
 	const auto valuesCnt = BLOCK_EXTENTS*BLOCK_EXTENTS*BLOCK_EXTENTS;
 	std::vector<char> blockData(valuesCnt);
@@ -120,7 +119,7 @@ VoxelGrid::VoxelGrid(unsigned w, unsigned d, unsigned h,
 			&materialData[0],
 			&blendData[0]);
 
-		for (auto id = 0; id < BLOCK_EXTENTS*BLOCK_EXTENTS*BLOCK_EXTENTS; ++id)
+		for (auto id = 0u; id < BLOCK_EXTENTS*BLOCK_EXTENTS*BLOCK_EXTENTS; ++id)
 		{
 			blockData.push_back(toGridDistValue(round(surfaceValues[id])));
 		}
@@ -141,7 +140,6 @@ VoxelGrid::VoxelGrid(unsigned w, unsigned d, unsigned h)
 	// Create per-block data
 	auto blocksX = m_Width / BLOCK_EXTENTS;
 	auto blocksY = m_Depth / BLOCK_EXTENTS;
-	auto blocksZ = m_Height / BLOCK_EXTENTS;
 
 	unsigned blockId = 0;
 	for (unsigned blZ = 0u; blZ < blocksY; ++blZ)
@@ -166,7 +164,6 @@ VoxelGrid::VoxelGrid(unsigned w, const char* heightmap)
 	// Create per-block data
 	auto blocksX = m_Width / BLOCK_EXTENTS;
 	auto blocksY = m_Depth / BLOCK_EXTENTS;
-	auto blocksZ = m_Height / BLOCK_EXTENTS;
 
 	std::vector<char> blockData;
 	std::vector<unsigned char> materialData;
@@ -279,7 +276,8 @@ Grid::PackedGrid* VoxelGrid::PackForSave() const
 		offset += size;
 	};
 
-	write(&CURRENT_FILE_VER, sizeof(CURRENT_FILE_VER));
+	const auto version = CURRENT_FILE_VER;
+	write(&version, sizeof(version));
 	const auto w = GetWidth();
 	const auto d = GetDepth();
 	const auto h = GetHeight();
@@ -335,7 +333,6 @@ void VoxelGrid::IdentifyTouchedBlocks(const glm::vec3& position, const glm::vec3
 
 	const auto blocksX = m_Width / BLOCK_EXTENTS;
 	const auto blocksY = m_Depth / BLOCK_EXTENTS;
-	const auto blocksZ = m_Height / BLOCK_EXTENTS;
 	const auto blockExtDiv2 = float(BLOCK_EXTENTS >> 1);
 	
 	glm::vec3 blockExtents(blockExtDiv2);
@@ -357,7 +354,7 @@ void VoxelGrid::IdentifyTouchedBlocks(const glm::vec3& position, const glm::vec3
 			const glm::vec3 blockBase(float(blX * BLOCK_EXTENTS),
 										float(blY * BLOCK_EXTENTS),
 										float(blZ * BLOCK_EXTENTS));
-			BlockExtents blockExt = std::make_pair(blockBase, blockBase + glm::vec3((const float)BLOCK_EXTENTS));
+			BlockExtents blockExt = std::make_pair(blockBase, blockBase + glm::vec3(float(BLOCK_EXTENTS)));
 			touchedBlocks.push_back(std::make_pair(blockId, blockExt));
 		}
 
@@ -583,7 +580,7 @@ std::pair<glm::vec3, glm::vec3> VoxelGrid::InjectMaterial(
 	return std::make_pair(globalStart, globalEnd);
 }
 
-void VoxelGrid::GetBlockData(const glm::vec3& blockCoords, char* output) const
+void VoxelGrid::GetBlockData(const glm::ivec3& blockCoords, char* output) const
 {
 	const auto id = CalculateInternalBlockId(blockCoords);
 	const Block& block = m_Blocks[id];
@@ -591,7 +588,7 @@ void VoxelGrid::GetBlockData(const glm::vec3& blockCoords, char* output) const
 	DecompressBlock<char>(&block.DistanceData[0], block.DistanceData.size(), !!(block.Flags & BF_DistanceUncompressed), output);
 }
 
-void VoxelGrid::GetMaterialBlockData(const glm::vec3& blockCoords, unsigned char* materialOutput, unsigned char* blendOutput) const
+void VoxelGrid::GetMaterialBlockData(const glm::ivec3& blockCoords, unsigned char* materialOutput, unsigned char* blendOutput) const
 {
 	const auto id = CalculateInternalBlockId(blockCoords);
 	const Block& matBlock = m_Blocks[id];
@@ -601,7 +598,7 @@ void VoxelGrid::GetMaterialBlockData(const glm::vec3& blockCoords, unsigned char
 	DecompressBlock<unsigned char>(&matBlock.BlendData[0], matBlock.BlendData.size(), !!(matBlock.Flags & BF_BlendUncompressed), blendOutput);
 }
 
-bool VoxelGrid::IsBlockEmpty(const glm::vec3& blockCoords) const
+bool VoxelGrid::IsBlockEmpty(const glm::ivec3& blockCoords) const
 {
 	const auto id = CalculateInternalBlockId(blockCoords);
 	return !!(m_Blocks[id].Flags & BF_Empty);
@@ -678,7 +675,6 @@ void VoxelGrid::DecompressBlock(const Type* data, unsigned sz, bool isUncompress
 		unsigned char length = 0;
 		Type value = 0;
 
-		Type* outPtr = output;
 		for (auto id = 0u; id < sz; id += 2)
 		{
 			length = reinterpret_cast<const unsigned char*>(data)[id];
@@ -693,7 +689,7 @@ void VoxelGrid::DecompressBlock(const Type* data, unsigned sz, bool isUncompress
 	}
 }
 
-void VoxelGrid::ModifyBlockDistanceData(const glm::vec3& coords, const char* distances)
+void VoxelGrid::ModifyBlockDistanceData(const glm::ivec3& coords, const char* distances)
 {
 	const auto id = CalculateInternalBlockId(coords);
 	Block& block = m_Blocks[id];
@@ -715,7 +711,7 @@ void VoxelGrid::ModifyBlockDistanceData(const glm::vec3& coords, const char* dis
 	}
 }
 
-void VoxelGrid::ModifyBlockMaterialData(const glm::vec3& coords, const MaterialId* materials, const BlendFactor* blends)
+void VoxelGrid::ModifyBlockMaterialData(const glm::ivec3& coords, const MaterialId* materials, const BlendFactor* blends)
 {
 	const auto id = CalculateInternalBlockId(coords);
 	Block& block = m_Blocks[id];
@@ -800,7 +796,7 @@ Grid* Grid::Create(unsigned w, const char* heightmap)
 	return new Grid(impl.release());
 }
 
-Grid* Grid::Load(const char* blob, unsigned size)
+Grid* Grid::Load(const char* blob, unsigned)
 {
 	return new Grid(VoxelGrid::Load(blob));
 }
@@ -884,27 +880,27 @@ unsigned Grid::GetBlockExtent() const
 
 bool Grid::GetBlockDistanceData(const float3& coords, char* output) const
 {
-	const auto internalCoords = glm::vec3(coords.x, coords.y, coords.z);
+	const auto internalCoords = glm::ivec3(int(coords.x), int(coords.y), int(coords.z));
 	m_InternalGrid->GetBlockData(internalCoords, output);
 	return true;
 }
 
 void Grid::ModifyBlockDistanceData(const float3& coords, const char* distances)
 {
-	const auto internalCoords = glm::vec3(coords.x, coords.y, coords.z);
+	const auto internalCoords = glm::ivec3(int(coords.x), int(coords.y), int(coords.z));
 	m_InternalGrid->ModifyBlockDistanceData(internalCoords, distances);
 }
 
 bool Grid::GetBlockMaterialData(const float3& coords, MaterialId* materials, BlendFactor* blends) const
 {
-	const auto internalCoords = glm::vec3(coords.x, coords.y, coords.z);
+	const auto internalCoords = glm::ivec3(int(coords.x), int(coords.y), int(coords.z));
 	m_InternalGrid->GetMaterialBlockData(internalCoords, materials, blends);
 	return true;
 }
 
 void Grid::ModifyBlockMaterialData(const float3& coords, const MaterialId* materials, const BlendFactor* blends)
 {
-	const auto internalCoords = glm::vec3(coords.x, coords.y, coords.z);
+	const auto internalCoords = glm::ivec3(int(coords.x), int(coords.y), int(coords.z));
 	m_InternalGrid->ModifyBlockMaterialData(internalCoords, materials, blends);
 }
 
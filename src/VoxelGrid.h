@@ -5,6 +5,13 @@
 
 #include "../include/Grid.h"
 
+// The grid is stored and polygonized in cubic blocks of 2^VOXELS_BLOCK_EXTENT_POWER voxels per side.
+// Smaller blocks make modifications cheaper, larger ones lower the per-block overhead of static grids.
+// Grids saved with one block extent can't be loaded with another.
+#ifndef VOXELS_BLOCK_EXTENT_POWER
+#define VOXELS_BLOCK_EXTENT_POWER 4
+#endif
+
 namespace Voxels
 {
 class VoxelSurface;
@@ -46,20 +53,22 @@ public:
 												MaterialId material,
 												bool addSubtractBlend);
 
-	void GetBlockData(const glm::vec3& blockCoords, char* output) const;
-	void GetMaterialBlockData(const glm::vec3& blockCoords, unsigned char* materialOutput, unsigned char* blendOutput) const;
-	bool IsBlockEmpty(const glm::vec3& blockCoords) const;
+	void GetBlockData(const glm::ivec3& blockCoords, char* output) const;
+	void GetMaterialBlockData(const glm::ivec3& blockCoords, unsigned char* materialOutput, unsigned char* blendOutput) const;
+	bool IsBlockEmpty(const glm::ivec3& blockCoords) const;
 
-	inline unsigned CalculateInternalBlockId(const glm::vec3& blockCoords) const;
+	inline unsigned CalculateInternalBlockId(const glm::ivec3& blockCoords) const;
 
-	inline glm::vec3 GetBlocksCount() const;
+	inline glm::ivec3 GetBlocksCount() const;
 
-	void ModifyBlockDistanceData(const glm::vec3& coords, const char* distances);
-	void ModifyBlockMaterialData(const glm::vec3& coords, const MaterialId* materials, const BlendFactor* blends);
+	void ModifyBlockDistanceData(const glm::ivec3& coords, const char* distances);
+	void ModifyBlockMaterialData(const glm::ivec3& coords, const MaterialId* materials, const BlendFactor* blends);
 
 	inline size_t MemoryForGrid() const;
 
-	static const unsigned BLOCK_EXTENTS = 16u;
+	static const unsigned BLOCK_EXTENTS_POWER = VOXELS_BLOCK_EXTENT_POWER;
+	static const unsigned BLOCK_EXTENTS = 1u << BLOCK_EXTENTS_POWER;
+	static_assert(BLOCK_EXTENTS >= 8 && BLOCK_EXTENTS <= 32, "The supported block extents are 8, 16 and 32 voxels");
 
 private:
 	typedef char value_type;
@@ -133,19 +142,20 @@ private:
 	VoxelGrid(const VoxelGrid&);
 	VoxelGrid& operator=(const VoxelGrid&);
 
-	static const unsigned CURRENT_FILE_VER = 1;
+	// the layout of the blocks depends on their extent
+	static const unsigned CURRENT_FILE_VER = 1 + (BLOCK_EXTENTS_POWER == 4 ? 0 : (BLOCK_EXTENTS_POWER << 16));
 };
 
-unsigned VoxelGrid::CalculateInternalBlockId(const glm::vec3& blockCoords) const
+unsigned VoxelGrid::CalculateInternalBlockId(const glm::ivec3& blockCoords) const
 {
 	return unsigned(blockCoords.x
 				+ blockCoords.y * (GetWidth() / BLOCK_EXTENTS)
 				+ blockCoords.z * (GetWidth() / BLOCK_EXTENTS) * (GetHeight() / BLOCK_EXTENTS));
 }
 
-glm::vec3 VoxelGrid::GetBlocksCount() const
+glm::ivec3 VoxelGrid::GetBlocksCount() const
 {
-	return glm::vec3(m_Width / BLOCK_EXTENTS,
+	return glm::ivec3(m_Width / BLOCK_EXTENTS,
 							 m_Depth / BLOCK_EXTENTS,
 							 m_Height / BLOCK_EXTENTS);
 }
@@ -19,12 +19,24 @@ void DefaultDeallocate(void* ptr)
 
 void* DefaultAllocateAligned(size_t size, size_t alignment)
 {
+#ifdef _WIN32
 	return _aligned_malloc(size, alignment);
+#else
+	void* ptr = nullptr;
+	if (posix_memalign(&ptr, std::max(alignment, sizeof(void*)), size)) {
+		return nullptr;
+	}
+	return ptr;
+#endif
 }
 
 void DefaultDeallocateAligned(void* ptr)
 {
+#ifdef _WIN32
 	_aligned_free(ptr);
+#else
+	free(ptr);
+#endif
 }
 
 Voxels::VoxelsAllocate_f voxel_allocate = &DefaultAllocate;
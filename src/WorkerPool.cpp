@@ -0,0 +1,88 @@
+// Copyright (c) 2013-2016, Stoyan Nikolov
+// All rights reserved.
+// Voxels Library, please see LICENSE for licensing details.
+#include "stdafx.h"
+#include "WorkerPool.h"
+
+namespace Voxels
+{
+
+WorkerPool::WorkerPool()
+	: m_RunId(0)
+	, m_WorkersCount(0)
+	, m_PendingWorkers(0)
+	, m_Function(nullptr)
+	, m_Context(nullptr)
+	, m_Quit(false)
+{}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Lock);
+		m_Quit = true;
+	}
+	m_RunStarted.notify_all();
+
+	std::for_each(m_Threads.begin(), m_Threads.end(), [](std::thread& thread) { thread.join(); });
+}
+
+void WorkerPool::Run(unsigned workersCount, WorkerFunction function, void* context)
+{
+	if (workersCount <= 1) {
+		if (workersCount) {
+			function(context, 0);
+		}
+		return;
+	}
+
+	std::lock_guard<std::mutex> runLock(m_RunLock);
+	{
+		std::lock_guard<std::mutex> lock(m_Lock);
+		// new threads get the id of the previous run, so they take part in this one
+		while (m_Threads.size() < workersCount - 1) {
+			m_Threads.emplace_back(&WorkerPool::ThreadLoop, this, unsigned(m_Threads.size() + 1), m_RunId);
+		}
+
+		m_Function = function;
+		m_Context = context;
+		m_WorkersCount = workersCount;
+		m_PendingWorkers = workersCount - 1;
+		++m_RunId;
+	}
+	m_RunStarted.notify_all();
+
+	function(context, 0);
+
+	std::unique_lock<std::mutex> lock(m_Lock);
+	m_RunCompleted.wait(lock, [this] { return m_PendingWorkers == 0; });
+	m_Function = nullptr;
+	m_Context = nullptr;
+}
+
+void WorkerPool::ThreadLoop(unsigned workerIndex, unsigned runId)
+{
+	std::unique_lock<std::mutex> lock(m_Lock);
+	for (;;) {
+		m_RunStarted.wait(lock, [this, runId] { return m_Quit || m_RunId != runId; });
+		if (m_Quit)
+			return;
+
+		runId = m_RunId;
+		if (workerIndex >= m_WorkersCount)
+			continue;
+
+		const auto function = m_Function;
+		const auto context = m_Context;
+		lock.unlock();
+
+		function(context, workerIndex);
+
+		lock.lock();
+		if (--m_PendingWorkers == 0) {
+			m_RunCompleted.notify_one();
+		}
+	}
+}
+
+}
@@ -0,0 +1,49 @@
+// Copyright (c) 2013-2016, Stoyan Nikolov
+// All rights reserved.
+// Voxels Library, please see LICENSE for licensing details.
+#pragma once
+
+#include "../include/TaskExecutor.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace Voxels
+{
+
+// The default executor of the polygonization. The calling thread runs
+// worker 0 and the rest of the workers run on threads owned by the pool.
+// Threads are created when a run needs more of them and are kept waiting
+// for the next run until the pool is destroyed.
+class WorkerPool : public TaskExecutor
+{
+public:
+	WorkerPool();
+	virtual ~WorkerPool();
+
+	virtual void Run(unsigned workersCount, WorkerFunction function, void* context) override;
+
+private:
+	WorkerPool(const WorkerPool&);
+	WorkerPool& operator=(const WorkerPool&);
+
+	void ThreadLoop(unsigned workerIndex, unsigned runId);
+
+	std::vector<std::thread> m_Threads;
+
+	// serializes runs started on different threads
+	std::mutex m_RunLock;
+
+	std::mutex m_Lock;
+	std::condition_variable m_RunStarted;
+	std::condition_variable m_RunCompleted;
+	unsigned m_RunId;
+	unsigned m_WorkersCount;
+	unsigned m_PendingWorkers;
+	WorkerFunction m_Function;
+	void* m_Context;
+	bool m_Quit;
+};
+
+}
@@ -3,9 +3,15 @@
 // Voxels Library, please see LICENSE for licensing details.
 #pragma once
 
+#ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 #define NOMINMAX
 #include <Windows.h>
+#else
+#include <cstdlib>
+#include <cstring>
+#include <cassert>
+#endif
 
 #include <utility>
 #include <memory>
@@ -17,12 +23,33 @@
 #define snprintf _snprintf
 #endif
 
+#ifndef _countof
+#define _countof(arr) (sizeof(arr) / sizeof(arr[0]))
+#endif
+
 #define VOXELS_LOG_SIZE 512
 
+// GLM is third party code - keep its warnings out of our GCC/Clang builds
+#ifdef __GNUC__
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wstrict-aliasing"
+#pragma GCC diagnostic ignored "-Wparentheses"
+#endif
 #include <glm/glm.hpp>
+#ifdef __GNUC__
+#pragma GCC diagnostic pop
+#endif
 
+// Profi is needed only by the builds that profile the library
+#ifdef PROFI_ENABLE
 #include <profi_decls.h>
 #include <profi.h>
+#else
+#define PROFI_FUNC
+#define PROFI_SCOPE(name)
+#define PROFI_SCOPE_S2(name)
+#define PROFI_SCOPE_S3(name)
+#endif
 #include "../include/Declarations.h"
 #include "../include/Library.h"
 
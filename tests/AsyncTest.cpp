@@ -0,0 +1,130 @@
+// Copyright (c) 2013-2016, Stoyan Nikolov
+// All rights reserved.
+// Voxels Library, please see LICENSE for licensing details.
+
+// Runs asynchronous polygonizations, compares them with the synchronous
+// ones and checks that a cancelled modification leaves a valid surface.
+
+#include "TestCommon.h"
+
+#include <mutex>
+
+using namespace VoxelsTests;
+
+namespace
+{
+
+class RecordingListener : public PolygonizationListener
+{
+public:
+	RecordingListener()
+		: CompletedCount(0)
+		, Surface(nullptr)
+		, Cancelled(false)
+	{}
+
+	virtual void OnBlockPolygonized(unsigned level, const BlockPolygons* block) override
+	{
+		Hasher hasher;
+		const auto counts = AddBlock(block, hasher);
+		std::lock_guard<std::mutex> lock(Mutex);
+		if (counts.Indices) {
+			Blocks[BlockKey(level, block->GetMinimalCorner())] = hasher.GetHash();
+		}
+	}
+
+	virtual void OnCompleted(PolygonSurface* surface, bool cancelled) override
+	{
+		std::lock_guard<std::mutex> lock(Mutex);
+		++CompletedCount;
+		Surface = surface;
+		Cancelled = cancelled;
+	}
+
+	std::mutex Mutex;
+	BlockHashes Blocks;
+	unsigned CompletedCount;
+	PolygonSurface* Surface;
+	bool Cancelled;
+};
+
+void CheckCompleted()
+{
+	auto grid = CreateTerrainGrid(64);
+	TestMaterialMap materials;
+	Polygonizer polygonizer;
+	auto expected = polygonizer.Execute(*grid, &materials);
+
+	RecordingListener listener;
+	auto async = polygonizer.ExecuteAsync(*grid, &materials, nullptr, &listener);
+	auto surface = async->Wait();
+	VOXELS_CHECK(async->IsCompleted());
+	async->Destroy();
+
+	VOXELS_CHECK(listener.CompletedCount == 1);
+	VOXELS_CHECK(listener.Surface == surface && !listener.Cancelled);
+	VOXELS_CHECK(SummarizeSurface(surface) == SummarizeSurface(expected));
+	// the listener gets the same polygons as the surface
+	VOXELS_CHECK(listener.Blocks == HashBlocks(surface));
+
+	surface->Destroy();
+	expected->Destroy();
+	grid->Destroy();
+}
+
+void CheckCancelled()
+{
+	auto grid = CreateTerrainGrid(128);
+	TestMaterialMap materials;
+	Polygonizer polygonizer;
+
+	// the run might complete before it is cancelled
+	RecordingListener listener;
+	auto async = polygonizer.ExecuteAsync(*grid, &materials, nullptr, &listener);
+	async->Cancel();
+	auto surface = async->Wait();
+	async->Destroy();
+	VOXELS_CHECK(listener.CompletedCount == 1);
+	VOXELS_CHECK(listener.Surface == surface && listener.Cancelled == !surface);
+	if (surface) {
+		surface->Destroy();
+	}
+
+	surface = polygonizer.Execute(*grid, &materials);
+	auto modification = Modification::Create();
+	modification->Map = surface;
+	DigSphere(grid, modification);
+	RecordingListener modificationListener;
+	async = polygonizer.ExecuteAsync(*grid, &materials, modification, &modificationListener);
+	async->Cancel();
+	VOXELS_CHECK(async->Wait() == surface);
+	async->Destroy();
+	VOXELS_CHECK(modificationListener.CompletedCount == 1 && modificationListener.Surface == surface);
+	modification->Destroy();
+
+	// the next modification polygonizes again what the cancelled one didn't
+	modification = Modification::Create();
+	modification->Map = surface;
+	modification->MinCornerModified = float3(0.f, 0.f, 0.f);
+	modification->MaxCornerModified = float3(1.f, 1.f, 1.f);
+	polygonizer.Execute(*grid, &materials, modification);
+	auto expected = polygonizer.Execute(*grid, &materials);
+	VOXELS_CHECK(HashBlocks(surface) == HashBlocks(expected));
+
+	modification->Destroy();
+	expected->Destroy();
+	surface->Destroy();
+	grid->Destroy();
+}
+
+}
+
+int main()
+{
+	LibraryScope library;
+
+	CheckCompleted();
+	CheckCancelled();
+
+	return TestResult();
+}
@@ -0,0 +1,109 @@
+// Copyright (c) 2013-2016, Stoyan Nikolov
+// All rights reserved.
+// Voxels Library, please see LICENSE for licensing details.
+
+// Checks the changes of the blocks reported by the modifications and that
+// the blocks keep their ids.
+
+#include "TestCommon.h"
+
+using namespace VoxelsTests;
+
+namespace
+{
+
+typedef std::map<unsigned, std::string> BlockIds;
+
+BlockIds CollectIds(const PolygonSurface* surface)
+{
+	BlockIds ids;
+	for (unsigned level = 0; level < surface->GetLevelsCount(); ++level) {
+		const auto blocksCount = surface->GetBlocksForLevelCount(level);
+		for (unsigned blockId = 0; blockId < blocksCount; ++blockId) {
+			const auto block = surface->GetBlockForLevel(level, blockId);
+			ids[block->GetId()] = BlockKey(level, block->GetMinimalCorner());
+		}
+	}
+	return ids;
+}
+
+unsigned GetChangedCount(const Modification* modification, BlockChange change)
+{
+	unsigned count = 0;
+	modification->GetBlocks(change, &count);
+	return count;
+}
+
+void CheckChanges(VertexFormat format)
+{
+	auto grid = CreateTerrainGrid(64);
+	TestMaterialMap materials;
+	Polygonizer polygonizer;
+	PolygonizationOptions options;
+	options.OutputFormat = format;
+	polygonizer.SetOptions(options);
+	auto surface = polygonizer.Execute(*grid, &materials);
+	const auto blocksCount = unsigned(CollectIds(surface).size());
+
+	// nothing changed in the grid, so no block has changed either
+	auto modification = Modification::Create();
+	modification->Map = surface;
+	modification->MinCornerModified = float3(0.f, 0.f, 0.f);
+	modification->MaxCornerModified = float3(64.f, 64.f, 64.f);
+	polygonizer.Execute(*grid, &materials, modification);
+	VOXELS_CHECK(GetChangedCount(modification, BC_Unchanged) == blocksCount);
+	VOXELS_CHECK(GetChangedCount(modification, BC_Added) == 0);
+	VOXELS_CHECK(GetChangedCount(modification, BC_Removed) == 0);
+	VOXELS_CHECK(GetChangedCount(modification, BC_Changed) == 0);
+	unsigned modifiedCount = 0;
+	modification->GetModifiedBlocks(&modifiedCount);
+	VOXELS_CHECK(modifiedCount == 0);
+	modification->Destroy();
+
+	const auto ids = CollectIds(surface);
+	modification = Modification::Create();
+	modification->Map = surface;
+	DigSphere(grid, modification);
+	polygonizer.Execute(*grid, &materials, modification);
+
+	// the blocks that are still there keep their ids
+	const auto modifiedIds = CollectIds(surface);
+	unsigned removedCount = 0;
+	const auto removed = modification->GetBlocks(BC_Removed, &removedCount);
+	for (unsigned i = 0; i < removedCount; ++i) {
+		VOXELS_CHECK(ids.count(removed[i]) == 1 && modifiedIds.count(removed[i]) == 0);
+	}
+	unsigned addedCount = 0;
+	const auto added = modification->GetBlocks(BC_Added, &addedCount);
+	for (unsigned i = 0; i < addedCount; ++i) {
+		VOXELS_CHECK(ids.count(added[i]) == 0 && modifiedIds.count(added[i]) == 1);
+	}
+	for (auto id = modifiedIds.cbegin(); id != modifiedIds.cend(); ++id) {
+		const auto oldId = ids.find(id->first);
+		VOXELS_CHECK(oldId == ids.cend() || oldId->second == id->second);
+		VOXELS_CHECK(surface->GetBlockById(id->first)->GetId() == id->first);
+	}
+
+	const auto changedCount = GetChangedCount(modification, BC_Changed);
+	VOXELS_CHECK(changedCount > 0);
+	modification->GetModifiedBlocks(&modifiedCount);
+	VOXELS_CHECK(modifiedCount == addedCount + changedCount);
+	VOXELS_CHECK(addedCount + removedCount + changedCount + GetChangedCount(modification, BC_Unchanged) <= surface->GetStatistics()->BlocksCalculated);
+	modification->Destroy();
+
+	surface->Destroy();
+	grid->Destroy();
+}
+
+}
+
+int main()
+{
+	LibraryScope library;
+
+	CheckChanges(VF_Full);
+	CheckChanges(VF_Compact);
+	CheckChanges(VF_Collision);
+
+	return TestResult();
+}
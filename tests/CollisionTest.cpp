@@ -0,0 +1,149 @@
+// Copyright (c) 2013-2016, Stoyan Nikolov
+// All rights reserved.
+// Voxels Library, please see LICENSE for licensing details.
+
+// Polygonizes a grid with VF_Collision and checks that the blocks have only
+// welded positions and the same triangles as level 0 of the full format.
+
+#include "TestCommon.h"
+
+#include <set>
+
+using namespace VoxelsTests;
+
+namespace
+{
+
+typedef std::vector<long> Triangle;
+typedef std::vector<Triangle> Triangles;
+
+// The positions are rounded, so that the same vertex computed twice compares equal
+void AddPosition(const float3& position, Triangle& triangle)
+{
+	triangle.push_back(std::lround(position.x * 1024.f));
+	triangle.push_back(std::lround(position.y * 1024.f));
+	triangle.push_back(std::lround(position.z * 1024.f));
+}
+
+// Every triangle starts with its smallest vertex, so that the winding is kept
+void AddTriangle(Triangle& triangle, Triangles& triangles)
+{
+	auto first = triangle.begin();
+	for (auto vertex = triangle.begin() + 3; vertex != triangle.end(); vertex += 3) {
+		if (std::lexicographical_compare(vertex, vertex + 3, first, first + 3)) {
+			first = vertex;
+		}
+	}
+	std::rotate(triangle.begin(), first, triangle.end());
+	triangles.push_back(triangle);
+}
+
+Triangles CollectTriangles(const PolygonVertex* vertices, const unsigned* indices, unsigned indicesCount)
+{
+	Triangles triangles;
+	for (unsigned i = 0; i < indicesCount; i += 3) {
+		Triangle triangle;
+		for (unsigned corner = 0; corner < 3; ++corner) {
+			AddPosition(vertices[indices[i + corner]].Position, triangle);
+		}
+		AddTriangle(triangle, triangles);
+	}
+	std::sort(triangles.begin(), triangles.end());
+	return triangles;
+}
+
+Triangles CollectTriangles(const float3* positions, const unsigned* indices, unsigned indicesCount)
+{
+	Triangles triangles;
+	for (unsigned i = 0; i < indicesCount; i += 3) {
+		Triangle triangle;
+		for (unsigned corner = 0; corner < 3; ++corner) {
+			AddPosition(positions[indices[i + corner]], triangle);
+		}
+		AddTriangle(triangle, triangles);
+	}
+	std::sort(triangles.begin(), triangles.end());
+	return triangles;
+}
+
+void CompareBlocks(const BlockPolygons* full, const BlockPolygons* collision)
+{
+	unsigned count = 0;
+	VOXELS_CHECK(collision->GetVertices(&count) == nullptr && count == 0);
+	VOXELS_CHECK(collision->GetCompactVertices(&count) == nullptr && count == 0);
+	for (unsigned face = 0; face < BlockPolygons::Face_Count; ++face) {
+		collision->GetTransitionIndices(BlockPolygons::TransitionFaceId(face), &count);
+		VOXELS_CHECK(count == 0);
+	}
+
+	unsigned positionsCount = 0;
+	unsigned indicesCount = 0;
+	const auto positions = collision->GetPositions(&positionsCount);
+	const auto indices = collision->GetIndices(&indicesCount);
+	VOXELS_CHECK(indicesCount % 3 == 0);
+	for (unsigned i = 0; i < indicesCount; ++i) {
+		VOXELS_CHECK(indices[i] < positionsCount);
+	}
+
+	// the vertices with equal positions are welded
+	std::set<std::vector<float>> unique;
+	for (unsigned i = 0; i < positionsCount; ++i) {
+		std::vector<float> key;
+		key.push_back(positions[i].x);
+		key.push_back(positions[i].y);
+		key.push_back(positions[i].z);
+		unique.insert(key);
+	}
+	VOXELS_CHECK(unique.size() == positionsCount);
+
+	unsigned verticesCount = 0;
+	unsigned fullIndicesCount = 0;
+	const auto vertices = full->GetVertices(&verticesCount);
+	const auto fullIndices = full->GetIndices(&fullIndicesCount);
+	VOXELS_CHECK(positionsCount <= verticesCount);
+	VOXELS_CHECK(CollectTriangles(positions, indices, indicesCount) == CollectTriangles(vertices, fullIndices, fullIndicesCount));
+}
+
+}
+
+int main()
+{
+	LibraryScope library;
+
+	auto grid = CreateTerrainGrid(64);
+	TestMaterialMap materials;
+	Polygonizer polygonizer;
+	auto full = polygonizer.Execute(*grid, &materials);
+
+	PolygonizationOptions options;
+	options.OutputFormat = VF_Collision;
+	polygonizer.SetOptions(options);
+	auto collision = polygonizer.Execute(*grid, &materials);
+	VOXELS_CHECK(collision->GetVertexFormat() == VF_Collision);
+
+	// only level 0 is polygonized
+	VOXELS_CHECK(collision->GetLevelsCount() == 1);
+	const auto blocksCount = full->GetBlocksForLevelCount(0);
+	VOXELS_CHECK(collision->GetBlocksForLevelCount(0) == blocksCount);
+
+	std::map<std::string, const BlockPolygons*> fullBlocks;
+	for (unsigned blockId = 0; blockId < blocksCount; ++blockId) {
+		const auto block = full->GetBlockForLevel(0, blockId);
+		fullBlocks[BlockKey(0, block->GetMinimalCorner())] = block;
+	}
+	for (unsigned blockId = 0; blockId < collision->GetBlocksForLevelCount(0); ++blockId) {
+		const auto block = collision->GetBlockForLevel(0, blockId);
+		const auto found = fullBlocks.find(BlockKey(0, block->GetMinimalCorner()));
+		VOXELS_CHECK(found != fullBlocks.end());
+		if (found != fullBlocks.end()) {
+			CompareBlocks(found->second, block);
+		}
+	}
+	VOXELS_CHECK(collision->GetPolygonDataSizeBytes() < full->GetPolygonDataSizeBytes() / 4);
+
+	collision->Destroy();
+	full->Destroy();
+	grid->Destroy();
+
+	return TestResult();
+}
@@ -0,0 +1,187 @@
+// Copyright (c) 2013-2016, Stoyan Nikolov
+// All rights reserved.
+// Voxels Library, please see LICENSE for licensing details.
+
+// Polygonizes the same grid with VF_Full and VF_Compact and checks that
+// every compact vertex decodes to its full counterpart, for both methods.
+
+#include "TestCommon.h"
+
+using namespace VoxelsTests;
+
+namespace
+{
+
+float3 DecodePosition(const unsigned short position[3], const float3& minCorner, const float3& maxCorner)
+{
+	return float3(minCorner.x + position[0] / 65535.f * (maxCorner.x - minCorner.x),
+		minCorner.y + position[1] / 65535.f * (maxCorner.y - minCorner.y),
+		minCorner.z + position[2] / 65535.f * (maxCorner.z - minCorner.z));
+}
+
+float3 DecodeNormal(const signed char normal[2])
+{
+	float x = normal[0] / 127.f;
+	float y = normal[1] / 127.f;
+	const float z = 1.f - std::abs(x) - std::abs(y);
+	if (z < 0.f) {
+		const float foldedX = 1.f - std::abs(y);
+		const float foldedY = 1.f - std::abs(x);
+		x = x >= 0.f ? foldedX : -foldedX;
+		y = y >= 0.f ? foldedY : -foldedY;
+	}
+	const float length = std::sqrt(x * x + y * y + z * z);
+	return float3(x / length, y / length, z / length);
+}
+
+bool IsNear(const float3& lhs, const float3& rhs, float tolerance)
+{
+	return std::abs(lhs.x - rhs.x) <= tolerance
+		&& std::abs(lhs.y - rhs.y) <= tolerance
+		&& std::abs(lhs.z - rhs.z) <= tolerance;
+}
+
+struct CompactMesh
+{
+	const CompactPolygonVertex* Vertices;
+	unsigned VerticesCount;
+	const CompactSecondaryPosition* SecondaryPositions;
+	unsigned SecondaryPositionsCount;
+	const unsigned short* Indices;
+	const unsigned* WideIndices;
+	unsigned IndicesCount;
+
+	unsigned GetIndex(unsigned id) const { return Indices ? Indices[id] : WideIndices[id]; }
+};
+
+// The compact mesh has the same triangles in the same order as the full one, only
+// the vertices are quantized and reordered
+void CompareMeshes(const PolygonVertex* vertices,
+	unsigned verticesCount,
+	const unsigned* indices,
+	unsigned indicesCount,
+	const CompactMesh& compact,
+	const float3& minCorner,
+	const float3& maxCorner)
+{
+	VOXELS_CHECK(compact.VerticesCount == verticesCount);
+	VOXELS_CHECK(compact.IndicesCount == indicesCount);
+	if (compact.VerticesCount != verticesCount || compact.IndicesCount != indicesCount)
+		return;
+
+	const float extent = std::max(maxCorner.x - minCorner.x, std::max(maxCorner.y - minCorner.y, maxCorner.z - minCorner.z));
+	const float tolerance = extent / 65535.f + 0.001f;
+	for (unsigned i = 0; i < indicesCount; ++i) {
+		VOXELS_CHECK(compact.GetIndex(i) < compact.VerticesCount);
+		const auto& vertex = vertices[indices[i]];
+		const auto compactIndex = compact.GetIndex(i);
+		const auto& compactVertex = compact.Vertices[compactIndex];
+
+		VOXELS_CHECK(IsNear(DecodePosition(compactVertex.Position, minCorner, maxCorner), vertex.Position, tolerance));
+
+		const auto normal = DecodeNormal(compactVertex.Normal);
+		const float dot = normal.x * vertex.Normal.x + normal.y * vertex.Normal.y + normal.z * vertex.Normal.z;
+		VOXELS_CHECK(dot > 0.99f);
+
+		unsigned flags;
+		memcpy(&flags, &vertex.SecondaryPosition.w, sizeof(flags));
+		VOXELS_CHECK(compactVertex.TransitionFlags == flags);
+		if (flags) {
+			VOXELS_CHECK(compactIndex < compact.SecondaryPositionsCount);
+			const float3 secondary(vertex.SecondaryPosition.x, vertex.SecondaryPosition.y, vertex.SecondaryPosition.z);
+			VOXELS_CHECK(IsNear(DecodePosition(compact.SecondaryPositions[compactIndex].Position, minCorner, maxCorner), secondary, tolerance));
+		}
+
+		const auto& textures = vertex.Textures.TextureIndices;
+		VOXELS_CHECK(compactVertex.Blend == textures.Blend);
+		VOXELS_CHECK(compactVertex.Uxz == textures.Uxz && compactVertex.Txz == textures.Txz);
+		VOXELS_CHECK(compactVertex.Uny == textures.Uny && compactVertex.Upy == textures.Upy);
+		VOXELS_CHECK(compactVertex.Tny == textures.Tny && compactVertex.Tpy == textures.Tpy);
+	}
+}
+
+void CompareBlocks(const BlockPolygons* full, const BlockPolygons* compact)
+{
+	const auto minCorner = compact->GetMinimalCorner();
+	const auto maxCorner = compact->GetMaximalCorner();
+	VOXELS_CHECK(IsNear(minCorner, full->GetMinimalCorner(), 0.f));
+
+	unsigned verticesCount = 0;
+	unsigned indicesCount = 0;
+	const auto vertices = full->GetVertices(&verticesCount);
+	const auto indices = full->GetIndices(&indicesCount);
+
+	unsigned count = 0;
+	CompactMesh mesh;
+	mesh.Vertices = compact->GetCompactVertices(&mesh.VerticesCount);
+	mesh.SecondaryPositions = compact->GetCompactSecondaryPositions(&mesh.SecondaryPositionsCount);
+	mesh.Indices = compact->GetCompactIndices(&mesh.IndicesCount);
+	mesh.WideIndices = compact->GetIndices(&count);
+	if (!mesh.Indices) {
+		mesh.IndicesCount = count;
+	}
+	VOXELS_CHECK(compact->GetVertices(&count) == nullptr);
+	CompareMeshes(vertices, verticesCount, indices, indicesCount, mesh, minCorner, maxCorner);
+
+	for (unsigned face = 0; face < BlockPolygons::Face_Count; ++face) {
+		const auto faceId = BlockPolygons::TransitionFaceId(face);
+		const auto transitionVertices = full->GetTransitionVertices(faceId, &verticesCount);
+		const auto transitionIndices = full->GetTransitionIndices(faceId, &indicesCount);
+
+		CompactMesh transition;
+		transition.Vertices = compact->GetCompactTransitionVertices(faceId, &transition.VerticesCount);
+		transition.SecondaryPositions = compact->GetCompactTransitionSecondaryPositions(faceId, &transition.SecondaryPositionsCount);
+		transition.Indices = compact->GetCompactTransitionIndices(faceId, &transition.IndicesCount);
+		transition.WideIndices = compact->GetTransitionIndices(faceId, &count);
+		if (!transition.Indices) {
+			transition.IndicesCount = count;
+		}
+		CompareMeshes(transitionVertices, verticesCount, transitionIndices, indicesCount, transition, minCorner, maxCorner);
+	}
+}
+
+void CompareFormats(Grid* grid, MeshingMethod method)
+{
+	TestMaterialMap materials;
+	Polygonizer polygonizer;
+	PolygonizationOptions options;
+	options.Method = method;
+	polygonizer.SetOptions(options);
+	auto full = polygonizer.Execute(*grid, &materials);
+	VOXELS_CHECK(full->GetVertexFormat() == VF_Full);
+
+	options.OutputFormat = VF_Compact;
+	polygonizer.SetOptions(options);
+	auto compact = polygonizer.Execute(*grid, &materials);
+	VOXELS_CHECK(compact->GetVertexFormat() == VF_Compact);
+
+	VOXELS_CHECK(compact->GetLevelsCount() == full->GetLevelsCount());
+	for (unsigned level = 0; level < full->GetLevelsCount(); ++level) {
+		const auto blocksCount = full->GetBlocksForLevelCount(level);
+		VOXELS_CHECK(compact->GetBlocksForLevelCount(level) == blocksCount);
+		if (compact->GetBlocksForLevelCount(level) != blocksCount)
+			continue;
+		for (unsigned blockId = 0; blockId < blocksCount; ++blockId) {
+			CompareBlocks(full->GetBlockForLevel(level, blockId), compact->GetBlockForLevel(level, blockId));
+		}
+	}
+	VOXELS_CHECK(compact->GetPolygonDataSizeBytes() < full->GetPolygonDataSizeBytes() / 2);
+
+	compact->Destroy();
+	full->Destroy();
+}
+
+}
+
+int main()
+{
+	LibraryScope library;
+
+	auto grid = CreateTerrainGrid(64);
+	CompareFormats(grid, MM_TransVoxel);
+	// the Surface Nets skirts reach outside of the block
+	CompareFormats(grid, MM_SurfaceNets);
+	grid->Destroy();
+
+	return TestResult();
+}
@@ -0,0 +1,41 @@
+// Copyright (c) 2013-2016, Stoyan Nikolov
+// All rights reserved.
+// Voxels Library, please see LICENSE for licensing details.
+
+// Polygonizes grids with the default options and compares the surfaces with
+// the ones the library produced before the integer cell, block and cache
+// coordinates. The expected values were recorded with the baseline sources.
+
+#include "TestCommon.h"
+
+using namespace VoxelsTests;
+
+namespace
+{
+
+void CheckDefaultSurface(unsigned size, const SurfaceSummary& expected)
+{
+	auto grid = CreateTerrainGrid(size);
+	TestMaterialMap materials;
+	Polygonizer polygonizer;
+	auto surface = polygonizer.Execute(*grid, &materials);
+	const auto summary = SummarizeSurface(surface);
+	char name[32];
+	snprintf(name, sizeof(name), "terrain %u", size);
+	PrintSummary(name, summary);
+	VOXELS_CHECK(summary == expected);
+	surface->Destroy();
+	grid->Destroy();
+}
+
+}
+
+int main()
+{
+	LibraryScope library;
+
+	CheckDefaultSurface(64, SurfaceSummary{ 3, 37, 19900, 61770, 0xc8c38474bd4f495aull });
+	CheckDefaultSurface(128, SurfaceSummary{ 4, 189, 103271, 311466, 0x38440d0d46ab7607ull });
+
+	return TestResult();
+}
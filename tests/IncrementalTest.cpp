@@ -0,0 +1,92 @@
+// Copyright (c) 2013-2016, Stoyan Nikolov
+// All rights reserved.
+// Voxels Library, please see LICENSE for licensing details.
+
+// Polygonizes and modifies grids in small steps and compares the surfaces
+// with the ones of a single Execute call.
+
+#include "TestCommon.h"
+
+using namespace VoxelsTests;
+
+namespace
+{
+
+PolygonizationBudget CellsBudget()
+{
+	PolygonizationBudget budget;
+	budget.Cells = 4096;
+	return budget;
+}
+
+// Returns the count of steps
+unsigned Complete(PolygonizationProgress* progress, const PolygonizationBudget& budget, const PolygonSurface* surface)
+{
+	unsigned steps = 1;
+	while (!progress->IsCompleted()) {
+		VOXELS_CHECK(progress->GetSurface() == surface);
+		progress->Continue(budget);
+		++steps;
+	}
+	return steps;
+}
+
+void CheckNewSurface(const PolygonizationBudget& budget)
+{
+	auto grid = CreateTerrainGrid(64);
+	TestMaterialMap materials;
+	Polygonizer polygonizer;
+	auto expected = polygonizer.Execute(*grid, &materials);
+
+	auto progress = polygonizer.ExecuteIncremental(*grid, &materials, nullptr, budget);
+	const auto steps = Complete(progress, budget, nullptr);
+	auto surface = progress->GetSurface();
+	progress->Destroy();
+	VOXELS_CHECK(steps > 1 || !budget.Cells);
+	VOXELS_CHECK(SummarizeSurface(surface) == SummarizeSurface(expected));
+
+	surface->Destroy();
+	expected->Destroy();
+	grid->Destroy();
+}
+
+void CheckModification()
+{
+	auto grid = CreateTerrainGrid(64);
+	TestMaterialMap materials;
+	Polygonizer polygonizer;
+	auto surface = polygonizer.Execute(*grid, &materials);
+
+	auto modification = Modification::Create();
+	modification->Map = surface;
+	DigSphere(grid, modification);
+	const auto budget = CellsBudget();
+	auto progress = polygonizer.ExecuteIncremental(*grid, &materials, modification, budget);
+	// the surface stays valid during the whole modification
+	VOXELS_CHECK(Complete(progress, budget, surface) > 1);
+	VOXELS_CHECK(progress->GetSurface() == surface);
+	progress->Destroy();
+
+	auto expected = polygonizer.Execute(*grid, &materials);
+	VOXELS_CHECK(HashBlocks(surface) == HashBlocks(expected));
+
+	modification->Destroy();
+	expected->Destroy();
+	surface->Destroy();
+	grid->Destroy();
+}
+
+}
+
+int main()
+{
+	LibraryScope library;
+
+	CheckNewSurface(CellsBudget());
+	PolygonizationBudget timeBudget;
+	timeBudget.Milliseconds = 1.f;
+	CheckNewSurface(timeBudget);
+	CheckModification();
+
+	return TestResult();
+}
@@ -0,0 +1,146 @@
+// Copyright (c) 2013-2016, Stoyan Nikolov
+// All rights reserved.
+// Voxels Library, please see LICENSE for licensing details.
+
+// Groups the indices of the blocks by material and checks that the ranges
+// partition the same triangles and that every triangle has its range's material.
+
+#include "TestCommon.h"
+
+using namespace VoxelsTests;
+
+namespace
+{
+
+typedef std::vector<unsigned long long> Triangle;
+typedef std::vector<Triangle> Triangles;
+
+// TestMaterialMap gives material i the texture ids from i * 10
+unsigned char GetMaterial(const PolygonVertex& vertex)
+{
+	return vertex.Textures.TextureIndices.Tpy / 10;
+}
+
+// The material of at least two of the vertices or of the first one
+unsigned char GetTriangleMaterial(const PolygonVertex* vertices, const unsigned* indices)
+{
+	const auto m0 = GetMaterial(vertices[indices[0]]);
+	const auto m1 = GetMaterial(vertices[indices[1]]);
+	const auto m2 = GetMaterial(vertices[indices[2]]);
+	return (m1 == m2 && m0 != m1) ? m1 : m0;
+}
+
+Triangles CollectTriangles(const PolygonVertex* vertices, const unsigned* indices, unsigned indicesCount)
+{
+	Triangles triangles;
+	for (unsigned i = 0; i < indicesCount; i += 3) {
+		Triangle triangle;
+		for (unsigned corner = 0; corner < 3; ++corner) {
+			Hasher hasher;
+			AddVertices(&vertices[indices[i + corner]], 1, hasher);
+			triangle.push_back(hasher.GetHash());
+		}
+		std::rotate(triangle.begin(), std::min_element(triangle.begin(), triangle.end()), triangle.end());
+		triangles.push_back(triangle);
+	}
+	std::sort(triangles.begin(), triangles.end());
+	return triangles;
+}
+
+void CompareBlocks(const BlockPolygons* block, const BlockPolygons* grouped)
+{
+	unsigned count = 0;
+	VOXELS_CHECK(block->GetMaterialRanges(&count) == nullptr && count == 0);
+
+	unsigned verticesCount = 0;
+	unsigned indicesCount = 0;
+	unsigned groupedVerticesCount = 0;
+	unsigned groupedIndicesCount = 0;
+	const auto vertices = block->GetVertices(&verticesCount);
+	const auto indices = block->GetIndices(&indicesCount);
+	const auto groupedVertices = grouped->GetVertices(&groupedVerticesCount);
+	const auto groupedIndices = grouped->GetIndices(&groupedIndicesCount);
+	VOXELS_CHECK(groupedVerticesCount == verticesCount);
+	VOXELS_CHECK(groupedIndicesCount == indicesCount);
+	VOXELS_CHECK(CollectTriangles(groupedVertices, groupedIndices, groupedIndicesCount) == CollectTriangles(vertices, indices, indicesCount));
+
+	// the ranges cover all the indices in order, ordered by material
+	unsigned rangesCount = 0;
+	const auto ranges = grouped->GetMaterialRanges(&rangesCount);
+	VOXELS_CHECK(groupedIndicesCount == 0 || rangesCount > 0);
+	unsigned firstIndex = 0;
+	for (unsigned i = 0; i < rangesCount; ++i) {
+		const auto& range = ranges[i];
+		VOXELS_CHECK(range.FirstIndex == firstIndex);
+		VOXELS_CHECK(range.IndicesCount > 0 && range.IndicesCount % 3 == 0);
+		VOXELS_CHECK(i == 0 || ranges[i - 1].Material < range.Material);
+		for (unsigned index = range.FirstIndex; index < range.FirstIndex + range.IndicesCount && index < groupedIndicesCount; index += 3) {
+			VOXELS_CHECK(GetTriangleMaterial(groupedVertices, &groupedIndices[index]) == range.Material);
+		}
+		firstIndex += range.IndicesCount;
+	}
+	VOXELS_CHECK(firstIndex == groupedIndicesCount);
+}
+
+// The compact blocks have the same ranges
+void CompareRanges(const BlockPolygons* grouped, const BlockPolygons* compact)
+{
+	unsigned rangesCount = 0;
+	unsigned compactRangesCount = 0;
+	const auto ranges = grouped->GetMaterialRanges(&rangesCount);
+	const auto compactRanges = compact->GetMaterialRanges(&compactRangesCount);
+	VOXELS_CHECK(compactRangesCount == rangesCount);
+	for (unsigned i = 0; i < std::min(rangesCount, compactRangesCount); ++i) {
+		VOXELS_CHECK(compactRanges[i].Material == ranges[i].Material);
+		VOXELS_CHECK(compactRanges[i].FirstIndex == ranges[i].FirstIndex);
+		VOXELS_CHECK(compactRanges[i].IndicesCount == ranges[i].IndicesCount);
+	}
+}
+
+}
+
+int main()
+{
+	LibraryScope library;
+
+	auto grid = CreateTerrainGrid(64);
+	TestMaterialMap materials;
+	Polygonizer polygonizer;
+	auto surface = polygonizer.Execute(*grid, &materials);
+
+	PolygonizationOptions options;
+	options.GroupIndicesByMaterial = true;
+	polygonizer.SetOptions(options);
+	auto grouped = polygonizer.Execute(*grid, &materials);
+
+	options.OutputFormat = VF_Compact;
+	polygonizer.SetOptions(options);
+	auto compact = polygonizer.Execute(*grid, &materials);
+
+	unsigned multiMaterialBlocks = 0;
+	VOXELS_CHECK(grouped->GetLevelsCount() == surface->GetLevelsCount());
+	for (unsigned level = 0; level < surface->GetLevelsCount(); ++level) {
+		const auto blocksCount = surface->GetBlocksForLevelCount(level);
+		VOXELS_CHECK(grouped->GetBlocksForLevelCount(level) == blocksCount);
+		VOXELS_CHECK(compact->GetBlocksForLevelCount(level) == blocksCount);
+		if (grouped->GetBlocksForLevelCount(level) != blocksCount || compact->GetBlocksForLevelCount(level) != blocksCount)
+			continue;
+		for (unsigned blockId = 0; blockId < blocksCount; ++blockId) {
+			const auto groupedBlock = grouped->GetBlockForLevel(level, blockId);
+			CompareBlocks(surface->GetBlockForLevel(level, blockId), groupedBlock);
+			CompareRanges(groupedBlock, compact->GetBlockForLevel(level, blockId));
+
+			unsigned rangesCount = 0;
+			groupedBlock->GetMaterialRanges(&rangesCount);
+			multiMaterialBlocks += rangesCount > 1;
+		}
+	}
+	VOXELS_CHECK(multiMaterialBlocks > 0);
+
+	compact->Destroy();
+	grouped->Destroy();
+	surface->Destroy();
+	grid->Destroy();
+
+	return TestResult();
+}
@@ -0,0 +1,187 @@
+// Copyright (c) 2013-2016, Stoyan Nikolov
+// All rights reserved.
+// Voxels Library, please see LICENSE for licensing details.
+
+// Splits the blocks in meshlets and checks their limits, that they cover the
+// indices inside the material ranges and that their bounds hold the triangles.
+
+#include "TestCommon.h"
+
+#include <set>
+
+using namespace VoxelsTests;
+
+namespace
+{
+
+float3 Subtract(const float3& lhs, const float3& rhs)
+{
+	return float3(lhs.x - rhs.x, lhs.y - rhs.y, lhs.z - rhs.z);
+}
+
+float Dot(const float3& lhs, const float3& rhs)
+{
+	return lhs.x * rhs.x + lhs.y * rhs.y + lhs.z * rhs.z;
+}
+
+float3 Cross(const float3& lhs, const float3& rhs)
+{
+	return float3(lhs.y * rhs.z - lhs.z * rhs.y, lhs.z * rhs.x - lhs.x * rhs.z, lhs.x * rhs.y - lhs.y * rhs.x);
+}
+
+bool IsInside(const float3& position, const float3& minCorner, const float3& maxCorner)
+{
+	return position.x >= minCorner.x && position.x <= maxCorner.x
+		&& position.y >= minCorner.y && position.y <= maxCorner.y
+		&& position.z >= minCorner.z && position.z <= maxCorner.z;
+}
+
+// A viewer on the axis of the cone behind its apex is in the culled region, so
+// every triangle of the meshlet must face away from it
+void CheckCone(const Meshlet& meshlet, const PolygonVertex* vertices, const unsigned* indices)
+{
+	if (Dot(meshlet.ConeAxis, meshlet.ConeAxis) == 0.f)
+		return;
+
+	VOXELS_CHECK(meshlet.ConeCutoff >= 0.f && meshlet.ConeCutoff < 1.f);
+	const float distances[] = { 0.5f, 10.f, 1000.f };
+	for (const auto distance : distances) {
+		const float3 viewer(meshlet.ConeApex.x - meshlet.ConeAxis.x * distance,
+			meshlet.ConeApex.y - meshlet.ConeAxis.y * distance,
+			meshlet.ConeApex.z - meshlet.ConeAxis.z * distance);
+		for (unsigned i = meshlet.FirstIndex; i < meshlet.FirstIndex + meshlet.IndicesCount; i += 3) {
+			const auto& p0 = vertices[indices[i]].Position;
+			const auto& p1 = vertices[indices[i + 1]].Position;
+			const auto& p2 = vertices[indices[i + 2]].Position;
+			// the front is the side the vertex normals point to
+			const auto front = Cross(Subtract(p2, p0), Subtract(p1, p0));
+			VOXELS_CHECK(Dot(front, Subtract(viewer, p0)) <= 0.001f);
+		}
+	}
+}
+
+unsigned CheckBlock(const BlockPolygons* block)
+{
+	unsigned verticesCount = 0;
+	unsigned indicesCount = 0;
+	const auto vertices = block->GetVertices(&verticesCount);
+	const auto indices = block->GetIndices(&indicesCount);
+	unsigned meshletsCount = 0;
+	const auto meshlets = block->GetMeshlets(&meshletsCount);
+	VOXELS_CHECK(indicesCount == 0 || meshletsCount > 0);
+
+	unsigned rangesCount = 0;
+	const auto ranges = block->GetMaterialRanges(&rangesCount);
+	unsigned range = 0;
+
+	// the meshlets cover all the indices in order
+	unsigned firstIndex = 0;
+	for (unsigned i = 0; i < meshletsCount; ++i) {
+		const auto& meshlet = meshlets[i];
+		VOXELS_CHECK(meshlet.FirstIndex == firstIndex);
+		VOXELS_CHECK(meshlet.IndicesCount > 0 && meshlet.IndicesCount % 3 == 0);
+		VOXELS_CHECK(meshlet.IndicesCount <= 3 * Meshlet::MAX_TRIANGLES);
+		VOXELS_CHECK(meshlet.FirstIndex + meshlet.IndicesCount <= indicesCount);
+		if (meshlet.FirstIndex + meshlet.IndicesCount > indicesCount)
+			return meshletsCount;
+		firstIndex += meshlet.IndicesCount;
+
+		std::set<unsigned> used(indices + meshlet.FirstIndex, indices + meshlet.FirstIndex + meshlet.IndicesCount);
+		VOXELS_CHECK(meshlet.VerticesCount == used.size());
+		VOXELS_CHECK(meshlet.VerticesCount <= Meshlet::MAX_VERTICES);
+		for (const auto index : used) {
+			const auto offset = Subtract(vertices[index].Position, meshlet.Center);
+			VOXELS_CHECK(std::sqrt(Dot(offset, offset)) <= meshlet.Radius * 1.0001f + 0.001f);
+		}
+		CheckCone(meshlet, vertices, indices);
+
+		// every meshlet is inside a single material range
+		if (rangesCount) {
+			while (range < rangesCount && ranges[range].FirstIndex + ranges[range].IndicesCount <= meshlet.FirstIndex) {
+				++range;
+			}
+			VOXELS_CHECK(range < rangesCount);
+			if (range < rangesCount) {
+				VOXELS_CHECK(meshlet.FirstIndex >= ranges[range].FirstIndex);
+				VOXELS_CHECK(meshlet.FirstIndex + meshlet.IndicesCount <= ranges[range].FirstIndex + ranges[range].IndicesCount);
+			}
+		}
+	}
+	VOXELS_CHECK(firstIndex == indicesCount);
+	return meshletsCount;
+}
+
+// The polygons bounds are inside the block extents and hold all the vertices
+void CheckBounds(const BlockPolygons* block)
+{
+	const auto minCorner = block->GetPolygonsMinimalCorner();
+	const auto maxCorner = block->GetPolygonsMaximalCorner();
+	VOXELS_CHECK(IsInside(minCorner, block->GetMinimalCorner(), block->GetMaximalCorner()));
+	VOXELS_CHECK(IsInside(maxCorner, block->GetMinimalCorner(), block->GetMaximalCorner()));
+
+	unsigned verticesCount = 0;
+	const auto vertices = block->GetVertices(&verticesCount);
+	for (unsigned i = 0; i < verticesCount; ++i) {
+		VOXELS_CHECK(IsInside(vertices[i].Position, minCorner, maxCorner));
+	}
+	for (unsigned face = 0; face < BlockPolygons::Face_Count; ++face) {
+		const auto transitionVertices = block->GetTransitionVertices(BlockPolygons::TransitionFaceId(face), &verticesCount);
+		for (unsigned i = 0; i < verticesCount; ++i) {
+			VOXELS_CHECK(IsInside(transitionVertices[i].Position, minCorner, maxCorner));
+		}
+	}
+}
+
+void CheckMeshlets(bool groupByMaterial)
+{
+	auto grid = CreateTerrainGrid(64);
+	TestMaterialMap materials;
+	Polygonizer polygonizer;
+	PolygonizationOptions options;
+	options.GroupIndicesByMaterial = groupByMaterial;
+	polygonizer.SetOptions(options);
+	auto surface = polygonizer.Execute(*grid, &materials);
+
+	options.BuildMeshlets = true;
+	polygonizer.SetOptions(options);
+	auto clustered = polygonizer.Execute(*grid, &materials);
+
+	unsigned meshletsCount = 0;
+	for (unsigned level = 0; level < surface->GetLevelsCount(); ++level) {
+		const auto blocksCount = surface->GetBlocksForLevelCount(level);
+		VOXELS_CHECK(clustered->GetBlocksForLevelCount(level) == blocksCount);
+		if (clustered->GetBlocksForLevelCount(level) != blocksCount)
+			continue;
+		for (unsigned blockId = 0; blockId < blocksCount; ++blockId) {
+			const auto block = surface->GetBlockForLevel(level, blockId);
+			unsigned count = 0;
+			VOXELS_CHECK(block->GetMeshlets(&count) == nullptr && count == 0);
+			CheckBounds(block);
+
+			const auto clusteredBlock = clustered->GetBlockForLevel(level, blockId);
+			unsigned indicesCount = 0;
+			unsigned clusteredIndicesCount = 0;
+			block->GetIndices(&indicesCount);
+			clusteredBlock->GetIndices(&clusteredIndicesCount);
+			VOXELS_CHECK(clusteredIndicesCount == indicesCount);
+			meshletsCount += CheckBlock(clusteredBlock);
+		}
+	}
+	VOXELS_CHECK(meshletsCount > clustered->GetLevelsCount());
+
+	clustered->Destroy();
+	surface->Destroy();
+	grid->Destroy();
+}
+
+}
+
+int main()
+{
+	LibraryScope library;
+
+	CheckMeshlets(false);
+	CheckMeshlets(true);
+
+	return TestResult();
+}
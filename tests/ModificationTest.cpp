@@ -0,0 +1,43 @@
+// Copyright (c) 2013-2016, Stoyan Nikolov
+// All rights reserved.
+// Voxels Library, please see LICENSE for licensing details.
+
+// Modifies a polygonized grid and checks that the modified surface is the
+// same as a new one and that only the blocks around the change are polygonized again.
+
+#include "TestCommon.h"
+
+using namespace VoxelsTests;
+
+int main()
+{
+	LibraryScope library;
+
+	auto grid = CreateTerrainGrid(64);
+	TestMaterialMap materials;
+	Polygonizer polygonizer;
+	auto surface = polygonizer.Execute(*grid, &materials);
+	const auto blocksCount = SummarizeSurface(surface).Blocks;
+
+	auto modification = Modification::Create();
+	modification->Map = surface;
+	DigSphere(grid, modification);
+	VOXELS_CHECK(polygonizer.Execute(*grid, &materials, modification) == surface);
+
+	auto expected = polygonizer.Execute(*grid, &materials);
+	VOXELS_CHECK(HashBlocks(surface) == HashBlocks(expected));
+
+	// only the blocks around the sphere are polygonized again
+	unsigned modifiedCount = 0;
+	modification->GetModifiedBlocks(&modifiedCount);
+	VOXELS_CHECK(modifiedCount > 0);
+	VOXELS_CHECK(surface->GetStatistics()->BlocksCalculated < blocksCount / 2);
+	VOXELS_CHECK(modifiedCount <= surface->GetStatistics()->BlocksCalculated);
+
+	modification->Destroy();
+	expected->Destroy();
+	surface->Destroy();
+	grid->Destroy();
+
+	return TestResult();
+}
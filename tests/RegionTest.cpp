@@ -0,0 +1,114 @@
+// Copyright (c) 2013-2016, Stoyan Nikolov
+// All rights reserved.
+// Voxels Library, please see LICENSE for licensing details.
+
+// Polygonizes regions of a grid and checks that their blocks are the same
+// as the blocks of the whole surface.
+
+#include "TestCommon.h"
+
+#include <set>
+
+using namespace VoxelsTests;
+
+namespace
+{
+
+const unsigned BLOCK_EXTENT = 16;
+
+std::string AddressKey(const BlockAddress& address)
+{
+	// the corners of the blocks are output with Y up
+	const float size = float(BLOCK_EXTENT << address.Level);
+	return BlockKey(address.Level, float3(address.X * size, address.Z * size, address.Y * size));
+}
+
+void CheckBlocksList()
+{
+	auto grid = CreateTerrainGrid(64);
+	TestMaterialMap materials;
+	Polygonizer polygonizer;
+	auto surface = polygonizer.Execute(*grid, &materials);
+	const auto blocks = HashBlocks(surface);
+
+	const BlockAddress addresses[] = {
+		{ 0, 1, 2, 1 },
+		{ 0, 3, 0, 1 },
+		{ 1, 0, 1, 0 },
+		{ 2, 0, 0, 0 },
+	};
+	PolygonizationRegion region;
+	region.Blocks = addresses;
+	region.BlocksCount = sizeof(addresses) / sizeof(addresses[0]);
+	auto regionSurface = polygonizer.Execute(*grid, &materials, region);
+	const auto regionBlocks = HashBlocks(regionSurface);
+
+	std::set<std::string> selected;
+	for (unsigned i = 0; i < region.BlocksCount; ++i) {
+		selected.insert(AddressKey(addresses[i]));
+	}
+	// the selected blocks without polygons are not in the surface
+	for (auto block = regionBlocks.cbegin(); block != regionBlocks.cend(); ++block) {
+		VOXELS_CHECK(selected.count(block->first) == 1);
+	}
+	for (auto key = selected.cbegin(); key != selected.cend(); ++key) {
+		VOXELS_CHECK(blocks.count(*key) == regionBlocks.count(*key));
+	}
+	VOXELS_CHECK(!regionBlocks.empty());
+	VOXELS_CHECK(CountDifferentBlocks(regionBlocks, blocks) == 0);
+
+	// modifications of the region update only its blocks
+	auto modification = Modification::Create();
+	modification->Map = regionSurface;
+	DigSphere(grid, modification);
+	polygonizer.Execute(*grid, &materials, modification);
+	auto expected = polygonizer.Execute(*grid, &materials, region);
+	VOXELS_CHECK(HashBlocks(regionSurface) == HashBlocks(expected));
+
+	modification->Destroy();
+	expected->Destroy();
+	regionSurface->Destroy();
+	surface->Destroy();
+	grid->Destroy();
+}
+
+void CheckViewer()
+{
+	auto grid = CreateTerrainGrid(128);
+	TestMaterialMap materials;
+	Polygonizer polygonizer;
+	auto surface = polygonizer.Execute(*grid, &materials);
+	const auto blocks = HashBlocks(surface);
+
+	PolygonizationRegion region;
+	region.UseViewer = true;
+	region.ViewerPosition = float3(20.f, 40.f, 24.f);
+	for (unsigned level = 0; level < PolygonizationOptions::LEVELS_COUNT; ++level) {
+		region.LodDistances[level] = float(20 << level);
+	}
+	auto regionSurface = polygonizer.Execute(*grid, &materials, region);
+	const auto regionBlocks = HashBlocks(regionSurface);
+	VOXELS_CHECK(CountDifferentBlocks(regionBlocks, blocks) == 0);
+	VOXELS_CHECK(regionBlocks.size() < blocks.size());
+
+	// the blocks around the viewer are the finest ones
+	VOXELS_CHECK(regionSurface->GetBlocksForLevelCount(0) > 0);
+	const BlockAddress viewerBlock = { 0, 1, 2, 1 };
+	VOXELS_CHECK(regionBlocks.count(AddressKey(viewerBlock)) == 1);
+
+	regionSurface->Destroy();
+	surface->Destroy();
+	grid->Destroy();
+}
+
+}
+
+int main()
+{
+	LibraryScope library;
+
+	CheckBlocksList();
+	CheckViewer();
+
+	return TestResult();
+}
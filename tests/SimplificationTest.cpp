@@ -0,0 +1,159 @@
+// Copyright (c) 2013-2016, Stoyan Nikolov
+// All rights reserved.
+// Voxels Library, please see LICENSE for licensing details.
+
+// Simplifies the coarse levels of a surface, with and without material
+// ranges, and compares the blocks with the ones of a surface that is not simplified.
+
+#include "TestCommon.h"
+
+#include <set>
+
+using namespace VoxelsTests;
+
+namespace
+{
+
+typedef std::set<std::vector<float>> Positions;
+
+bool IsOnBoundary(const float3& position, const float3& minCorner, const float3& maxCorner, float cellSize)
+{
+	return position.x <= minCorner.x + cellSize || position.x >= maxCorner.x - cellSize
+		|| position.y <= minCorner.y + cellSize || position.y >= maxCorner.y - cellSize
+		|| position.z <= minCorner.z + cellSize || position.z >= maxCorner.z - cellSize;
+}
+
+std::vector<float> ToKey(const float3& position)
+{
+	std::vector<float> key;
+	key.push_back(position.x);
+	key.push_back(position.y);
+	key.push_back(position.z);
+	return key;
+}
+
+// The ranges must cover all the indices in order, each with a different material
+void CheckRanges(const BlockPolygons* block, std::set<unsigned char>& materials)
+{
+	unsigned indicesCount = 0;
+	block->GetIndices(&indicesCount);
+	unsigned rangesCount = 0;
+	const auto ranges = block->GetMaterialRanges(&rangesCount);
+	VOXELS_CHECK(indicesCount == 0 || rangesCount > 0);
+	unsigned firstIndex = 0;
+	for (unsigned i = 0; i < rangesCount; ++i) {
+		VOXELS_CHECK(ranges[i].FirstIndex == firstIndex);
+		VOXELS_CHECK(ranges[i].IndicesCount > 0 && ranges[i].IndicesCount % 3 == 0);
+		VOXELS_CHECK(materials.insert(ranges[i].Material).second);
+		firstIndex += ranges[i].IndicesCount;
+	}
+	VOXELS_CHECK(firstIndex == indicesCount);
+}
+
+void CompareBlocks(const BlockPolygons* block, const BlockPolygons* simplified, unsigned level, bool groupByMaterial)
+{
+	unsigned verticesCount = 0;
+	unsigned indicesCount = 0;
+	unsigned simplifiedVerticesCount = 0;
+	unsigned simplifiedIndicesCount = 0;
+	const auto vertices = block->GetVertices(&verticesCount);
+	block->GetIndices(&indicesCount);
+	const auto simplifiedVertices = simplified->GetVertices(&simplifiedVerticesCount);
+	const auto simplifiedIndices = simplified->GetIndices(&simplifiedIndicesCount);
+	VOXELS_CHECK(simplifiedIndicesCount <= indicesCount);
+	VOXELS_CHECK(simplifiedVerticesCount <= verticesCount);
+
+	// the simplification can't move the vertices shared with the neighbours
+	Positions positions;
+	for (unsigned i = 0; i < verticesCount; ++i) {
+		positions.insert(ToKey(vertices[i].Position));
+	}
+	const auto minCorner = simplified->GetMinimalCorner();
+	const auto maxCorner = simplified->GetMaximalCorner();
+	const float cellSize = float(1 << level);
+	for (unsigned i = 0; i < simplifiedVerticesCount; ++i) {
+		const auto& position = simplifiedVertices[i].Position;
+		if (IsOnBoundary(position, minCorner, maxCorner, cellSize)) {
+			VOXELS_CHECK(positions.count(ToKey(position)) == 1);
+		}
+	}
+
+	// the unused vertices are removed
+	std::vector<char> used(simplifiedVerticesCount, 0);
+	for (unsigned i = 0; i < simplifiedIndicesCount; ++i) {
+		VOXELS_CHECK(simplifiedIndices[i] < simplifiedVerticesCount);
+		if (simplifiedIndices[i] < simplifiedVerticesCount) {
+			used[simplifiedIndices[i]] = 1;
+		}
+	}
+	VOXELS_CHECK(std::count(used.begin(), used.end(), 0) == 0);
+
+	if (groupByMaterial) {
+		std::set<unsigned char> materials;
+		std::set<unsigned char> simplifiedMaterials;
+		CheckRanges(block, materials);
+		CheckRanges(simplified, simplifiedMaterials);
+		VOXELS_CHECK(std::includes(materials.begin(), materials.end(), simplifiedMaterials.begin(), simplifiedMaterials.end()));
+	}
+}
+
+void CheckSimplification(bool groupByMaterial)
+{
+	auto grid = CreateTerrainGrid(128);
+	TestMaterialMap materials;
+	Polygonizer polygonizer;
+	PolygonizationOptions options;
+	options.GroupIndicesByMaterial = groupByMaterial;
+	polygonizer.SetOptions(options);
+	auto surface = polygonizer.Execute(*grid, &materials);
+	VOXELS_CHECK(surface->GetStatistics()->SimplificationTrianglesRemoved == 0);
+
+	for (unsigned level = 1; level < PolygonizationOptions::LEVELS_COUNT; ++level) {
+		options.SimplificationError[level] = 0.5f;
+	}
+	polygonizer.SetOptions(options);
+	auto simplified = polygonizer.Execute(*grid, &materials);
+
+	const auto blocks = HashBlocks(surface);
+	const auto simplifiedBlocks = HashBlocks(simplified);
+	VOXELS_CHECK(simplified->GetLevelsCount() == surface->GetLevelsCount());
+	for (unsigned level = 0; level < surface->GetLevelsCount(); ++level) {
+		const auto blocksCount = surface->GetBlocksForLevelCount(level);
+		VOXELS_CHECK(simplified->GetBlocksForLevelCount(level) == blocksCount);
+		if (simplified->GetBlocksForLevelCount(level) != blocksCount)
+			continue;
+		for (unsigned blockId = 0; blockId < blocksCount; ++blockId) {
+			const auto block = surface->GetBlockForLevel(level, blockId);
+			const auto simplifiedBlock = simplified->GetBlockForLevel(level, blockId);
+			const auto key = BlockKey(level, block->GetMinimalCorner());
+			if (level == 0) {
+				// level 0 is not simplified
+				VOXELS_CHECK(blocks.find(key)->second == simplifiedBlocks.find(key)->second);
+			} else {
+				CompareBlocks(block, simplifiedBlock, level, groupByMaterial);
+			}
+		}
+	}
+
+	const auto summary = SummarizeSurface(surface);
+	const auto simplifiedSummary = SummarizeSurface(simplified);
+	const auto removed = simplified->GetStatistics()->SimplificationTrianglesRemoved;
+	VOXELS_CHECK(removed > 0);
+	VOXELS_CHECK(simplifiedSummary.Indices + removed * 3 == summary.Indices);
+
+	simplified->Destroy();
+	surface->Destroy();
+	grid->Destroy();
+}
+
+}
+
+int main()
+{
+	LibraryScope library;
+
+	CheckSimplification(false);
+	CheckSimplification(true);
+
+	return TestResult();
+}
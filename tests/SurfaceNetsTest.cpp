@@ -0,0 +1,156 @@
+// Copyright (c) 2013-2016, Stoyan Nikolov
+// All rights reserved.
+// Voxels Library, please see LICENSE for licensing details.
+
+// Polygonizes a grid with Surface Nets and checks the LOD levels, the skirts
+// on the faces between the blocks and that modifications keep the method.
+
+#include "TestCommon.h"
+
+#include <set>
+#include <tuple>
+
+using namespace VoxelsTests;
+
+namespace
+{
+
+bool IsInside(const float3& position, const float3& minCorner, const float3& maxCorner, float tolerance)
+{
+	return position.x >= minCorner.x - tolerance && position.x <= maxCorner.x + tolerance
+		&& position.y >= minCorner.y - tolerance && position.y <= maxCorner.y + tolerance
+		&& position.z >= minCorner.z - tolerance && position.z <= maxCorner.z + tolerance;
+}
+
+float GetAxis(const float3& position, unsigned axis)
+{
+	return axis == 0 ? position.x : (axis == 1 ? position.y : position.z);
+}
+
+// Every skirt vertex pair is a vertex of the regular mesh on the face of the block
+// and a copy of it below the mesh and past the face. Returns the count of skirt
+// triangles.
+unsigned CheckSkirts(const BlockPolygons* block, unsigned level, const float3& gridExtents)
+{
+	const float cellSize = float(1 << level);
+	const float depth = 2.f * cellSize;
+	const auto minCorner = block->GetMinimalCorner();
+	const auto maxCorner = block->GetMaximalCorner();
+	const float3 blockMin(minCorner.x + depth, minCorner.y + depth, minCorner.z + depth);
+	const float blockSize = 16.f * cellSize;
+
+	unsigned verticesCount = 0;
+	const auto vertices = block->GetVertices(&verticesCount);
+	std::set<std::tuple<float, float, float>> positions;
+	for (unsigned i = 0; i < verticesCount; ++i) {
+		positions.insert(std::make_tuple(vertices[i].Position.x, vertices[i].Position.y, vertices[i].Position.z));
+	}
+
+	unsigned triangles = 0;
+	for (unsigned face = 0; face < BlockPolygons::Face_Count; ++face) {
+		const auto faceId = BlockPolygons::TransitionFaceId(face);
+		unsigned skirtVerticesCount = 0;
+		unsigned skirtIndicesCount = 0;
+		const auto skirtVertices = block->GetTransitionVertices(faceId, &skirtVerticesCount);
+		const auto skirtIndices = block->GetTransitionIndices(faceId, &skirtIndicesCount);
+		VOXELS_CHECK(skirtVerticesCount % 2 == 0);
+		VOXELS_CHECK(skirtIndicesCount % 6 == 0);
+		triangles += skirtIndicesCount / 3;
+
+		// the faces go Y-, Z-, X-, Y+, Z+, X+ and the ones at the grid boundary have no skirt
+		const unsigned axis = face % 3 == 0 ? 1 : (face % 3 == 1 ? 2 : 0);
+		const bool positive = face >= 3;
+		const float facePosition = GetAxis(blockMin, axis) + (positive ? blockSize : 0.f);
+		if (facePosition == 0.f || facePosition >= GetAxis(gridExtents, axis) - 1.f) {
+			VOXELS_CHECK(skirtIndicesCount == 0);
+		}
+
+		for (unsigned i = 0; i + 1 < skirtVerticesCount; i += 2) {
+			const auto& upper = skirtVertices[i];
+			const auto& lower = skirtVertices[i + 1];
+			VOXELS_CHECK(positions.count(std::make_tuple(upper.Position.x, upper.Position.y, upper.Position.z)) == 1);
+			// the vertices of the faces are in the first cell of the block or of the neighbor
+			const float position = GetAxis(upper.Position, axis);
+			VOXELS_CHECK(position >= facePosition - 0.001f && position <= facePosition + cellSize + 0.001f);
+			// the lower vertex is moved along the normal into the volume and past the face
+			const float3 expected(upper.Position.x - upper.Normal.x * depth,
+				upper.Position.y - upper.Normal.y * depth,
+				upper.Position.z - upper.Normal.z * depth);
+			for (unsigned other = 0; other < 3; ++other) {
+				if (other != axis) {
+					VOXELS_CHECK(std::abs(GetAxis(lower.Position, other) - GetAxis(expected, other)) < 0.01f);
+				}
+			}
+			const float lowerPosition = GetAxis(lower.Position, axis);
+			VOXELS_CHECK(positive ? lowerPosition >= facePosition + depth - 0.001f : lowerPosition <= facePosition - depth + 0.001f);
+			VOXELS_CHECK(IsInside(lower.Position, minCorner, maxCorner, 0.001f));
+		}
+		for (unsigned i = 0; i < skirtIndicesCount; ++i) {
+			VOXELS_CHECK(skirtIndices[i] < skirtVerticesCount);
+		}
+	}
+	return triangles;
+}
+
+}
+
+int main()
+{
+	LibraryScope library;
+
+	auto grid = CreateTerrainGrid(64);
+	const float3 gridExtents(float(grid->GetWidth()), float(grid->GetHeight()), float(grid->GetDepth()));
+	TestMaterialMap materials;
+	Polygonizer polygonizer;
+	auto transVoxel = polygonizer.Execute(*grid, &materials);
+
+	PolygonizationOptions options;
+	options.Method = MM_SurfaceNets;
+	polygonizer.SetOptions(options);
+	auto surface = polygonizer.Execute(*grid, &materials);
+
+	// the same levels and blocks as TransVoxel, with fewer vertices
+	VOXELS_CHECK(surface->GetLevelsCount() == transVoxel->GetLevelsCount());
+	VOXELS_CHECK(surface->GetLevelsCount() > 1);
+	for (unsigned level = 0; level < surface->GetLevelsCount(); ++level) {
+		VOXELS_CHECK(surface->GetBlocksForLevelCount(level) > 0);
+		VOXELS_CHECK(surface->GetBlocksForLevelCount(level) == transVoxel->GetBlocksForLevelCount(level));
+	}
+	unsigned verticesCount = 0;
+	unsigned transVoxelVerticesCount = 0;
+	for (unsigned blockId = 0; blockId < surface->GetBlocksForLevelCount(0); ++blockId) {
+		unsigned count = 0;
+		surface->GetBlockForLevel(0, blockId)->GetVertices(&count);
+		verticesCount += count;
+		transVoxel->GetBlockForLevel(0, blockId)->GetVertices(&count);
+		transVoxelVerticesCount += count;
+	}
+	VOXELS_CHECK(verticesCount > 0 && verticesCount < transVoxelVerticesCount);
+
+	// the blocks below the top level have skirts on the faces between them
+	const auto topLevel = surface->GetLevelsCount() - 1;
+	for (unsigned level = 0; level < surface->GetLevelsCount(); ++level) {
+		unsigned skirtTriangles = 0;
+		for (unsigned blockId = 0; blockId < surface->GetBlocksForLevelCount(level); ++blockId) {
+			skirtTriangles += CheckSkirts(surface->GetBlockForLevel(level, blockId), level, gridExtents);
+		}
+		VOXELS_CHECK(level == topLevel ? skirtTriangles == 0 : skirtTriangles > 0);
+	}
+
+	auto modification = Modification::Create();
+	modification->Map = surface;
+	DigSphere(grid, modification);
+	VOXELS_CHECK(polygonizer.Execute(*grid, &materials, modification) == surface);
+	VOXELS_CHECK(surface->GetStatistics()->BlocksCalculated > 0);
+
+	auto expected = polygonizer.Execute(*grid, &materials);
+	VOXELS_CHECK(HashBlocks(surface) == HashBlocks(expected));
+
+	modification->Destroy();
+	expected->Destroy();
+	surface->Destroy();
+	transVoxel->Destroy();
+	grid->Destroy();
+
+	return TestResult();
+}
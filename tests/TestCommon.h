@@ -0,0 +1,337 @@
+// Copyright (c) 2013-2016, Stoyan Nikolov
+// All rights reserved.
+// Voxels Library, please see LICENSE for licensing details.
+#pragma once
+
+// Helpers shared by the tests. Every test is a separate executable that
+// builds small deterministic grids, polygonizes them and returns a non-zero
+// code if any check fails.
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "../include/Voxels.h"
+
+namespace VoxelsTests
+{
+
+using namespace Voxels;
+
+static unsigned g_Failures = 0;
+
+#define VOXELS_CHECK(condition) \
+	do { \
+		if (!(condition)) { \
+			++VoxelsTests::g_Failures; \
+			printf("%s(%d): check failed: %s\n", __FILE__, __LINE__, #condition); \
+		} \
+	} while (false)
+
+// A bowl-shaped terrain with a cave. All values are computed with correctly
+// rounded operations only, so every compiler produces the same grid.
+class TerrainSurface : public VoxelSurface
+{
+public:
+	virtual void GetSurface(float xStart, float xEnd, float xStep,
+							float yStart, float yEnd, float yStep,
+							float zStart, float zEnd, float zStep,
+							float* output,
+							unsigned char* materialid,
+							unsigned char* blend) override
+	{
+		unsigned id = 0;
+		for (float z = zStart; z < zEnd; z += zStep) {
+			for (float y = yStart; y < yEnd; y += yStep) {
+				for (float x = xStart; x < xEnd; x += xStep, ++id) {
+					const float height = 20.f + ((x - 20.f) * (x - 20.f) + (y - 40.f) * (y - 40.f)) / 96.f;
+					const float dx = x - 36.f;
+					const float dy = y - 30.f;
+					const float dz = z - 22.f;
+					const float cave = 9.f - std::sqrt(dx * dx + dy * dy + dz * dz);
+					output[id] = std::max(z - height, cave);
+
+					const int ix = int(x);
+					const int iy = int(y);
+					const int iz = int(z);
+					if (materialid)
+						materialid[id] = (unsigned char)((ix / 9 + iy / 7 + iz / 5) % 3);
+					if (blend)
+						blend[id] = (unsigned char)((ix * iy + iz) & 0xFF);
+				}
+			}
+		}
+	}
+};
+
+class SphereSurface : public VoxelSurface
+{
+public:
+	virtual void GetSurface(float xStart, float xEnd, float xStep,
+							float yStart, float yEnd, float yStep,
+							float zStart, float zEnd, float zStep,
+							float* output,
+							unsigned char*,
+							unsigned char*) override
+	{
+		unsigned id = 0;
+		for (float z = zStart; z < zEnd; z += zStep) {
+			for (float y = yStart; y < yEnd; y += yStep) {
+				for (float x = xStart; x < xEnd; x += xStep) {
+					output[id++] = std::sqrt(x * x + y * y + z * z) - 6.f;
+				}
+			}
+		}
+	}
+};
+
+class TestMaterialMap : public MaterialMap
+{
+public:
+	static const unsigned MATERIALS_COUNT = 3;
+
+	TestMaterialMap()
+	{
+		for (unsigned i = 0; i < MATERIALS_COUNT; ++i) {
+			for (unsigned j = 0; j < 3; ++j) {
+				m_Materials[i].DiffuseIds0[j] = (unsigned char)(i * 10 + j);
+				m_Materials[i].DiffuseIds1[j] = (unsigned char)(i * 10 + j + 5);
+			}
+		}
+	}
+
+	virtual Material* GetMaterial(unsigned char id) const override
+	{
+		return id < MATERIALS_COUNT ? const_cast<Material*>(&m_Materials[id]) : nullptr;
+	}
+
+private:
+	Material m_Materials[MATERIALS_COUNT];
+};
+
+inline void PrintLogMessage(LogSeverity severity, const char* message)
+{
+	if (severity >= LS_Warning) {
+		printf("%s\n", message);
+	}
+}
+
+// Initializes the library for the lifetime of a test
+class LibraryScope
+{
+public:
+	LibraryScope()
+	{
+		if (InitializeVoxels(VOXELS_VERSION, &PrintLogMessage, nullptr) != IE_Ok) {
+			printf("Unable to initialize the library\n");
+			++g_Failures;
+		}
+	}
+
+	~LibraryScope()
+	{
+		DeinitializeVoxels();
+	}
+};
+
+inline int TestResult()
+{
+	printf("%u failed checks\n", g_Failures);
+	return g_Failures ? 1 : 0;
+}
+
+inline Grid* CreateTerrainGrid(unsigned size)
+{
+	TerrainSurface terrain;
+	return Grid::Create(size, size, size, 0.f, 0.f, 0.f, 1.f, &terrain);
+}
+
+// Digs a sphere in the terrain and sets the dirty region of the modification
+inline void DigSphere(Grid* grid, Modification* modification)
+{
+	SphereSurface sphere;
+	const auto modified = grid->InjectSurface(float3(30.f, 30.f, 24.f), float3(8.f, 8.f, 8.f), &sphere, IT_Subtract);
+	modification->MinCornerModified = modified.first;
+	modification->MaxCornerModified = modified.second;
+}
+
+// FNV-1a of the output. Positions are rounded to 1/16 of a cell and the
+// normals are left out, so that floating-point differences between
+// compilers don't change the hashes.
+class Hasher
+{
+public:
+	Hasher()
+		: m_Hash(14695981039346656037ull)
+	{}
+
+	void Add(const void* data, size_t size)
+	{
+		auto bytes = static_cast<const unsigned char*>(data);
+		for (size_t i = 0; i < size; ++i) {
+			m_Hash ^= bytes[i];
+			m_Hash *= 1099511628211ull;
+		}
+	}
+
+	void Add(unsigned value)
+	{
+		Add(&value, sizeof(value));
+	}
+
+	void Add(float value)
+	{
+		Add(unsigned(int(std::floor(value * 16.f + 0.5f))));
+	}
+
+	void Add(const float3& value)
+	{
+		Add(value.x);
+		Add(value.y);
+		Add(value.z);
+	}
+
+	unsigned long long GetHash() const { return m_Hash; }
+
+private:
+	unsigned long long m_Hash;
+};
+
+inline void AddVertices(const PolygonVertex* vertices, unsigned count, Hasher& hasher)
+{
+	for (unsigned i = 0; i < count; ++i) {
+		const auto& vertex = vertices[i];
+		hasher.Add(vertex.Position);
+		unsigned flags;
+		memcpy(&flags, &vertex.SecondaryPosition.w, sizeof(flags));
+		hasher.Add(flags);
+		if (flags) {
+			hasher.Add(vertex.SecondaryPosition.x);
+			hasher.Add(vertex.SecondaryPosition.y);
+			hasher.Add(vertex.SecondaryPosition.z);
+		}
+		hasher.Add(vertex.Textures.TI, sizeof(vertex.Textures.TI));
+	}
+}
+
+struct MeshCounts
+{
+	unsigned Vertices;
+	unsigned Indices;
+};
+
+// Hashes the regular and transition meshes of a block in the full vertex format
+inline MeshCounts AddBlock(const BlockPolygons* block, Hasher& hasher)
+{
+	MeshCounts counts = { 0, 0 };
+	unsigned verticesCount = 0;
+	unsigned indicesCount = 0;
+	auto vertices = block->GetVertices(&verticesCount);
+	auto indices = block->GetIndices(&indicesCount);
+	AddVertices(vertices, verticesCount, hasher);
+	hasher.Add(indices, indicesCount * sizeof(unsigned));
+	counts.Vertices += verticesCount;
+	counts.Indices += indicesCount;
+	for (unsigned face = 0; face < BlockPolygons::Face_Count; ++face) {
+		const auto faceId = BlockPolygons::TransitionFaceId(face);
+		vertices = block->GetTransitionVertices(faceId, &verticesCount);
+		indices = block->GetTransitionIndices(faceId, &indicesCount);
+		AddVertices(vertices, verticesCount, hasher);
+		hasher.Add(indices, indicesCount * sizeof(unsigned));
+		counts.Vertices += verticesCount;
+		counts.Indices += indicesCount;
+	}
+	return counts;
+}
+
+struct SurfaceSummary
+{
+	unsigned Levels;
+	unsigned Blocks;
+	unsigned Vertices;
+	unsigned Indices;
+	unsigned long long Hash;
+};
+
+// Summarizes a surface in the full vertex format, the blocks in the order
+// of the levels of the surface
+inline SurfaceSummary SummarizeSurface(const PolygonSurface* surface)
+{
+	SurfaceSummary summary = { surface->GetLevelsCount(), 0, 0, 0, 0 };
+	Hasher hasher;
+	for (unsigned level = 0; level < summary.Levels; ++level) {
+		const auto blocksCount = surface->GetBlocksForLevelCount(level);
+		for (unsigned blockId = 0; blockId < blocksCount; ++blockId) {
+			const auto block = surface->GetBlockForLevel(level, blockId);
+			++summary.Blocks;
+			hasher.Add(level);
+			hasher.Add(block->GetMinimalCorner());
+			const auto counts = AddBlock(block, hasher);
+			summary.Vertices += counts.Vertices;
+			summary.Indices += counts.Indices;
+		}
+	}
+	summary.Hash = hasher.GetHash();
+	return summary;
+}
+
+inline bool operator==(const SurfaceSummary& lhs, const SurfaceSummary& rhs)
+{
+	return lhs.Levels == rhs.Levels
+		&& lhs.Blocks == rhs.Blocks
+		&& lhs.Vertices == rhs.Vertices
+		&& lhs.Indices == rhs.Indices
+		&& lhs.Hash == rhs.Hash;
+}
+
+inline void PrintSummary(const char* name, const SurfaceSummary& summary)
+{
+	printf("%s: { %u, %u, %u, %u, 0x%016llxull }\n", name,
+		summary.Levels, summary.Blocks, summary.Vertices, summary.Indices, summary.Hash);
+}
+
+// The hash of every block keyed by its level and minimal corner. Compares
+// surfaces whose blocks are stored in a different order.
+typedef std::map<std::string, unsigned long long> BlockHashes;
+
+inline std::string BlockKey(unsigned level, const float3& corner)
+{
+	char key[64];
+	snprintf(key, sizeof(key), "%u (%g %g %g)", level, corner.x, corner.y, corner.z);
+	return key;
+}
+
+inline BlockHashes HashBlocks(const PolygonSurface* surface)
+{
+	BlockHashes hashes;
+	for (unsigned level = 0; level < surface->GetLevelsCount(); ++level) {
+		const auto blocksCount = surface->GetBlocksForLevelCount(level);
+		for (unsigned blockId = 0; blockId < blocksCount; ++blockId) {
+			const auto block = surface->GetBlockForLevel(level, blockId);
+			Hasher hasher;
+			AddBlock(block, hasher);
+			hashes[BlockKey(level, block->GetMinimalCorner())] = hasher.GetHash();
+		}
+	}
+	return hashes;
+}
+
+// The count of blocks of the subset that are missing or different in the surface
+inline unsigned CountDifferentBlocks(const BlockHashes& subset, const BlockHashes& surface)
+{
+	unsigned different = 0;
+	for (auto block = subset.cbegin(); block != subset.cend(); ++block) {
+		const auto found = surface.find(block->first);
+		if (found == surface.cend() || found->second != block->second) {
+			++different;
+		}
+	}
+	return different;
+}
+
+}
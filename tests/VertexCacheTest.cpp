@@ -0,0 +1,134 @@
+// Copyright (c) 2013-2016, Stoyan Nikolov
+// All rights reserved.
+// Voxels Library, please see LICENSE for licensing details.
+
+// Checks that the vertex cache optimization only reorders the triangles and
+// the vertices of the blocks and reduces the simulated cache misses.
+
+#include "TestCommon.h"
+
+using namespace VoxelsTests;
+
+namespace
+{
+
+typedef std::vector<unsigned long long> Triangle;
+typedef std::vector<Triangle> Triangles;
+
+unsigned long long HashVertex(const PolygonVertex& vertex)
+{
+	Hasher hasher;
+	AddVertices(&vertex, 1, hasher);
+	return hasher.GetHash();
+}
+
+// The triangles of a mesh by the data of their vertices. Every triangle
+// starts with its smallest vertex so that the winding is kept.
+Triangles CollectTriangles(const PolygonVertex* vertices, const unsigned* indices, unsigned indicesCount)
+{
+	Triangles triangles;
+	for (unsigned i = 0; i < indicesCount; i += 3) {
+		Triangle triangle;
+		for (unsigned corner = 0; corner < 3; ++corner) {
+			triangle.push_back(HashVertex(vertices[indices[i + corner]]));
+		}
+		std::rotate(triangle.begin(), std::min_element(triangle.begin(), triangle.end()), triangle.end());
+		triangles.push_back(triangle);
+	}
+	std::sort(triangles.begin(), triangles.end());
+	return triangles;
+}
+
+// The optimized vertices are in the order the triangles first use them. The
+// vertices no triangle uses are kept after the used ones.
+bool AreVerticesInUseOrder(const unsigned* indices, unsigned indicesCount, unsigned verticesCount)
+{
+	unsigned nextVertex = 0;
+	for (unsigned i = 0; i < indicesCount; ++i) {
+		if (indices[i] == nextVertex) {
+			++nextVertex;
+		} else if (indices[i] > nextVertex) {
+			return false;
+		}
+	}
+	return nextVertex <= verticesCount;
+}
+
+void CompareMeshes(const PolygonVertex* vertices,
+	unsigned verticesCount,
+	const unsigned* indices,
+	unsigned indicesCount,
+	const PolygonVertex* optimizedVertices,
+	unsigned optimizedVerticesCount,
+	const unsigned* optimizedIndices,
+	unsigned optimizedIndicesCount)
+{
+	VOXELS_CHECK(optimizedVerticesCount == verticesCount);
+	VOXELS_CHECK(optimizedIndicesCount == indicesCount);
+	VOXELS_CHECK(CollectTriangles(vertices, indices, indicesCount)
+		== CollectTriangles(optimizedVertices, optimizedIndices, optimizedIndicesCount));
+	VOXELS_CHECK(AreVerticesInUseOrder(optimizedIndices, optimizedIndicesCount, optimizedVerticesCount));
+}
+
+void CompareBlocks(const BlockPolygons* block, const BlockPolygons* optimized)
+{
+	unsigned verticesCount = 0;
+	unsigned indicesCount = 0;
+	unsigned optimizedVerticesCount = 0;
+	unsigned optimizedIndicesCount = 0;
+	const auto vertices = block->GetVertices(&verticesCount);
+	const auto indices = block->GetIndices(&indicesCount);
+	const auto optimizedVertices = optimized->GetVertices(&optimizedVerticesCount);
+	const auto optimizedIndices = optimized->GetIndices(&optimizedIndicesCount);
+	CompareMeshes(vertices, verticesCount, indices, indicesCount, optimizedVertices, optimizedVerticesCount, optimizedIndices, optimizedIndicesCount);
+
+	for (unsigned face = 0; face < BlockPolygons::Face_Count; ++face) {
+		const auto faceId = BlockPolygons::TransitionFaceId(face);
+		const auto transitionVertices = block->GetTransitionVertices(faceId, &verticesCount);
+		const auto transitionIndices = block->GetTransitionIndices(faceId, &indicesCount);
+		const auto optimizedTransitionVertices = optimized->GetTransitionVertices(faceId, &optimizedVerticesCount);
+		const auto optimizedTransitionIndices = optimized->GetTransitionIndices(faceId, &optimizedIndicesCount);
+		CompareMeshes(transitionVertices, verticesCount, transitionIndices, indicesCount,
+			optimizedTransitionVertices, optimizedVerticesCount, optimizedTransitionIndices, optimizedIndicesCount);
+	}
+}
+
+}
+
+int main()
+{
+	LibraryScope library;
+
+	auto grid = CreateTerrainGrid(64);
+	TestMaterialMap materials;
+	Polygonizer polygonizer;
+	auto surface = polygonizer.Execute(*grid, &materials);
+	VOXELS_CHECK(surface->GetStatistics()->CacheOptimizedTriangles == 0);
+
+	PolygonizationOptions options;
+	options.OptimizeVertexCache = true;
+	polygonizer.SetOptions(options);
+	auto optimized = polygonizer.Execute(*grid, &materials);
+
+	const auto summary = SummarizeSurface(surface);
+	VOXELS_CHECK(optimized->GetLevelsCount() == surface->GetLevelsCount());
+	for (unsigned level = 0; level < surface->GetLevelsCount(); ++level) {
+		const auto blocksCount = surface->GetBlocksForLevelCount(level);
+		VOXELS_CHECK(optimized->GetBlocksForLevelCount(level) == blocksCount);
+		if (optimized->GetBlocksForLevelCount(level) != blocksCount)
+			continue;
+		for (unsigned blockId = 0; blockId < blocksCount; ++blockId) {
+			CompareBlocks(surface->GetBlockForLevel(level, blockId), optimized->GetBlockForLevel(level, blockId));
+		}
+	}
+
+	const auto stats = optimized->GetStatistics();
+	VOXELS_CHECK(stats->CacheOptimizedTriangles == summary.Indices / 3);
+	VOXELS_CHECK(stats->VertexCacheMissesAfter < stats->VertexCacheMissesBefore);
+
+	optimized->Destroy();
+	surface->Destroy();
+	grid->Destroy();
+
+	return TestResult();
+}